@@ -1,5 +1,230 @@
 #include "umilog.hpp"
+#include "umilog_transport.hpp"
+#include "relp_server.hpp"
+#include "tls_server.hpp"
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <set>
+
+/**
+ * Collector listening on localhost used to check what the logger sends
+ * */
+class udp_sink {
+public:
+    udp_sink()
+            : m_socket(m_ioservice, boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {
+        receive();
+        m_thread = std::thread([this]() { m_ioservice.run(); });
+    }
+
+    ~udp_sink() {
+        m_ioservice.stop();
+        m_thread.join();
+    }
+
+    int port() const {
+        return m_socket.local_endpoint().port();
+    }
+
+    std::vector<std::string> messages() {
+        std::unique_lock<std::mutex> _lock(m_mutex);
+        return m_messages;
+    }
+
+private:
+    void receive() {
+        m_socket.async_receive_from(
+                boost::asio::buffer(m_buffer), m_remote,
+                [this](const boost::system::error_code &error, std::size_t size) {
+                    if (!error) {
+                        std::unique_lock<std::mutex> _lock(m_mutex);
+                        m_messages.emplace_back(m_buffer.data(), size);
+                    }
+                    receive();
+                });
+    }
+
+    boost::asio::io_service m_ioservice;
+    boost::asio::ip::udp::socket m_socket;
+    boost::asio::ip::udp::endpoint m_remote;
+    std::array<char, 1024 * 64> m_buffer;
+    std::mutex m_mutex;
+    std::vector<std::string> m_messages;
+    std::thread m_thread;
+};
+
+/**
+ * TCP collector listening on localhost, keeps the stream of every connection
+ * */
+class tcp_sink {
+public:
+    explicit tcp_sink(int port = 0)
+            : m_acceptor(m_ioservice, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(),
+                                                                     static_cast<unsigned short>(port))) {
+        accept();
+        m_thread = std::thread([this]() { m_ioservice.run(); });
+    }
+
+    ~tcp_sink() {
+        m_ioservice.stop();
+        m_thread.join();
+    }
+
+    int port() const {
+        return m_acceptor.local_endpoint().port();
+    }
+
+    std::vector<std::string> streams() {
+        std::unique_lock<std::mutex> _lock(m_mutex);
+        std::vector<std::string> _streams;
+        for (auto &i: m_connections) {
+            _streams.push_back(i->m_data);
+        }
+        return _streams;
+    }
+
+    /**
+     * Gets the connections closed by the logger
+     * */
+    std::size_t closed() const {
+        return m_closed;
+    }
+
+private:
+    struct connection {
+        explicit connection(boost::asio::io_service &service) : m_socket(service) { }
+
+        boost::asio::ip::tcp::socket m_socket;
+        std::array<char, 1024 * 64> m_buffer;
+        std::string m_data;
+    };
+
+    void accept() {
+        auto _connection = std::make_shared<connection>(m_ioservice);
+        m_acceptor.async_accept(_connection->m_socket, [this, _connection](const boost::system::error_code &error) {
+            if (!error) {
+                {
+                    std::unique_lock<std::mutex> _lock(m_mutex);
+                    m_connections.push_back(_connection);
+                }
+                read(_connection);
+            }
+            accept();
+        });
+    }
+
+    void read(std::shared_ptr<connection> c) {
+        c->m_socket.async_read_some(boost::asio::buffer(c->m_buffer),
+                                    [this, c](const boost::system::error_code &error, std::size_t size) {
+                                        if (!error) {
+                                            {
+                                                std::unique_lock<std::mutex> _lock(m_mutex);
+                                                c->m_data.append(c->m_buffer.data(), size);
+                                            }
+                                            read(c);
+                                        } else {
+                                            ++m_closed;
+                                        }
+                                    });
+    }
+
+    boost::asio::io_service m_ioservice;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    std::mutex m_mutex;
+    std::vector<std::shared_ptr<connection>> m_connections;
+    std::atomic<std::size_t> m_closed{0};
+    std::thread m_thread;
+};
+
+/**
+ * TCP collector that accepts the connections and never reads them, the writers stall
+ * */
+class stalled_sink {
+public:
+    stalled_sink()
+            : m_acceptor(m_ioservice, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {
+        // A small window fills at once, the accepted connections inherit it
+        m_acceptor.set_option(boost::asio::socket_base::receive_buffer_size(4096));
+        accept();
+        m_thread = std::thread([this]() { m_ioservice.run(); });
+    }
+
+    ~stalled_sink() {
+        m_ioservice.stop();
+        m_thread.join();
+    }
+
+    int port() const {
+        return m_acceptor.local_endpoint().port();
+    }
+
+private:
+    void accept() {
+        auto _socket = std::make_shared<boost::asio::ip::tcp::socket>(m_ioservice);
+        m_acceptor.async_accept(*_socket, [this, _socket](const boost::system::error_code &error) {
+            if (!error) {
+                m_sockets.push_back(_socket);
+            }
+            accept();
+        });
+    }
+
+    boost::asio::io_service m_ioservice;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    std::vector<std::shared_ptr<boost::asio::ip::tcp::socket>> m_sockets;
+    std::thread m_thread;
+};
+
+static std::size_t count_containing(const std::vector<std::string> &messages, const std::string &text) {
+    return static_cast<std::size_t>(std::count_if(messages.begin(), messages.end(), [&](const std::string &m) {
+        return m.find(text) != std::string::npos;
+    }));
+}
+
+static std::size_t count_text(const std::string &data, const std::string &text) {
+    std::size_t count = 0;
+    for (std::size_t position = data.find(text); position != std::string::npos;
+         position = data.find(text, position + text.size())) {
+        ++count;
+    }
+    return count;
+}
+
+/**
+ * Splits a TCP or TLS stream in its messages by their length, "MSG-LEN SP SYSLOG-MSG",
+ * a malformed or cut frame ends it with an empty message
+ * */
+static std::vector<std::string> split_frames(const std::string &data) {
+    std::vector<std::string> messages;
+    std::size_t position = 0;
+    while (position < data.size()) {
+        const std::size_t space = data.find(' ', position);
+        if (space == std::string::npos || space == position ||
+            data.find_first_not_of("0123456789", position) != space) {
+            messages.emplace_back();
+            break;
+        }
+        const std::size_t size = std::stoul(data.substr(position, space - position));
+        if (space + 1 + size > data.size()) {
+            messages.emplace_back();
+            break;
+        }
+        messages.push_back(data.substr(space + 1, size));
+        position = space + 1 + size;
+    }
+    return messages;
+}
+
+/**
+ * Waits until the condition holds, the collectors read in their own thread after a flush
+ * */
+template<typename Condition>
+static bool eventually(Condition condition) {
+    for (int i = 0; i < 400 && !condition(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return condition();
+}
 
 TEST(basic_check, test_eq) {
     EXPECT_EQ(1, 1);
@@ -10,7 +235,7 @@ TEST(basic_check, test_eq) {
     umi::log::logger log(loggerData, loggerConnection);
     log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "AAA", "Hello %d my dear friend %s", 11,
             "jose");
-    sleep(2);
+    log.flush(std::chrono::seconds(2));
 }
 
 TEST(basic_check, test_eq_2) {
@@ -29,5 +254,1193 @@ TEST(basic_check, test_eq_2) {
     data_test_1,
       "Hello %d my dear friend %s", 11,
     "jose");
-    sleep(2);
-}
\ No newline at end of file
+    log.flush(std::chrono::seconds(2));
+}
+
+TEST(rate_limit, suppressed_summary) {
+    udp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_rate_limit(umi::log::rate_limit(20.0, 2));
+    std::vector<umi::log::connection> loggerConnection{
+            umi::log::connection(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(), std::string())};
+    umi::log::logger log(loggerData, loggerConnection);
+    for (int i = 0; i < 10; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "RETRY", "attempt %d", i);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "RETRY", "attempt %d", 10);
+    // other keys own their own bucket
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "OTHER", "unrelated");
+    ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    ASSERT_TRUE(eventually([&sink]() { return count_containing(sink.messages(), "unrelated") == 1; }));
+    auto messages = sink.messages();
+    EXPECT_EQ(3u, count_containing(messages, "attempt"));
+    EXPECT_EQ(1u, count_containing(messages, "[umilog@32473 suppressed=\"8\"]"));
+    EXPECT_EQ(1u, count_containing(messages, "unrelated"));
+}
+
+TEST(rate_limit, summary_swept_without_new_calls) {
+    udp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    umi::log::rate_limit limit(1.0, 2);
+    limit.set_sweep_interval(std::chrono::milliseconds(50));
+    loggerData.set_rate_limit(limit);
+    std::vector<umi::log::connection> loggerConnection{
+            umi::log::connection(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(), std::string())};
+    umi::log::logger log(loggerData, loggerConnection);
+    for (int i = 0; i < 10; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "BURST", "attempt %d", i);
+    }
+    // The key never logs again, the sweep reports it once
+    ASSERT_TRUE(eventually([&sink]() {
+        return count_containing(sink.messages(), "[umilog@32473 suppressed=\"8\"]") == 1;
+    }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    const auto messages = sink.messages();
+    EXPECT_EQ(1u, count_containing(messages, "suppressed="));
+    EXPECT_EQ(1u, count_containing(messages, " BURST [umilog@32473 suppressed=\"8\"] suppressed 8 messages"));
+}
+
+TEST(rate_limit, idle_buckets_evicted) {
+    umi::log::rate_limiter limiter(umi::log::rate_limit(1000.0, 2));
+    uint64_t suppressed = 0;
+    for (int i = 0; i < 100; ++i) {
+        limiter.try_acquire(static_cast<uint64_t>(i), 11, "Test", "KEY", "site", suppressed);
+    }
+    // A key with suppressed messages is kept until they are reported
+    for (int i = 0; i < 3; ++i) {
+        limiter.try_acquire(1000, 11, "Test", "HOT", "site", suppressed);
+    }
+    EXPECT_EQ(101u, limiter.get_bucket_count());
+    std::this_thread::sleep_for(std::chrono::milliseconds(20)); // the buckets refill
+    const auto calls = limiter.sweep();
+    ASSERT_EQ(1u, calls.size());
+    EXPECT_EQ(1u, calls[0].m_count);
+    EXPECT_EQ("HOT", calls[0].m_msgid);
+    EXPECT_EQ(1u, limiter.get_bucket_count());
+    EXPECT_TRUE(limiter.sweep().empty());
+    EXPECT_EQ(0u, limiter.get_bucket_count());
+}
+
+TEST(dedup, different_header_not_collapsed) {
+    udp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_dedup_window(std::chrono::milliseconds(200));
+    std::vector<umi::log::connection> loggerConnection{
+            umi::log::connection(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(), std::string())};
+    umi::log::logger log(loggerData, loggerConnection);
+    // One call site and one body, the app or the msgid tell them apart
+    const std::array<std::pair<const char *, const char *>, 4> origins{{
+            {"Test", "CONN"}, {"Test", "DISK"}, {"Other", "DISK"}, {"Test", "CONN"}}};
+    for (auto &origin: origins) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, origin.first, origin.second, "refused");
+    }
+    ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    ASSERT_TRUE(eventually([&sink]() { return sink.messages().size() == 4; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_EQ(4u, count_containing(sink.messages(), "refused"));
+    EXPECT_EQ(0u, count_containing(sink.messages(), "repeated"));
+}
+
+TEST(dedup, collapse_repeats) {
+    udp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_dedup_window(std::chrono::milliseconds(200));
+    std::vector<umi::log::connection> loggerConnection{
+            umi::log::connection(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(), std::string())};
+    umi::log::logger log(loggerData, loggerConnection);
+    for (int i = 0; i < 50; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "CONN", "connection refused");
+    }
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "CONN", "connected");
+    for (int i = 0; i < 5; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "CONN", "connection refused");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(600));
+    auto messages = sink.messages();
+    ASSERT_EQ(5u, messages.size());
+    EXPECT_NE(std::string::npos, messages[0].find("connection refused"));
+    EXPECT_NE(std::string::npos, messages[1].find("[umilog@32473 repeated=\"49\"] last message repeated 49 times"));
+    EXPECT_NE(std::string::npos, messages[2].find("connected"));
+    EXPECT_NE(std::string::npos, messages[3].find("connection refused"));
+    // the last repeats are reported when the window expires
+    EXPECT_NE(std::string::npos, messages[4].find("last message repeated 4 times"));
+}
+
+TEST(sampling, one_in_n) {
+    udp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_sampling(umi::log::sampling(umi::log::severity::Informational, 10));
+    std::vector<umi::log::connection> loggerConnection{
+            umi::log::connection(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(), std::string())};
+    umi::log::logger log(loggerData, loggerConnection);
+    for (int i = 0; i < 1000; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Debug, "Test", "VERBOSE", "debug %d", i);
+    }
+    for (int i = 0; i < 20; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "IMPORTANT", "error %d", i);
+    }
+    ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    ASSERT_TRUE(eventually([&sink]() { return count_containing(sink.messages(), "error 19") == 1; }));
+    auto messages = sink.messages();
+    const std::size_t debugMessages = count_containing(messages, "VERBOSE");
+    EXPECT_GT(debugMessages, 40u);
+    EXPECT_LT(debugMessages, 200u);
+    EXPECT_EQ(debugMessages, count_containing(messages, "VERBOSE [umilog@32473 sample_rate=\"10\"] debug"));
+    EXPECT_EQ(20u, count_containing(messages, "IMPORTANT - error"));
+}
+
+TEST(sampling, per_second_per_site) {
+    umi::log::sampler sampler(umi::log::sampling(umi::log::severity::Debug, 1, 100.0));
+    const char *site = "site %d";
+    uint32_t sampleRate = 1;
+    // The first second there is no history, every call is kept
+    const auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1100)) {
+        sampler.sample(umi::log::severity::Debug, site, sampleRate);
+    }
+    std::size_t kept = 0;
+    for (int i = 0; i < 100000; ++i) {
+        if (sampler.sample(umi::log::severity::Debug, site, sampleRate)) {
+            ++kept;
+        }
+    }
+    EXPECT_LT(kept, 50000u);
+    // The kept messages carry the fraction used
+    sampleRate = 1;
+    while (!sampler.sample(umi::log::severity::Debug, site, sampleRate)) {
+    }
+    EXPECT_GT(sampleRate, 1u);
+}
+
+TEST(structured_data, builder_escapes_and_grows) {
+    umi::log::sd_builder sd;
+    EXPECT_TRUE(sd.empty());
+    sd.add_element("request@32473").add_param("id", "a\"b]c\\d").add_param("route", "/users");
+    sd.add_element("origin").add_param_non_escape("ip", "127.0.0.1");
+    EXPECT_EQ("[request@32473 id=\"a\\\"b\\]c\\\\d\" route=\"/users\"][origin ip=\"127.0.0.1\"]",
+              std::string(sd.get_data().data(), sd.get_data().size()));
+
+    // values bigger than the inline storage move the section to the heap
+    std::string big(umi::log::sd_builder::inline_size * 3, ']');
+    sd.clear();
+    sd.add_element("big").add_param("v", big);
+    EXPECT_EQ(umi::log::sd_builder::inline_size * 6 + 10, sd.get_data().size());
+}
+
+TEST(structured_data, builder_moves) {
+    umi::log::sd_builder small;
+    small.add_element("small").add_param("id", "1");
+    umi::log::sd_builder moved(std::move(small));
+    EXPECT_TRUE(small.empty());
+    // writing to the moved from builder does not touch the data that was inline
+    small.add_element("other");
+    moved.add_param("route", "/a");
+    EXPECT_EQ("[small id=\"1\" route=\"/a\"]", std::string(moved.get_data().data(), moved.get_data().size()));
+
+    umi::log::sd_builder big;
+    big.add_element("big").add_param("v", std::string(umi::log::sd_builder::inline_size, 'x'));
+    const std::string expected(big.get_data().data(), big.get_data().size());
+    moved = std::move(big);
+    EXPECT_TRUE(big.empty());
+    EXPECT_EQ(expected, std::string(moved.get_data().data(), moved.get_data().size()));
+    // the moved from builder is usable again
+    big.add_element("again");
+    EXPECT_EQ("[again]", std::string(big.get_data().data(), big.get_data().size()));
+}
+
+TEST(structured_data, builder_in_message) {
+    udp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    std::vector<umi::log::connection> loggerConnection{
+            umi::log::connection(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(), std::string())};
+    umi::log::logger log(loggerData, loggerConnection);
+    umi::log::sd_builder sd;
+    sd.add_element("request@32473").add_param("id", "42");
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "REQ", sd, "done in %d ms", 7);
+    umi::log::sd_builder empty;
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "REQ", empty, "no data");
+    ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    ASSERT_TRUE(eventually([&sink]() { return count_containing(sink.messages(), "no data") == 1; }));
+    auto messages = sink.messages();
+    EXPECT_EQ(1u, count_containing(messages, " REQ [request@32473 id=\"42\"] done in 7 ms"));
+    EXPECT_EQ(1u, count_containing(messages, " REQ - no data"));
+}
+
+TEST(encoding, find_escape_matches_scalar) {
+    std::string value(200, 'a');
+    for (std::size_t position : {0u, 15u, 16u, 31u, 32u, 63u, 150u, 199u}) {
+        for (char special : {'"', '\\', ']'}) {
+            std::string test = value;
+            test[position] = special;
+            const char *begin = test.data();
+            const char *end = test.data() + test.size();
+            EXPECT_EQ(umi::log::find_escape_scalar(begin, end), umi::log::find_escape(begin, end));
+            EXPECT_EQ(begin + position, umi::log::find_escape(begin, end));
+        }
+    }
+    EXPECT_EQ(value.data() + value.size(), umi::log::find_escape(value.data(), value.data() + value.size()));
+
+    std::string mixed;
+    for (int i = 0; i < 100; ++i) {
+        mixed += (i % 7 == 0) ? "\"" : (i % 11 == 0) ? "]" : "abc";
+    }
+    std::string scalar(mixed.size() * 2, '\0');
+    std::string simd(mixed.size() * 2, '\0');
+    scalar.resize(umi::log::escape_to_scalar(&scalar[0], mixed.data(), mixed.data() + mixed.size()) - scalar.data());
+    simd.resize(umi::log::escape_to(&simd[0], mixed.data(), mixed.data() + mixed.size()) - simd.data());
+    EXPECT_EQ(scalar, simd);
+}
+
+TEST(encoding, classify_utf8) {
+    using umi::log::utf8_kind;
+    auto classify = [](const std::string &v) { return umi::log::classify_utf8(v.data(), v.size()); };
+    const std::string ascii(100, 'x');
+    EXPECT_EQ(utf8_kind::Ascii, classify(""));
+    EXPECT_EQ(utf8_kind::Ascii, classify(ascii));
+    EXPECT_EQ(utf8_kind::Utf8, classify(ascii + "\xC3\xB1" + ascii));
+    EXPECT_EQ(utf8_kind::Utf8, classify(ascii.substr(0, 15) + "\xE2\x82\xAC" + "\xF0\x9F\x98\x80"));
+    // sequence crossing the end of a 16 byte block
+    EXPECT_EQ(utf8_kind::Utf8, classify(ascii.substr(0, 14) + "\xF0\x9F\x98\x80" + ascii));
+    EXPECT_EQ(utf8_kind::Invalid, classify(ascii + "\xC0\xAF"));          // overlong
+    EXPECT_EQ(utf8_kind::Invalid, classify(ascii + "\xED\xA0\x80"));      // surrogate
+    EXPECT_EQ(utf8_kind::Invalid, classify(ascii + "\xF4\x90\x80\x80"));  // over U+10FFFF
+    EXPECT_EQ(utf8_kind::Invalid, classify(ascii.substr(0, 15) + "\xE2\x82"));  // truncated
+    EXPECT_EQ(utf8_kind::Invalid, classify(std::string("\xFF") + ascii));
+}
+
+TEST(encoding, classify_utf8_matches_scalar) {
+    // Valid and invalid sequences at every offset around the vector blocks
+    const std::vector<std::string> pieces{"\xC3\xB1", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\xEF\xBF\xBF",
+                                          "\xF4\x8F\xBF\xBF", "\xC0\xAF", "\xC2", "\xE0\x9F\x80",
+                                          "\xED\xA0\x80", "\xF0\x8F\xBF\xBF", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80",
+                                          "\x80", "\xE2\x82", "\xF0\x9F\x98", "\xFF"};
+    for (const auto &first : pieces) {
+        for (const auto &second : pieces) {
+            for (std::size_t offset = 0; offset < 40; ++offset) {
+                for (std::size_t after : {0, 1, 40}) {
+                    const std::string value = std::string(offset, 'x') + first + second + std::string(after, 'y');
+                    EXPECT_EQ(umi::log::classify_utf8_scalar(value.data(), value.size()),
+                              umi::log::classify_utf8(value.data(), value.size()))
+                            << "offset " << offset << " after " << after;
+                }
+            }
+        }
+    }
+}
+
+TEST(encoding, bom_on_utf8_messages) {
+    udp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    std::vector<umi::log::connection> loggerConnection{
+            umi::log::connection(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(), std::string())};
+    umi::log::logger log(loggerData, loggerConnection);
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "UTF", "espa\xC3\xB1" "a");
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "ASCII", "plain");
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "ANY", "latin1 \xF1");
+    ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    ASSERT_TRUE(eventually([&sink]() { return count_containing(sink.messages(), "latin1") == 1; }));
+    auto messages = sink.messages();
+    EXPECT_EQ(1u, count_containing(messages, "UTF - \xEF\xBB\xBF" "espa\xC3\xB1" "a"));
+    EXPECT_EQ(1u, count_containing(messages, "ASCII - plain"));
+    EXPECT_EQ(1u, count_containing(messages, "ANY - latin1 \xF1"));
+}
+
+static_assert(umi::log::is_valid_sd_name("request@32473"), "enterprise SD-ID");
+static_assert(!umi::log::is_valid_sd_name(""), "empty name");
+static_assert(!umi::log::is_valid_sd_name("bad name"), "space");
+static_assert(!umi::log::is_valid_sd_name("a=b"), "equal sign");
+static_assert(!umi::log::is_valid_sd_name("a]"), "bracket");
+static_assert(!umi::log::is_valid_sd_name("a\""), "quote");
+static_assert(!umi::log::is_valid_sd_name("name_longer_than_thirty_two_chars"), "33 characters");
+
+TEST(structured_data, schema) {
+    constexpr auto request_schema = umi::log::make_sd_schema("request@32473", "id", "route");
+    constexpr auto empty_schema = umi::log::make_sd_schema("empty");
+    static_assert(request_schema.get_size() == sizeof("[request@32473 id=\"\" route=\"\"]") - 1, "constant text");
+
+    umi::log::sd_builder sd;
+    sd.add_element(request_schema, "4\"2", std::string("/users"));
+    sd.add_element(empty_schema);
+    sd.add_param("extra", "x");
+    EXPECT_EQ("[request@32473 id=\"4\\\"2\" route=\"/users\"][empty extra=\"x\"]",
+              std::string(sd.get_data().data(), sd.get_data().size()));
+}
+
+TEST(structured_data, child_logger_and_context) {
+    udp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    std::vector<umi::log::connection> loggerConnection{
+            umi::log::connection(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(), std::string())};
+    umi::log::logger log(loggerData, loggerConnection);
+
+    umi::log::sd_builder request;
+    request.add_element("request@32473").add_param("id", "42");
+    umi::log::child_logger child(log, "Handler", "REQ", request);
+    umi::log::sd_builder tenant;
+    tenant.add_element("tenant@32473").add_param("name", "acme");
+    umi::log::child_logger grandchild(child, tenant);
+    child.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "child %d", 1);
+    umi::log::sd_builder extra;
+    extra.add_element("extra").add_param("k", "v");
+    grandchild.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, extra, "grandchild");
+    {
+        umi::log::sd_builder trace;
+        trace.add_element("trace@32473").add_param("span", "7");
+        umi::log::scoped_context context(trace);
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "CTX", "in context");
+        child.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "child in context");
+    }
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "CTX", "out of context");
+    ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    ASSERT_TRUE(eventually([&sink]() { return count_containing(sink.messages(), "out of context") == 1; }));
+    auto messages = sink.messages();
+    EXPECT_EQ(1u, count_containing(messages, "Handler " + std::to_string(getpid()) +
+                                             " REQ [request@32473 id=\"42\"] child 1"));
+    EXPECT_EQ(1u, count_containing(messages,
+                                   " REQ [request@32473 id=\"42\"][tenant@32473 name=\"acme\"][extra k=\"v\"] grandchild"));
+    EXPECT_EQ(1u, count_containing(messages, " CTX [trace@32473 span=\"7\"] in context"));
+    EXPECT_EQ(1u, count_containing(messages, " REQ [trace@32473 span=\"7\"][request@32473 id=\"42\"] child in context"));
+    EXPECT_EQ(1u, count_containing(messages, " CTX - out of context"));
+}
+
+TEST(io_threads, streams_stay_in_order) {
+    std::array<tcp_sink, 3> sinks;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_io_threads(3);
+    std::vector<umi::log::connection> loggerConnection;
+    for (auto &sink: sinks) {
+        loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", sink.port(),
+                                      std::string());
+    }
+    umi::log::logger log(loggerData, loggerConnection);
+    const int messages = 2000;
+    for (int i = 0; i < messages; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "SEQ", "seq=%06d;", i);
+    }
+    ASSERT_TRUE(log.flush(std::chrono::seconds(5)));
+    for (auto &sink: sinks) {
+        ASSERT_TRUE(eventually([&sink]() {
+            return sink.streams().size() == 1 && sink.streams()[0].find("seq=001999;") != std::string::npos;
+        }));
+    }
+    for (auto &sink: sinks) {
+        auto streams = sink.streams();
+        ASSERT_EQ(1u, streams.size());
+        // Octet counting frames every message
+        const std::vector<std::string> frames = split_frames(streams[0]);
+        ASSERT_EQ(static_cast<std::size_t>(messages), frames.size());
+        EXPECT_EQ(0u, frames.back().find("<131>1 "));
+        EXPECT_NE(std::string::npos, frames.back().find("seq=001999;"));
+        std::size_t position = 0;
+        for (int i = 0; i < messages; ++i) {
+            char expected[32];
+            snprintf(expected, sizeof(expected), "seq=%06d;", i);
+            position = streams[0].find(expected, position);
+            ASSERT_NE(std::string::npos, position) << "message " << i;
+        }
+    }
+}
+
+TEST(pipelines, one_connection_per_pipeline) {
+    tcp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_pipelines(4);
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", sink.port(),
+                                  std::string());
+    umi::log::logger log(loggerData, loggerConnection);
+    const int producers = 4;
+    const int messages = 500;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < producers; ++t) {
+        threads.emplace_back([&log, t]() {
+            for (int i = 0; i < messages; ++i) {
+                log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "SEQ",
+                        "thread=%d seq=%06d;", t, i);
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    ASSERT_TRUE(log.flush(std::chrono::seconds(5)));
+    ASSERT_TRUE(eventually([&sink]() {
+        std::size_t received = 0;
+        for (auto &stream: sink.streams()) {
+            received += count_text(stream, "seq=");
+        }
+        return received == static_cast<std::size_t>(producers * messages);
+    }));
+    auto streams = sink.streams();
+    ASSERT_EQ(4u, streams.size());
+    // Every thread sticks to one pipeline, so its messages come in order in a single stream
+    for (int t = 0; t < producers; ++t) {
+        char first[48];
+        snprintf(first, sizeof(first), "thread=%d seq=%06d;", t, 0);
+        auto stream = std::find_if(streams.begin(), streams.end(), [&first](const std::string &data) {
+            return data.find(first) != std::string::npos;
+        });
+        ASSERT_NE(streams.end(), stream);
+        std::size_t position = 0;
+        for (int i = 0; i < messages; ++i) {
+            char expected[48];
+            snprintf(expected, sizeof(expected), "thread=%d seq=%06d;", t, i);
+            position = stream->find(expected, position);
+            ASSERT_NE(std::string::npos, position) << "thread " << t << " message " << i;
+        }
+    }
+}
+
+TEST(transport, shared_between_loggers) {
+    tcp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_shared_transport(true);
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", sink.port(),
+                                  std::string());
+    {
+        umi::log::logger first(loggerData, loggerConnection);
+        umi::log::logger second(loggerData, loggerConnection);
+        first.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "First", "SHARED", "from first");
+        second.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Second", "SHARED", "from second");
+        ASSERT_TRUE(first.flush(std::chrono::seconds(2)));
+        ASSERT_TRUE(second.flush(std::chrono::seconds(2)));
+    }
+    ASSERT_TRUE(eventually([&sink]() {
+        return sink.streams().size() == 1 && count_text(sink.streams()[0], "from ") == 2;
+    }));
+    auto streams = sink.streams();
+    ASSERT_EQ(1u, streams.size());
+    EXPECT_NE(std::string::npos, streams[0].find("from first"));
+    EXPECT_NE(std::string::npos, streams[0].find("from second"));
+}
+
+TEST(transport, shared_rejects_other_settings) {
+    tcp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_shared_transport(true);
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", sink.port(),
+                                  std::string());
+    umi::log::logger first(loggerData, loggerConnection);
+    // The group is not a setting of the connection
+    std::vector<umi::log::connection> grouped(loggerConnection);
+    grouped.back().set_group("collectors");
+    EXPECT_NO_THROW(umi::log::logger(loggerData, grouped));
+    std::vector<umi::log::connection> batched(loggerConnection);
+    batched.back().set_batch_bytes(512);
+    EXPECT_THROW(umi::log::logger(loggerData, batched), std::invalid_argument);
+    umi::log::logger_local_data threaded(loggerData);
+    threaded.set_io_threads(4);
+    EXPECT_THROW(umi::log::logger(threaded, loggerConnection), std::invalid_argument);
+    // The rejected loggers have not touched the connection
+    first.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "First", "SHARED", "still here");
+    ASSERT_TRUE(first.flush(std::chrono::seconds(2)));
+    ASSERT_TRUE(eventually([&sink]() {
+        return sink.streams().size() == 1 && count_text(sink.streams()[0], "still here") == 1;
+    }));
+}
+
+TEST(transport, shared_closes_unused_connections) {
+    tcp_sink kept;
+    tcp_sink released;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_shared_transport(true);
+    std::vector<umi::log::connection> keptConnection{
+            umi::log::connection(umi::log::connection::connection_type::TCP, "127.0.0.1", kept.port(), std::string())};
+    std::vector<umi::log::connection> releasedConnection{
+            umi::log::connection(umi::log::connection::connection_type::TCP, "127.0.0.1", released.port(),
+                                 std::string())};
+    umi::log::logger first(loggerData, keptConnection);
+    {
+        umi::log::logger second(loggerData, releasedConnection);
+        second.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Second", "SHARED", "before");
+        ASSERT_TRUE(second.flush(std::chrono::seconds(2)));
+    }
+    // The transport lives on with the first logger, the connection nobody uses is closed
+    EXPECT_TRUE(eventually([&released]() { return released.closed() == 1; }));
+    EXPECT_EQ(0u, kept.closed());
+    // It opens again for a new logger, now with other settings
+    releasedConnection.back().set_batch_bytes(512);
+    umi::log::logger third(loggerData, releasedConnection);
+    third.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Third", "SHARED", "after");
+    ASSERT_TRUE(third.flush(std::chrono::seconds(2)));
+    ASSERT_TRUE(eventually([&released]() {
+        return released.streams().size() == 2 && count_text(released.streams()[1], "after") == 1;
+    }));
+}
+
+TEST(groups, messages_spread_once) {
+    std::array<tcp_sink, 2> group;
+    tcp_sink broadcast;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    std::vector<umi::log::connection> loggerConnection;
+    for (auto &sink: group) {
+        loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", sink.port(),
+                                      std::string());
+        loggerConnection.back().set_group("collectors");
+    }
+    loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", broadcast.port(),
+                                  std::string());
+    const int messages = 100;
+    {
+        umi::log::logger log(loggerData, loggerConnection);
+        for (int i = 0; i < messages; ++i) {
+            log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "SPREAD", "seq=%06d;", i);
+        }
+        ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    }
+    ASSERT_TRUE(eventually([&group, &broadcast]() {
+        return !broadcast.streams().empty() && count_text(broadcast.streams()[0], "seq=") == messages &&
+               !group[0].streams().empty() && !group[1].streams().empty() &&
+               count_text(group[0].streams()[0], "seq=") + count_text(group[1].streams()[0], "seq=") == messages;
+    }));
+    const std::string first = group[0].streams().at(0);
+    const std::string second = group[1].streams().at(0);
+    const std::string all = broadcast.streams().at(0);
+    // Round robin splits the group in halves, the connection without group gets everything
+    EXPECT_EQ(static_cast<std::size_t>(messages / 2), count_text(first, "seq="));
+    EXPECT_EQ(static_cast<std::size_t>(messages / 2), count_text(second, "seq="));
+    EXPECT_EQ(static_cast<std::size_t>(messages), count_text(all, "seq="));
+    for (int i = 0; i < messages; ++i) {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "seq=%06d;", i);
+        EXPECT_EQ(1u, count_text(first, expected) + count_text(second, expected)) << "message " << i;
+    }
+}
+
+TEST(groups, hash_by_msgid) {
+    std::array<tcp_sink, 2> group;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_group_balance(umi::log::group_balance::Hash_Msgid);
+    std::vector<umi::log::connection> loggerConnection;
+    for (auto &sink: group) {
+        loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", sink.port(),
+                                      std::string());
+        loggerConnection.back().set_group("collectors");
+    }
+    const std::vector<std::string> msgids{"LOGIN", "LOGOUT", "ORDER", "PAYMENT", "REFUND", "SEARCH"};
+    {
+        umi::log::logger log(loggerData, loggerConnection);
+        for (int i = 0; i < 60; ++i) {
+            const std::string &msgid = msgids[i % msgids.size()];
+            log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", msgid, "seq=%06d;", i);
+        }
+        ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    }
+    ASSERT_TRUE(eventually([&group]() {
+        return !group[0].streams().empty() && !group[1].streams().empty() &&
+               count_text(group[0].streams()[0], "seq=") + count_text(group[1].streams()[0], "seq=") == 60;
+    }));
+    const std::string first = group[0].streams().at(0);
+    const std::string second = group[1].streams().at(0);
+    EXPECT_EQ(60u, count_text(first, "seq=") + count_text(second, "seq="));
+    for (auto &msgid: msgids) {
+        // Every MSGID sticks to one connection
+        const std::string text = " " + msgid + " ";
+        EXPECT_TRUE(count_text(first, text) == 0 || count_text(second, text) == 0) << msgid;
+        EXPECT_EQ(10u, count_text(first, text) + count_text(second, text)) << msgid;
+    }
+}
+
+TEST(groups, failover_and_back) {
+    auto primary = std::make_unique<tcp_sink>();
+    const int primaryPort = primary->port();
+    tcp_sink standby;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_group_balance(umi::log::group_balance::Failover);
+    std::vector<umi::log::connection> loggerConnection;
+    for (int port: {primaryPort, standby.port()}) {
+        loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", port, std::string());
+        loggerConnection.back().set_group("collectors");
+        loggerConnection.back().set_reconnect_interval(std::chrono::milliseconds(50));
+    }
+    umi::log::logger log(loggerData, loggerConnection);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200)); // let the connections open
+    // Everything goes to the primary while it is healthy
+    for (int i = 0; i < 10; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "HA", "phase=1;");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_EQ(10u, count_text(primary->streams().at(0), "phase=1;"));
+    EXPECT_TRUE(standby.streams().empty() || count_text(standby.streams()[0], "phase=1;") == 0);
+    // The primary goes down, the standby takes the traffic
+    primary.reset();
+    bool switched = false;
+    for (int i = 0; i < 200 && !switched; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "HA", "phase=2;");
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        switched = !standby.streams().empty() && count_text(standby.streams()[0], "phase=2;") > 0;
+    }
+    EXPECT_TRUE(switched);
+    const auto health = log.get_health();
+    ASSERT_EQ(2u, health.size());
+    EXPECT_LT(0u, health[0].m_errors);
+    EXPECT_TRUE(health[1].m_open);
+    // The primary comes back and gets the traffic again
+    primary = std::make_unique<tcp_sink>(primaryPort);
+    bool back = false;
+    for (int i = 0; i < 200 && !back; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "HA", "phase=3;");
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        back = !primary->streams().empty() && count_text(primary->streams()[0], "phase=3;") > 0;
+    }
+    EXPECT_TRUE(back);
+}
+
+TEST(groups, failover_hands_over_pending) {
+    auto primary = std::make_unique<stalled_sink>();
+    tcp_sink standby;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_group_balance(umi::log::group_balance::Failover);
+    std::vector<umi::log::connection> loggerConnection;
+    for (int port: {primary->port(), standby.port()}) {
+        loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", port, std::string());
+        loggerConnection.back().set_group("collectors");
+        loggerConnection.back().set_reconnect_interval(std::chrono::seconds(10));
+    }
+    umi::log::logger log(loggerData, loggerConnection);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200)); // let the connections open
+    // Far more than the socket buffers take, the primary stalls with them queued
+    const int messages = 8000;
+    const std::string padding(1000, 'x');
+    for (int i = 0; i < messages; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "HA", "seq=%06d;%s", i,
+                padding.c_str());
+    }
+    // The queued messages go to the standby once the primary stalls
+    ASSERT_TRUE(eventually([&standby]() {
+        return !standby.streams().empty() && count_text(standby.streams()[0], "seq=") > 0;
+    }));
+    // The primary dies with a write in flight, the standby takes it too
+    primary.reset();
+    ASSERT_TRUE(log.flush(std::chrono::seconds(5)));
+    const auto metrics = log.get_metrics();
+    ASSERT_EQ(2u, metrics.m_connections.size());
+    EXPECT_LT(0u, metrics.m_connections[0].m_errors);
+    EXPECT_EQ(0u, metrics.m_connections[0].m_dropped);
+    // What the primary did not write reaches the standby
+    const auto received = [&standby]() {
+        std::set<std::string> sequences;
+        const std::string stream = standby.streams().at(0);
+        for (std::size_t position = stream.find("seq="); position != std::string::npos;
+             position = stream.find("seq=", position + 1)) {
+            sequences.insert(stream.substr(position, 10));
+        }
+        return sequences.size();
+    };
+    EXPECT_TRUE(eventually([&]() {
+        return received() + metrics.m_connections[0].m_written >= static_cast<uint64_t>(messages);
+    })) << received() << " received, " << metrics.m_connections[0].m_written << " written to the primary";
+}
+
+TEST(relp, window_keeps_order) {
+    relp_server server;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::RELP, "127.0.0.1", server.port(),
+                                  std::string());
+    loggerConnection.back().set_relp_window(16);
+    umi::log::logger log(loggerData, loggerConnection);
+    const int messages = 1000;
+    for (int i = 0; i < messages; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "RELP", "seq=%06d;", i);
+    }
+    // Over RELP the flush waits for the acks, the collector has every message
+    ASSERT_TRUE(log.flush(std::chrono::seconds(5)));
+    // The messages logged before the session opens wait for it
+    const auto received = server.messages();
+    ASSERT_EQ(static_cast<std::size_t>(messages), received.size());
+    for (int i = 0; i < messages; ++i) {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "seq=%06d;", i);
+        EXPECT_NE(std::string::npos, received[i].find(expected)) << "message " << i;
+    }
+}
+
+TEST(relp, unhealthy_without_acks) {
+    relp_server primary;
+    relp_server standby;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_group_balance(umi::log::group_balance::Failover);
+    std::vector<umi::log::connection> loggerConnection;
+    for (int port: {primary.port(), standby.port()}) {
+        loggerConnection.emplace_back(umi::log::connection::connection_type::RELP, "127.0.0.1", port, std::string());
+        loggerConnection.back().set_group("collectors");
+        loggerConnection.back().set_relp_window(16);
+    }
+    umi::log::logger log(loggerData, loggerConnection);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200)); // let the sessions open
+    // The primary takes the window and stops acking, nothing is in flight
+    primary.set_acking(false);
+    const int messages = 100;
+    for (int i = 0; i < messages; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "RELP", "seq=%06d;", i);
+    }
+    // The transactions without ack make it unhealthy, the rest of the window goes to the standby
+    EXPECT_TRUE(eventually([&]() { return standby.count() == messages - 16; })) << standby.count();
+    EXPECT_EQ(16u, primary.count());
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "RELP", "after");
+    EXPECT_TRUE(eventually([&]() { return count_containing(standby.messages(), "after") == 1; }));
+}
+
+TEST(relp, closes_session_on_shutdown) {
+    relp_server server;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_shutdown_timeout(std::chrono::seconds(2));
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::RELP, "127.0.0.1", server.port(),
+                                  std::string());
+    {
+        umi::log::logger log(loggerData, loggerConnection);
+        for (int i = 0; i < 10; ++i) {
+            log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "RELP", "seq=%06d;", i);
+        }
+    }
+    // The destructor drains the messages and waits for the response to the close command
+    EXPECT_EQ(10u, server.count());
+    EXPECT_EQ(1u, server.closes());
+}
+
+TEST(relp, retransmits_after_reconnect) {
+    relp_server server(100);
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::RELP, "127.0.0.1", server.port(),
+                                  std::string());
+    loggerConnection.back().set_relp_window(32);
+    loggerConnection.back().set_reconnect_interval(std::chrono::milliseconds(50));
+    umi::log::logger log(loggerData, loggerConnection);
+    const int messages = 500;
+    for (int i = 0; i < messages; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "RELP", "seq=%06d;", i);
+    }
+    const auto all_received = [&server]() {
+        const auto received = server.messages();
+        for (int i = 0; i < messages; ++i) {
+            char expected[32];
+            snprintf(expected, sizeof(expected), "seq=%06d;", i);
+            if (std::none_of(received.begin(), received.end(), [&expected](const std::string &m) {
+                return m.find(expected) != std::string::npos;
+            })) {
+                return false;
+            }
+        }
+        return true;
+    };
+    for (int i = 0; i < 300 && !all_received(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // The session dropped without ack is retried, every message arrives at least once
+    EXPECT_TRUE(all_received());
+    EXPECT_EQ(2u, server.sessions());
+    EXPECT_LT(0u, log.get_health()[0].m_errors);
+}
+
+TEST(resolve, buffered_until_connected) {
+    tcp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_shutdown_timeout(std::chrono::seconds(2));
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "localhost", sink.port(),
+                                  std::string());
+    const int messages = 100;
+    {
+        umi::log::logger log(loggerData, loggerConnection);
+        // No wait, the messages logged while the host is resolved and connected are kept
+        for (int i = 0; i < messages; ++i) {
+            log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "EARLY", "seq=%06d;", i);
+        }
+        // The destructor drains them
+    }
+    ASSERT_TRUE(eventually([&sink]() {
+        return sink.streams().size() == 1 && count_text(sink.streams()[0], "seq=") == messages;
+    }));
+    EXPECT_EQ(static_cast<std::size_t>(messages), count_text(sink.streams()[0], "seq="));
+    std::vector<boost::asio::ip::address> addresses;
+    bool refresh = true;
+    EXPECT_TRUE(umi::log::endpoint_cache::get_instance().get("localhost", false, addresses, refresh));
+    EXPECT_FALSE(addresses.empty());
+    EXPECT_FALSE(refresh);
+}
+
+TEST(resolve, abandoned_refresh_expires) {
+    umi::log::endpoint_cache &cache = umi::log::endpoint_cache::get_instance();
+    const std::chrono::milliseconds timeout = cache.get_refresh_timeout();
+    cache.set_refresh_timeout(std::chrono::milliseconds(50));
+    cache.put("abandoned.test", {boost::asio::ip::address::from_string("127.0.0.1")}, std::chrono::seconds(60));
+    std::vector<boost::asio::ip::address> addresses;
+    bool refresh = false;
+    ASSERT_TRUE(cache.get("abandoned.test", true, addresses, refresh));
+    EXPECT_TRUE(refresh);
+    // the connection that refreshes never reports back
+    ASSERT_TRUE(cache.get("abandoned.test", true, addresses, refresh));
+    EXPECT_FALSE(refresh);
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    ASSERT_TRUE(cache.get("abandoned.test", true, addresses, refresh));
+    EXPECT_TRUE(refresh);
+    cache.refresh_failed("abandoned.test");
+    ASSERT_TRUE(cache.get("abandoned.test", true, addresses, refresh));
+    EXPECT_TRUE(refresh);
+    cache.set_refresh_timeout(timeout);
+}
+
+TEST(resolve, unknown_host_does_not_block) {
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "collector.invalid", 0, std::string());
+    loggerConnection.back().set_reconnect_interval(std::chrono::milliseconds(50));
+    const auto start = std::chrono::steady_clock::now();
+    umi::log::logger log(loggerData, loggerConnection);
+    EXPECT_GT(std::chrono::milliseconds(100), std::chrono::steady_clock::now() - start);
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "LOST", "nobody listens");
+    for (int i = 0; i < 100 && log.get_health()[0].m_errors == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    EXPECT_LT(0u, log.get_health()[0].m_errors);
+    EXPECT_FALSE(log.get_health()[0].m_open);
+}
+
+TEST(tls, resumes_session_and_packs_records) {
+    tls_server server(1);
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::TLS, "localhost", server.port(),
+                                  server.ca_file());
+    loggerConnection.back().set_reconnect_interval(std::chrono::milliseconds(50));
+    umi::log::logger log(loggerData, loggerConnection);
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "TLS", "first");
+    // The collector drops the first connection, the second one resumes its session
+    for (int i = 0; i < 100 && server.handshakes() < 2; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    ASSERT_EQ(2u, server.handshakes());
+    EXPECT_EQ(1u, server.resumed());
+    const int messages = 1000;
+    for (int i = 0; i < messages; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "TLS", "seq=%06d;", i);
+    }
+    ASSERT_TRUE(log.flush(std::chrono::seconds(5)));
+    ASSERT_TRUE(eventually([&server]() { return count_text(server.streams().back(), "seq=") == messages; }));
+    const std::string stream = server.streams().back();
+    // The records are packed, the messages are split by their length
+    const std::vector<std::string> frames = split_frames(stream);
+    ASSERT_FALSE(frames.empty());
+    EXPECT_FALSE(frames.back().empty());
+    EXPECT_EQ(static_cast<std::size_t>(messages), count_containing(frames, "seq="));
+    std::size_t position = 0;
+    for (int i = 0; i < messages; ++i) {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "seq=%06d;", i);
+        position = stream.find(expected, position);
+        ASSERT_NE(std::string::npos, position) << "message " << i;
+    }
+}
+
+TEST(flush, bounded_when_collector_stalls) {
+    // A TCP collector never acks the RELP session, nothing is done
+    tcp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_shutdown_timeout(std::chrono::milliseconds(100));
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::RELP, "127.0.0.1", sink.port(),
+                                  std::string());
+    auto log = std::make_unique<umi::log::logger>(loggerData, loggerConnection);
+    log->log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "STALL", "never acked");
+    EXPECT_FALSE(log->flush(std::chrono::milliseconds(50)));
+    const auto start = std::chrono::steady_clock::now();
+    log.reset();
+    EXPECT_GT(std::chrono::seconds(1), std::chrono::steady_clock::now() - start);
+}
+
+TEST(metrics, counters_by_outcome) {
+    udp_sink sink;
+    int closedPort = 0;
+    {
+        tcp_sink closed;
+        closedPort = closed.port();
+    }
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Error);
+    loggerData.set_dedup_window(std::chrono::milliseconds(1000));
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(),
+                                  std::string());
+    loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", closedPort,
+                                  std::string());
+    loggerConnection.back().set_reconnect_interval(std::chrono::milliseconds(20));
+    umi::log::logger log(loggerData, loggerConnection);
+    for (int i = 0; i < 3; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Debug, "Test", "LOW", "filtered %d", i);
+    }
+    for (int i = 0; i < 5; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "HIGH", "sent %d", i);
+    }
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "HIGH", "sent %d", 4);
+    ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    const umi::log::logger_metrics metrics = log.get_metrics();
+    EXPECT_EQ(3u, metrics.m_filtered);
+    EXPECT_EQ(6u, metrics.m_enqueued);
+    EXPECT_EQ(1u, metrics.m_collapsed);
+    EXPECT_EQ(0u, metrics.m_queueDepth);
+    ASSERT_EQ(2u, metrics.m_connections.size());
+    // The flush reports the repeat, 6 messages reach every connection
+    EXPECT_EQ(6u, metrics.m_connections[0].m_sent);
+    EXPECT_EQ(6u, metrics.m_connections[0].m_written);
+    EXPECT_LT(6u * 50u, metrics.m_connections[0].m_writtenBytes);
+    EXPECT_EQ(0u, metrics.m_connections[0].m_dropped);
+    // Nobody listens on the TCP one
+    EXPECT_EQ(6u, metrics.m_connections[1].m_sent);
+    EXPECT_EQ(0u, metrics.m_connections[1].m_written);
+    EXPECT_EQ(6u, metrics.m_connections[1].m_dropped);
+    EXPECT_LT(0u, metrics.m_connections[1].m_errors);
+    EXPECT_EQ(0u, metrics.m_connections[1].m_pendingBytes);
+}
+
+TEST(metrics, latency_histograms) {
+    umi::log::latency_snapshot buckets;
+    for (uint64_t value : {0ull, 15ull, 16ull, 1000ull, 123456789ull}) {
+        const std::size_t bucket = umi::log::latency_snapshot::get_bucket(value);
+        EXPECT_LE(value, umi::log::latency_snapshot::get_bucket_limit(bucket));
+        // 6% of precision
+        EXPECT_GE(value + value / 16, umi::log::latency_snapshot::get_bucket_limit(bucket));
+        buckets.add(bucket, 1);
+    }
+    EXPECT_EQ(5u, buckets.get_count());
+    EXPECT_EQ(std::chrono::nanoseconds(16), buckets.get_percentile(50));
+
+    udp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    loggerData.set_latency_tracking(true);
+    std::vector<umi::log::connection> loggerConnection{
+            umi::log::connection(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(), std::string())};
+    umi::log::logger log(loggerData, loggerConnection);
+    const int messages = 100;
+    for (int i = 0; i < messages; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "LAT", "seq=%06d;", i);
+    }
+    ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    const umi::log::logger_metrics metrics = log.get_metrics();
+    EXPECT_EQ(static_cast<uint64_t>(messages), metrics.m_encodeLatency.get_count());
+    EXPECT_EQ(static_cast<uint64_t>(messages), metrics.m_queueLatency.get_count());
+    const umi::log::connection_metrics &connection = metrics.m_connections.at(0);
+    EXPECT_EQ(static_cast<uint64_t>(messages), connection.m_pendingLatency.get_count());
+    EXPECT_EQ(static_cast<uint64_t>(messages), connection.m_writeLatency.get_count());
+    EXPECT_EQ(static_cast<uint64_t>(messages), connection.m_totalLatency.get_count());
+    EXPECT_LT(std::chrono::nanoseconds(0), connection.m_totalLatency.get_percentile(50));
+    EXPECT_LE(connection.m_totalLatency.get_percentile(50), connection.m_totalLatency.get_percentile(99));
+    EXPECT_LE(connection.m_totalLatency.get_percentile(99), connection.m_totalLatency.get_max());
+    EXPECT_LE(connection.m_writeLatency.get_max(), connection.m_totalLatency.get_max());
+}
+
+TEST(metrics, telemetry_lines) {
+    udp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Error);
+    loggerData.set_telemetry_interval(std::chrono::milliseconds(100));
+    loggerData.set_latency_tracking(true);
+    std::vector<umi::log::connection> loggerConnection{
+            umi::log::connection(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(), std::string())};
+    umi::log::logger log(loggerData, loggerConnection);
+    for (int i = 0; i < 5; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "APP", "message %d", i);
+    }
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Debug, "Test", "APP", "filtered");
+    ASSERT_TRUE(eventually([&sink]() { return count_containing(sink.messages(), " TELEMETRY ") >= 2; }));
+    const auto messages = sink.messages();
+    // The first line has the messages logged, the second one the first line
+    EXPECT_EQ(1u, count_containing(messages, " umilog " + std::to_string(getpid()) +
+                                             " TELEMETRY [umilog@32473 enqueued=\"5\" filtered=\"1\" sampled=\"0\""
+                                             " limited=\"0\" sent=\"5\" dropped=\"0\" errors=\"0\" reconnects=\"0\""
+                                             " qdepth=\"0\" pending=\"0\" p99us=\""));
+    EXPECT_EQ(1u, count_containing(messages, "TELEMETRY [umilog@32473 enqueued=\"1\" filtered=\"0\""));
+}
+
+TEST(batching, linger_under_load) {
+    tcp_sink sink;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", sink.port(),
+                                  std::string());
+    loggerConnection.back().set_batch_messages(5);
+    loggerConnection.back().set_batch_linger(std::chrono::milliseconds(500));
+    umi::log::logger log(loggerData, loggerConnection);
+    // Idle, the first message is written alone at once
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "BATCH", "seq=%06d;", 0);
+    ASSERT_TRUE(log.flush(std::chrono::milliseconds(400)));
+    EXPECT_EQ(1u, log.get_metrics().m_connections[0].m_batches);
+    // Under load, the next ones wait to fill batches of 5
+    for (int i = 1; i <= 10; ++i) {
+        log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "BATCH", "seq=%06d;", i);
+    }
+    ASSERT_TRUE(log.flush(std::chrono::milliseconds(400)));
+    EXPECT_EQ(3u, log.get_metrics().m_connections[0].m_batches);
+    // A batch not full is written when the linger expires
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "BATCH", "seq=%06d;", 11);
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(log.flush(std::chrono::milliseconds(100)));
+    ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    EXPECT_LE(std::chrono::milliseconds(400), std::chrono::steady_clock::now() - start);
+    const umi::log::connection_metrics metrics = log.get_metrics().m_connections[0];
+    EXPECT_EQ(4u, metrics.m_batches);
+    EXPECT_EQ(12u, metrics.m_written);
+    ASSERT_TRUE(eventually([&sink]() {
+        return sink.streams().size() == 1 && count_text(sink.streams()[0], "seq=") == 12;
+    }));
+}
+
+TEST(crash_handler, dumps_messages_not_written) {
+    char path[] = "/tmp/umilog_crash_XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_LE(0, fd);
+    int closedPort = 0;
+    {
+        tcp_sink closed;
+        closedPort = closed.port();
+    }
+    EXPECT_EXIT({
+        umi::log::crash_handler::install(fd, 32);
+        umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                               umi::log::severity::Debug);
+        std::vector<umi::log::connection> delivered{
+                umi::log::connection(umi::log::connection::connection_type::UDP, "127.0.0.1", 9, std::string())};
+        umi::log::logger first(loggerData, delivered);
+        for (int i = 0; i < 3; ++i) {
+            first.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "CRASH", "delivered %d", i);
+        }
+        first.flush(std::chrono::seconds(2));
+        std::vector<umi::log::connection> lost{
+                umi::log::connection(umi::log::connection::connection_type::TCP, "127.0.0.1", closedPort,
+                                     std::string())};
+        lost.back().set_reconnect_interval(std::chrono::seconds(10));
+        umi::log::logger second(loggerData, lost);
+        for (int i = 0; i < 3; ++i) {
+            second.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "CRASH", "lost %d", i);
+        }
+        // Collapsed repeats and messages without connections are not waiting for anything
+        umi::log::logger_local_data dedupData(loggerData);
+        dedupData.set_dedup_window(std::chrono::seconds(10));
+        umi::log::logger third(dedupData, delivered);
+        for (int i = 0; i < 3; ++i) {
+            third.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "CRASH", "repeated");
+        }
+        third.flush(std::chrono::seconds(2));
+        umi::log::logger nowhere(loggerData, std::vector<umi::log::connection>());
+        nowhere.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "CRASH", "nowhere");
+        nowhere.flush(std::chrono::seconds(2));
+        // Written by one connection out of two
+        std::vector<umi::log::connection> both(delivered);
+        both.push_back(lost.back());
+        umi::log::logger fourth(loggerData, both);
+        fourth.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "CRASH", "half");
+        // Written over RELP and never acked
+        relp_server stalled;
+        stalled.set_acking(false);
+        std::vector<umi::log::connection> relp{
+                umi::log::connection(umi::log::connection::connection_type::RELP, "127.0.0.1", stalled.port(),
+                                     std::string())};
+        umi::log::logger fifth(loggerData, relp);
+        fifth.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "CRASH", "unacked");
+        eventually([&]() {
+            return fourth.get_metrics().m_connections[0].m_written == 1 && stalled.count() == 1;
+        });
+        std::abort();
+    }, ::testing::KilledBySignal(SIGABRT), "");
+    std::string dump;
+    std::array<char, 4096> buffer;
+    ssize_t size;
+    while ((size = pread(fd, buffer.data(), buffer.size(), static_cast<off_t>(dump.size()))) > 0) {
+        dump.append(buffer.data(), static_cast<std::size_t>(size));
+    }
+    close(fd);
+    std::remove(path);
+    EXPECT_EQ(0u, count_text(dump, "delivered"));
+    EXPECT_EQ(0u, count_text(dump, "repeated"));
+    EXPECT_EQ(0u, count_text(dump, "nowhere"));
+    EXPECT_EQ(5u, count_text(dump, "\n"));
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(1u, count_text(dump, "CRASH - lost " + std::to_string(i) + "\n"));
+    }
+    EXPECT_EQ(1u, count_text(dump, "CRASH - half\n"));
+    EXPECT_EQ(1u, count_text(dump, "CRASH - unacked\n"));
+}
+
+TEST(datagram, truncated_to_limit) {
+    // The cut never goes into the header nor the structured data
+    const std::string header = "<131>1 - host app 1 ID [a@32473 b=\"c\"] ";
+    umi::log::log_message message(header + "\xC3\xA9\xC3\xA9", 131, 7, 8, 24, header.size(), nullptr, 0);
+    EXPECT_EQ(header.size(), message.get_truncated_size(3));
+    EXPECT_EQ(header.size() + 2, message.get_truncated_size(header.size() + 3));
+    EXPECT_EQ(header.size() + 4, message.get_truncated_size(1024));
+
+    udp_sink sink;
+    udp_sink small;
+    tcp_sink stream;
+    umi::log::logger_local_data loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                           umi::log::severity::Debug);
+    std::vector<umi::log::connection> loggerConnection;
+    loggerConnection.emplace_back(umi::log::connection::connection_type::UDP, "127.0.0.1", sink.port(),
+                                  std::string());
+    loggerConnection.emplace_back(umi::log::connection::connection_type::UDP, "127.0.0.1", small.port(),
+                                  std::string());
+    loggerConnection.back().set_datagram_limit(480);
+    loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1", stream.port(),
+                                  std::string());
+    umi::log::logger log(loggerData, loggerConnection);
+    umi::log::sd_builder sd;
+    sd.add_element("request@32473").add_param("id", "42");
+    std::string body;
+    for (int i = 0; i < 1500; ++i) {
+        body += "\xC3\xA9";
+    }
+    log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Test", "BIG", sd, "%s", body.c_str());
+    ASSERT_TRUE(log.flush(std::chrono::seconds(2)));
+    ASSERT_TRUE(eventually([&sink, &small]() {
+        return sink.messages().size() == 1 && small.messages().size() == 1;
+    }));
+    const std::vector<std::string> messages{sink.messages()[0], small.messages()[0]};
+    // Loopback has a big MTU, the path limit is the 2048 bytes of RFC 5426
+    EXPECT_GE(2048u, messages[0].size());
+    EXPECT_LE(2047u, messages[0].size());
+    EXPECT_GE(480u, messages[1].size());
+    EXPECT_LE(479u, messages[1].size());
+    for (auto &i: messages) {
+        EXPECT_NE(std::string::npos, i.find(" BIG [request@32473 id=\"42\"] "));
+        EXPECT_EQ('\xA9', i.back());
+    }
+    ASSERT_TRUE(eventually([&stream]() {
+        return stream.streams().size() == 1 && count_text(stream.streams()[0], "\xC3\xA9") == 1500;
+    }));
+    const umi::log::logger_metrics metrics = log.get_metrics();
+    EXPECT_EQ(1u, metrics.m_connections[0].m_truncated);
+    EXPECT_EQ(1u, metrics.m_connections[1].m_truncated);
+    EXPECT_EQ(0u, metrics.m_connections[2].m_truncated);
+}
@@ -0,0 +1,172 @@
+#ifndef UMILOG_RELP_SERVER_HPP
+#define UMILOG_RELP_SERVER_HPP
+
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Small RELP collector listening on localhost, used by the tests and the benchmarks.
+ * It acks every syslog transaction and keeps the messages received.
+ * */
+class relp_server {
+public:
+    /**
+      \brief Starts listening
+
+      \param dropAfter closes the first connection without ack when this number of
+      messages have been received, 0 to never do it
+    */
+    explicit relp_server(std::size_t dropAfter = 0)
+            : m_acceptor(m_ioservice, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+              m_dropAfter(dropAfter) {
+        accept();
+        m_thread = std::thread([this]() { m_ioservice.run(); });
+    }
+
+    ~relp_server() {
+        m_ioservice.stop();
+        m_thread.join();
+    }
+
+    int port() const {
+        return m_acceptor.local_endpoint().port();
+    }
+
+    std::vector<std::string> messages() {
+        std::unique_lock<std::mutex> _lock(m_mutex);
+        return m_messages;
+    }
+
+    std::size_t count() const {
+        return m_count;
+    }
+
+    std::size_t sessions() const {
+        return m_sessions;
+    }
+
+    /**
+      \brief Gets the close commands received
+    */
+    std::size_t closes() const {
+        return m_closes;
+    }
+
+    /**
+      \brief Stops or resumes the acks of the syslog transactions, a stalled collector
+    */
+    void set_acking(bool acking) {
+        m_acking = acking;
+    }
+
+private:
+    struct connection {
+        explicit connection(boost::asio::io_service &service) : m_socket(service) { }
+
+        boost::asio::ip::tcp::socket m_socket;
+        std::array<char, 1024 * 64> m_buffer;
+        std::string m_input;
+        std::string m_output;
+    };
+
+    void accept() {
+        auto _connection = std::make_shared<connection>(m_ioservice);
+        m_acceptor.async_accept(_connection->m_socket, [this, _connection](const boost::system::error_code &error) {
+            if (!error) {
+                ++m_sessions;
+                read(_connection);
+            }
+            accept();
+        });
+    }
+
+    void read(std::shared_ptr<connection> c) {
+        c->m_socket.async_read_some(boost::asio::buffer(c->m_buffer),
+                                    [this, c](const boost::system::error_code &error, std::size_t size) {
+                                        if (!error) {
+                                            c->m_input.append(c->m_buffer.data(), size);
+                                            if (process(*c)) {
+                                                read(c);
+                                            }
+                                        }
+                                    });
+    }
+
+    /**
+     * Handles the complete frames, false if the connection has been closed
+     * */
+    bool process(connection &c) {
+        std::size_t _begin = 0;
+        while (true) {
+            const std::size_t _command = c.m_input.find(' ', _begin);
+            const std::size_t _length = _command == std::string::npos ? _command : c.m_input.find(' ', _command + 1);
+            if (_length == std::string::npos) {
+                break;
+            }
+            std::size_t _data = _length + 1;
+            std::size_t _dataSize = 0;
+            while (_data < c.m_input.size() && c.m_input[_data] >= '0' && c.m_input[_data] <= '9') {
+                _dataSize = _dataSize * 10 + static_cast<std::size_t>(c.m_input[_data++] - '0');
+            }
+            if (_data >= c.m_input.size()) {
+                break;
+            }
+            if (_dataSize > 0) {
+                ++_data;
+            }
+            if (_data + _dataSize >= c.m_input.size()) {
+                break;
+            }
+            const std::string _txnr(c.m_input, _begin, _command - _begin);
+            const std::string _name(c.m_input, _command + 1, _length - _command - 1);
+            if (_name == "open") {
+                const std::string _offers = "200 OK\nrelp_version=0\nrelp_software=stub\ncommands=syslog";
+                c.m_output += _txnr + " rsp " + boost::lexical_cast<std::string>(_offers.size()) + " " + _offers + "\n";
+            } else if (_name == "syslog") {
+                {
+                    std::unique_lock<std::mutex> _lock(m_mutex);
+                    m_messages.emplace_back(c.m_input, _data, _dataSize);
+                }
+                if (++m_count == m_dropAfter) {
+                    c.m_socket.close();
+                    return false;
+                }
+                if (m_acking) {
+                    c.m_output += _txnr + " rsp 6 200 OK\n";
+                }
+            } else if (_name == "close") {
+                ++m_closes;
+                c.m_output += _txnr + " rsp 0\n";
+            }
+            _begin = _data + _dataSize + 1;
+        }
+        c.m_input.erase(0, _begin);
+        if (!c.m_output.empty()) {
+            // The acks are small, a blocking write keeps the stand-in simple
+            boost::system::error_code _error;
+            boost::asio::write(c.m_socket, boost::asio::buffer(c.m_output), _error);
+            c.m_output.clear();
+        }
+        return true;
+    }
+
+    boost::asio::io_service m_ioservice;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    std::size_t m_dropAfter;
+    std::mutex m_mutex;
+    std::vector<std::string> m_messages;
+    std::atomic<std::size_t> m_count{0};
+    std::atomic<std::size_t> m_sessions{0};
+    std::atomic<std::size_t> m_closes{0};
+    std::atomic<bool> m_acking{true};
+    std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef UMILOG_TLS_SERVER_HPP
+#define UMILOG_TLS_SERVER_HPP
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * TLS collector listening on localhost with a self-signed certificate for
+ * "localhost", used by the tests and the benchmarks. The certificate is
+ * written to a temporary file to be used as the CA of the connections.
+ * */
+class tls_server {
+public:
+    /**
+      \brief Starts listening
+
+      \param drops number of connections closed after their first read
+    */
+    explicit tls_server(std::size_t drops = 0)
+            : m_context(boost::asio::ssl::context::tls_server),
+              m_acceptor(m_ioservice, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+              m_drops(drops) {
+        create_certificate();
+        static const unsigned char _sessionContext[] = "umilog";
+        SSL_CTX_set_session_id_context(m_context.native_handle(), _sessionContext, sizeof(_sessionContext) - 1);
+        accept();
+        m_thread = std::thread([this]() { m_ioservice.run(); });
+    }
+
+    ~tls_server() {
+        m_ioservice.stop();
+        m_thread.join();
+        std::remove(m_caFile.c_str());
+    }
+
+    int port() const {
+        return m_acceptor.local_endpoint().port();
+    }
+
+    const std::string &ca_file() const {
+        return m_caFile;
+    }
+
+    std::size_t bytes() const {
+        return m_bytes;
+    }
+
+    std::size_t handshakes() const {
+        return m_handshakes;
+    }
+
+    std::size_t resumed() const {
+        return m_resumed;
+    }
+
+    std::vector<std::string> streams() {
+        std::unique_lock<std::mutex> _lock(m_mutex);
+        std::vector<std::string> _streams;
+        for (auto &i: m_connections) {
+            _streams.push_back(i->m_data);
+        }
+        return _streams;
+    }
+
+private:
+    struct connection {
+        connection(boost::asio::io_service &service, boost::asio::ssl::context &context)
+                : m_stream(service, context) { }
+
+        boost::asio::ssl::stream<boost::asio::ip::tcp::socket> m_stream;
+        std::array<char, 1024 * 64> m_buffer;
+        std::string m_data;
+    };
+
+    void create_certificate() {
+        EVP_PKEY *_key = nullptr;
+        EVP_PKEY_CTX *_keyContext = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        EVP_PKEY_keygen_init(_keyContext);
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(_keyContext, NID_X9_62_prime256v1);
+        EVP_PKEY_keygen(_keyContext, &_key);
+        EVP_PKEY_CTX_free(_keyContext);
+        X509 *_certificate = X509_new();
+        X509_set_version(_certificate, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(_certificate), 1);
+        X509_gmtime_adj(X509_getm_notBefore(_certificate), -60);
+        X509_gmtime_adj(X509_getm_notAfter(_certificate), 3600);
+        X509_set_pubkey(_certificate, _key);
+        X509_NAME *_name = X509_get_subject_name(_certificate);
+        X509_NAME_add_entry_by_txt(_name, "CN", MBSTRING_ASC,
+                                   reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+        X509_set_issuer_name(_certificate, _name);
+        X509_sign(_certificate, _key, EVP_sha256());
+        SSL_CTX_use_certificate(m_context.native_handle(), _certificate);
+        SSL_CTX_use_PrivateKey(m_context.native_handle(), _key);
+        char _path[] = "/tmp/umilog_ca_XXXXXX";
+        const int _fd = mkstemp(_path);
+        FILE *_file = fdopen(_fd, "w");
+        PEM_write_X509(_file, _certificate);
+        fclose(_file);
+        m_caFile = _path;
+        X509_free(_certificate);
+        EVP_PKEY_free(_key);
+    }
+
+    void accept() {
+        auto _connection = std::make_shared<connection>(m_ioservice, m_context);
+        m_acceptor.async_accept(_connection->m_stream.lowest_layer(),
+                                [this, _connection](const boost::system::error_code &error) {
+                                    if (!error) {
+                                        handshake(_connection);
+                                    }
+                                    accept();
+                                });
+    }
+
+    void handshake(std::shared_ptr<connection> c) {
+        c->m_stream.async_handshake(boost::asio::ssl::stream_base::server,
+                                    [this, c](const boost::system::error_code &error) {
+                                        if (error) {
+                                            return;
+                                        }
+                                        ++m_handshakes;
+                                        if (SSL_session_reused(c->m_stream.native_handle())) {
+                                            ++m_resumed;
+                                        }
+                                        {
+                                            std::unique_lock<std::mutex> _lock(m_mutex);
+                                            m_connections.push_back(c);
+                                        }
+                                        read(c);
+                                    });
+    }
+
+    void read(std::shared_ptr<connection> c) {
+        c->m_stream.async_read_some(boost::asio::buffer(c->m_buffer),
+                                    [this, c](const boost::system::error_code &error, std::size_t size) {
+                                        if (error) {
+                                            return;
+                                        }
+                                        {
+                                            std::unique_lock<std::mutex> _lock(m_mutex);
+                                            c->m_data.append(c->m_buffer.data(), size);
+                                        }
+                                        m_bytes += size;
+                                        if (m_drops > 0) {
+                                            --m_drops;
+                                            c->m_stream.lowest_layer().close();
+                                            return;
+                                        }
+                                        read(c);
+                                    });
+    }
+
+    boost::asio::io_service m_ioservice;
+    boost::asio::ssl::context m_context;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    std::size_t m_drops;
+    std::string m_caFile;
+    std::mutex m_mutex;
+    std::vector<std::shared_ptr<connection>> m_connections;
+    std::atomic<std::size_t> m_bytes{0};
+    std::atomic<std::size_t> m_handshakes{0};
+    std::atomic<std::size_t> m_resumed{0};
+    std::thread m_thread;
+};
+
+#endif
@@ -28,5 +28,514 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #include "umilog.hpp"
+#include "umilog_transport.hpp"
+#ifdef __linux__
+#include <sched.h>
+#endif
 
+namespace umi {
+    namespace log {
+        /**
+          \brief Pipelines and telemetry of a logger
 
+          They live in the library so the applications don't compile asio.
+        */
+        class logger_impl {
+        public:
+            /**
+              \brief Creates the state, the logger adds the pipelines
+            */
+            logger_impl(umi::log::logger &owner, const umi::log::logger_local_data &loggerData)
+                    : m_owner(owner),
+                      m_loggerLocalData(loggerData) { }
+
+            /**
+              \brief Chooses the pipeline of the calling thread
+
+              By thread every producer always uses the same pipeline, so its
+              messages keep their order. By CPU the pipeline of the core running
+              the caller is used, a thread that migrates may reorder messages.
+            */
+            std::size_t select_pipeline() const {
+                if (m_pipelines.size() == 1) {
+                    return 0;
+                }
+#ifdef __linux__
+                if (m_loggerLocalData.get_pipeline_affinity() == umi::log::pipeline_affinity::Cpu) {
+                    const int _cpu = sched_getcpu();
+                    if (_cpu >= 0) {
+                        return static_cast<std::size_t>(_cpu) % m_pipelines.size();
+                    }
+                }
+#endif
+                // Threads are numbered as they log for the first time to spread them evenly
+                static std::atomic<std::size_t> _nextThread(0);
+                static thread_local const std::size_t _thread = _nextThread++;
+                return _thread % m_pipelines.size();
+            }
+
+            /**
+              \brief Waits for the next telemetry line, called with the telemetry mutex
+            */
+            void schedule_telemetry() {
+                std::shared_ptr<telemetry_state> _state = m_telemetry;
+                m_telemetryTimer->expires_from_now(m_loggerLocalData.get_telemetry_interval());
+                m_telemetryTimer->async_wait([this, _state](const boost::system::error_code &error) {
+                    std::unique_lock<std::mutex> _lock(_state->m_mutex);
+                    if (error || _state->m_stopped) {
+                        return;
+                    }
+                    m_owner.send_telemetry();
+                    schedule_telemetry();
+                });
+            }
+
+            /**
+              \brief Waits for the next sweep of the rate limiter, called with the sweep mutex
+            */
+            void schedule_sweep() {
+                std::shared_ptr<sweep_state> _state = m_sweep;
+                m_sweepTimer->expires_from_now(m_loggerLocalData.get_rate_limit().get_sweep_interval());
+                m_sweepTimer->async_wait([this, _state](const boost::system::error_code &error) {
+                    std::unique_lock<std::mutex> _lock(_state->m_mutex);
+                    if (error || _state->m_stopped) {
+                        return;
+                    }
+                    m_owner.sweep_rate_limiter();
+                    schedule_sweep();
+                });
+            }
+
+            /**
+             * Logger that owns the state
+             * */
+            umi::log::logger &m_owner;
+            /**
+             * Settings of the logger
+             * */
+            const umi::log::logger_local_data &m_loggerLocalData;
+            /**
+             * Pipelines that send the messages, one unless the logger is sharded
+             * */
+            std::vector<std::unique_ptr<umi::log::pipeline>> m_pipelines;
+            /**
+             * State of the telemetry shared with the timer handler
+             * */
+            struct telemetry_state {
+                std::mutex m_mutex; //!< Held by the handler and by the destructor
+                bool m_stopped = false; //!< The logger is being destroyed
+                umi::log::logger_metrics m_metrics = umi::log::logger_metrics(); //!< Counters at the last line
+                umi::log::connection_metrics m_connections = umi::log::connection_metrics(); //!< Added
+            };
+            /**
+             * Telemetry state, null if the telemetry is disabled
+             * */
+            std::shared_ptr<telemetry_state> m_telemetry;
+            /**
+             * Timer of the telemetry lines, it runs in the io service of the first pipeline
+             * */
+            std::unique_ptr<boost::asio::steady_timer> m_telemetryTimer;
+            /**
+             * State of the rate limiter sweep shared with the timer handler
+             * */
+            struct sweep_state {
+                std::mutex m_mutex; //!< Held by the handler and by the destructor
+                bool m_stopped = false; //!< The logger is being destroyed
+            };
+            /**
+             * Sweep state, null if the rate limiter is disabled
+             * */
+            std::shared_ptr<sweep_state> m_sweep;
+            /**
+             * Timer of the rate limiter sweep, it runs in the io service of the first pipeline
+             * */
+            std::unique_ptr<boost::asio::steady_timer> m_sweepTimer;
+        };
+    }
+}
+
+/**
+  \brief Creates a logger instance
+*/
+umi::log::logger::logger(const umi::log::logger_local_data &loggerData,
+                         const std::vector<umi::log::connection> &loggerConnection)
+        : m_loggerLocalData(loggerData),
+          m_loggerConnection(loggerConnection) {
+    if (m_loggerLocalData.get_rate_limit().is_enabled()) {
+        m_rateLimiter = std::make_unique<umi::log::rate_limiter>(m_loggerLocalData.get_rate_limit());
+    }
+    if (m_loggerLocalData.get_sampling().is_enabled()) {
+        m_sampler = std::make_unique<umi::log::sampler>(m_loggerLocalData.get_sampling());
+    }
+    m_impl = std::make_unique<umi::log::logger_impl>(*this, m_loggerLocalData);
+    const uint32_t _pipelines = std::max<uint32_t>(1, m_loggerLocalData.get_pipelines());
+    for (uint32_t i = 0; i < _pipelines; ++i) {
+        m_impl->m_pipelines.push_back(std::make_unique<umi::log::pipeline>(m_loggerLocalData, m_loggerConnection));
+    }
+    if (m_loggerLocalData.get_telemetry_interval().count() > 0) {
+        m_impl->m_telemetry = std::make_shared<umi::log::logger_impl::telemetry_state>();
+        m_impl->m_telemetryTimer = std::make_unique<boost::asio::steady_timer>(
+                m_impl->m_pipelines.front()->get_io_service());
+        std::unique_lock<std::mutex> _lock(m_impl->m_telemetry->m_mutex);
+        m_impl->schedule_telemetry();
+    }
+    if (m_rateLimiter && m_loggerLocalData.get_rate_limit().get_sweep_interval().count() > 0) {
+        m_impl->m_sweep = std::make_shared<umi::log::logger_impl::sweep_state>();
+        m_impl->m_sweepTimer = std::make_unique<boost::asio::steady_timer>(
+                m_impl->m_pipelines.front()->get_io_service());
+        std::unique_lock<std::mutex> _lock(m_impl->m_sweep->m_mutex);
+        m_impl->schedule_sweep();
+    }
+}
+
+/**
+  \brief Release the resources used by the logger
+*/
+umi::log::logger::~logger() {
+    if (m_impl->m_telemetry) {
+        std::unique_lock<std::mutex> _lock(m_impl->m_telemetry->m_mutex);
+        m_impl->m_telemetry->m_stopped = true; // a late handler only sees this
+        m_impl->m_telemetryTimer.reset();
+    }
+    if (m_impl->m_sweep) {
+        std::unique_lock<std::mutex> _lock(m_impl->m_sweep->m_mutex);
+        m_impl->m_sweep->m_stopped = true;
+        m_impl->m_sweepTimer.reset();
+    }
+    if (m_rateLimiter) {
+        sweep_rate_limiter(); // the last summaries go with the drain
+    }
+    if (m_loggerLocalData.get_shutdown_timeout().count() > 0) {
+        flush(m_loggerLocalData.get_shutdown_timeout()); // drain within the deadline
+    }
+    m_impl->m_pipelines.clear(); // stop the io services and the connections
+}
+
+/**
+  \brief Stores the message in the queue of the pipeline of the calling thread
+*/
+void umi::log::logger::enqueue(std::shared_ptr<umi::log::log_message> &&message) {
+    m_impl->m_pipelines[m_impl->select_pipeline()]->push(std::move(message));
+}
+
+/**
+  \brief Gets the health of every connection
+*/
+std::vector<umi::log::connection_health> umi::log::logger::get_health() const {
+    umi::log::connection_health _empty;
+    _empty.m_open = true;
+    _empty.m_pendingBytes = 0;
+    _empty.m_lastSuccess = std::chrono::steady_clock::time_point();
+    _empty.m_errors = 0;
+    std::vector<umi::log::connection_health> _health(m_loggerConnection.size(), _empty);
+    for (auto &i: m_impl->m_pipelines) {
+        i->add_health(_health);
+    }
+    return _health;
+}
+
+/**
+  \brief Gets a snapshot of the counters
+*/
+umi::log::logger_metrics umi::log::logger::get_metrics() const {
+    umi::log::logger_metrics _metrics;
+    _metrics.m_filtered = m_counters.get(logger_counter::Filtered);
+    _metrics.m_sampledOut = m_counters.get(logger_counter::Sampled_Out);
+    _metrics.m_rateLimited = m_counters.get(logger_counter::Rate_Limited);
+    _metrics.m_formatErrors = m_counters.get(logger_counter::Format_Errors);
+    _metrics.m_enqueued = m_counters.get(logger_counter::Enqueued);
+    _metrics.m_collapsed = 0;
+    _metrics.m_queueDepth = 0;
+    umi::log::connection_metrics _empty = umi::log::connection_metrics();
+    _empty.m_open = true;
+    _metrics.m_connections.assign(m_loggerConnection.size(), _empty);
+    // The pipelines of a shared transport use the same sockets, each one is counted once
+    std::vector<const umi::log::socket *> _counted;
+    for (auto &i: m_impl->m_pipelines) {
+        _metrics.m_collapsed += i->get_collapsed();
+        _metrics.m_queueDepth += i->get_queue_depth();
+        i->add_latency(_metrics);
+        for (std::size_t j = 0; j < i->get_sockets().size(); ++j) {
+            const umi::log::socket *_socket = i->get_sockets()[j];
+            if (std::find(_counted.begin(), _counted.end(), _socket) != _counted.end()) {
+                continue;
+            }
+            _counted.push_back(_socket);
+            const umi::log::connection_metrics _socketMetrics = _socket->get_metrics();
+            umi::log::connection_metrics &_total = _metrics.m_connections[j];
+            _total.m_open = _total.m_open && _socketMetrics.m_open;
+            _total.m_sent += _socketMetrics.m_sent;
+            _total.m_written += _socketMetrics.m_written;
+            _total.m_writtenBytes += _socketMetrics.m_writtenBytes;
+            _total.m_batches += _socketMetrics.m_batches;
+            _total.m_dropped += _socketMetrics.m_dropped;
+            _total.m_pendingBytes += _socketMetrics.m_pendingBytes;
+            _total.m_pendingLimit += _socketMetrics.m_pendingLimit;
+            _total.m_reconnects += _socketMetrics.m_reconnects;
+            _total.m_errors += _socketMetrics.m_errors;
+            _total.m_truncated += _socketMetrics.m_truncated;
+            _total.m_pendingLatency.merge(_socketMetrics.m_pendingLatency);
+            _total.m_writeLatency.merge(_socketMetrics.m_writeLatency);
+            _total.m_totalLatency.merge(_socketMetrics.m_totalLatency);
+        }
+    }
+    return _metrics;
+}
+
+/**
+  \brief Sends the counters of the last interval
+*/
+void umi::log::logger::send_telemetry() {
+    static const std::string _app("umilog");
+    static const std::string _msgid("TELEMETRY");
+    static const char _site[] = "telemetry";
+    umi::log::logger_metrics _metrics = get_metrics();
+    umi::log::connection_metrics _connections = umi::log::connection_metrics();
+    for (auto &i: _metrics.m_connections) {
+        _connections.m_written += i.m_written;
+        _connections.m_dropped += i.m_dropped;
+        _connections.m_pendingBytes += i.m_pendingBytes;
+        _connections.m_reconnects += i.m_reconnects;
+        _connections.m_errors += i.m_errors;
+        _connections.m_totalLatency.merge(i.m_totalLatency);
+    }
+    umi::log::logger_impl::telemetry_state &_last = *m_impl->m_telemetry;
+    std::string _values;
+    std::vector<std::pair<const char *, std::size_t>> _params;
+    const auto _add = [&_values, &_params](const char *name, uint64_t value) {
+        const std::size_t _begin = _values.size();
+        append_number(_values, value);
+        _params.emplace_back(name, _values.size() - _begin);
+    };
+    _add("enqueued", _metrics.m_enqueued - _last.m_metrics.m_enqueued);
+    _add("filtered", _metrics.m_filtered - _last.m_metrics.m_filtered);
+    _add("sampled", _metrics.m_sampledOut - _last.m_metrics.m_sampledOut);
+    _add("limited", _metrics.m_rateLimited - _last.m_metrics.m_rateLimited);
+    _add("sent", _connections.m_written - _last.m_connections.m_written);
+    _add("dropped", _connections.m_dropped - _last.m_connections.m_dropped);
+    _add("errors", _connections.m_errors - _last.m_connections.m_errors);
+    _add("reconnects", _connections.m_reconnects - _last.m_connections.m_reconnects);
+    _add("qdepth", _metrics.m_queueDepth);
+    _add("pending", _connections.m_pendingBytes);
+    if (m_loggerLocalData.get_latency_tracking()) {
+        umi::log::latency_snapshot _interval = _connections.m_totalLatency;
+        _interval.subtract(_last.m_connections.m_totalLatency);
+        _add("p99us", static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                        _interval.get_percentile(99)).count()));
+    }
+    umi::log::sd_builder _st;
+    _st.add_element(umi::log::umilog_sd_id);
+    std::size_t _offset = 0;
+    for (auto &i: _params) {
+        _st.add_param_non_escape(i.first, boost::string_view(_values.data() + _offset, i.second));
+        _offset += i.second;
+    }
+    _last.m_metrics = std::move(_metrics);
+    _last.m_connections = std::move(_connections);
+    push_message(get_priority(umi::log::facility::Messages_Generated_Internally_By_Syslogd,
+                              umi::log::severity::Informational),
+                 _app, _msgid, boost::string_view(), _st, "telemetry", _site, 1,
+                 std::chrono::steady_clock::time_point());
+}
+
+/**
+  \brief Sends the summaries of the calls suppressed by the rate limiter
+*/
+void umi::log::logger::sweep_rate_limiter() {
+    for (auto &i: m_rateLimiter->sweep()) {
+        send_suppressed(i.m_priority, i.m_app, i.m_msgid, i.m_site, i.m_count);
+    }
+}
+
+/**
+  \brief Gets a future ready when the messages logged so far are written
+*/
+std::shared_future<void> umi::log::logger::flush_async() {
+    auto _barrier = std::make_shared<umi::log::flush_barrier>(m_impl->m_pipelines.size());
+    for (auto &i: m_impl->m_pipelines) {
+        i->flush(_barrier);
+    }
+    return _barrier->get_future();
+}
+
+/**
+  \brief Gets the connections and starts the io threads
+*/
+umi::log::pipeline::pipeline(const umi::log::logger_local_data &loggerData,
+                                    const std::vector<umi::log::connection> &loggerConnection)
+        : m_loggerLocalData(loggerData),
+          m_run(true),
+          m_transport(loggerData.get_shared_transport() ?
+                      umi::log::transport::get_shared(loggerData.get_io_threads()) :
+                      std::make_shared<umi::log::transport>(loggerData.get_io_threads())),
+          m_strand(m_transport->get_io_service()),
+          m_alive(std::make_shared<bool>(true)),
+          m_dedupTimer(m_transport->get_io_service()) {
+    // Get connections depending on the connection data, gathering the groups
+    std::vector<std::string> _groups;
+    try {
+        for (auto &i: loggerConnection) {
+            auto _group = std::find(_groups.begin(), _groups.end(), i.get_group());
+            if (i.get_group().empty() || _group == _groups.end()) {
+                _groups.push_back(i.get_group());
+                m_connections.emplace_back();
+                _group = _groups.end() - 1;
+            }
+            m_sockets.push_back(&m_transport->get_socket(i));
+            m_connections[_group - _groups.begin()].push_back(m_sockets.back());
+        }
+    } catch (...) {
+        // A shared connection with other settings, the ones got are released
+        for (auto i: m_sockets) {
+            m_transport->release_socket(*i, std::chrono::milliseconds(0));
+        }
+        throw;
+    }
+    m_nextConnection.resize(m_connections.size(), 0);
+    if (m_loggerLocalData.get_group_balance() == umi::log::group_balance::Failover) {
+        // A failed or stalled connection hands its messages to the next healthy one of the group
+        for (auto &i: m_connections) {
+            if (i.size() > 1) {
+                for (auto j: i) {
+                    j->add_failover(this, i, m_loggerLocalData.get_failover_stall());
+                }
+            }
+        }
+    }
+}
+
+/**
+  \brief Stops the queue and releases the connections, the transport dies with its last pipeline
+*/
+umi::log::pipeline::~pipeline() {
+    // The io threads may belong to other loggers, wait in the strand until no handler uses this pipeline
+    std::promise<void> _stopped;
+    m_strand.post([this, &_stopped]() {
+        m_run = false;
+        m_alive.reset();
+        m_dedupTimer.cancel();
+        _stopped.set_value();
+    });
+    _stopped.get_future().wait();
+    for (auto i: m_sockets) {
+        i->remove_failover(this);
+    }
+    // The last pipeline using a connection closes it, a RELP session is closed within the shutdown timeout
+    for (auto i: m_sockets) {
+        m_transport->release_socket(*i, m_loggerLocalData.get_shutdown_timeout());
+    }
+}
+
+/**
+ * \brief Sends what is queued and waits in the connections for the messages sent so far
+ * */
+void umi::log::pipeline::flush(const std::shared_ptr<umi::log::flush_barrier> &barrier) {
+    m_strand.post([this, barrier]() {
+        process_messages();
+        flush_repeated();
+        barrier->add(m_sockets.size());
+        for (auto i: m_sockets) {
+            i->when_done(i->get_sent(), [barrier]() { barrier->release(); });
+        }
+        barrier->release();
+    });
+}
+
+/**
+ * \brief Gets the io service of the transport
+ * */
+boost::asio::io_service &umi::log::pipeline::get_io_service() {
+    return m_transport->get_io_service();
+}
+
+/**
+ * \brief Adds the health of the connections to the logger report
+ * */
+void umi::log::pipeline::add_health(std::vector<umi::log::connection_health> &health) const {
+    for (std::size_t i = 0; i < m_sockets.size(); ++i) {
+        const umi::log::connection_health _health = m_sockets[i]->get_health();
+        health[i].m_open = health[i].m_open && _health.m_open;
+        health[i].m_pendingBytes += _health.m_pendingBytes;
+        health[i].m_lastSuccess = std::max(health[i].m_lastSuccess, _health.m_lastSuccess);
+        health[i].m_errors += _health.m_errors;
+    }
+}
+
+/**
+ * \brief Hands one message to one connection of every group
+ * */
+void umi::log::pipeline::send_message(const std::shared_ptr<umi::log::log_message> &message) {
+    if (message->get_crash_id() != 0) {
+        // The crash handler forgets it when every group has written it, or now if there are none
+        if (m_connections.empty()) {
+            umi::log::crash_handler::confirm(message->get_crash_id());
+            return;
+        }
+        message->set_crash_writers(static_cast<uint32_t>(m_connections.size()));
+    }
+    for (std::size_t i = 0; i < m_connections.size(); ++i) {
+        const auto &_group = m_connections[i];
+        std::size_t _chosen = 0;
+        if (_group.size() > 1) {
+            switch (m_loggerLocalData.get_group_balance()) {
+                case umi::log::group_balance::Round_Robin:
+                    _chosen = m_nextConnection[i]++ % _group.size();
+                    break;
+                case umi::log::group_balance::Least_Pending:
+                    for (std::size_t j = 1; j < _group.size(); ++j) {
+                        if (_group[j]->get_pending_bytes() < _group[_chosen]->get_pending_bytes()) {
+                            _chosen = j;
+                        }
+                    }
+                    break;
+                case umi::log::group_balance::Hash_Msgid:
+                    _chosen = static_cast<std::size_t>(message->get_msgid_hash() % _group.size());
+                    break;
+                case umi::log::group_balance::Failover: {
+                    // The first healthy one, else the first open one, else the primary
+                    const auto _stall = m_loggerLocalData.get_failover_stall();
+                    auto _healthy = std::find_if(_group.begin(), _group.end(), [&_stall](umi::log::socket *c) {
+                        return c->is_healthy(_stall);
+                    });
+                    if (_healthy == _group.end()) {
+                        _healthy = std::find_if(_group.begin(), _group.end(), [](umi::log::socket *c) {
+                            return c->get_health().m_open;
+                        });
+                    }
+                    _chosen = _healthy == _group.end() ? 0 : static_cast<std::size_t>(_healthy - _group.begin());
+                    break;
+                }
+            }
+        }
+        _group[_chosen]->send(message);
+    }
+}
+
+/**
+ * \brief Process the messages
+ * */
+void umi::log::pipeline::process_messages() {
+    std::queue<std::shared_ptr<umi::log::log_message>> _localQueue;
+    {
+        std::unique_lock<std::mutex> _lock(m_queueMutex);
+        std::swap(m_messageQueue, _localQueue);
+    }
+    const bool _dedup = m_loggerLocalData.get_dedup_window().count() > 0;
+    while (!_localQueue.empty() && m_run) {
+        std::shared_ptr<umi::log::log_message> _elementToSend = _localQueue.front();
+        _localQueue.pop();
+        --m_queueDepth;
+        if (_elementToSend->get_enqueued() != std::chrono::steady_clock::time_point()) {
+            const auto _now = std::chrono::steady_clock::now();
+            m_encodeLatency.record(_elementToSend->get_encode());
+            m_queueLatency.record(_now - _elementToSend->get_enqueued());
+            _elementToSend->set_dequeued(_now);
+        }
+        // Process element
+        if (_dedup && collapse_message(_elementToSend)) {
+            continue;
+        }
+        send_message(_elementToSend);
+    }
+}
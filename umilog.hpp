@@ -34,16 +34,34 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #include <functional>
 #include <iostream>
 #include <unordered_map>
-#include <boost/asio.hpp>
-#include <boost/asio/ssl.hpp>
-#include <boost/lexical_cast.hpp>
-#include <boost/algorithm/string.hpp>
-#include <condition_variable>
+#include <boost/utility/string_view.hpp>
+#include <algorithm>
+#include <cctype>
 #include <cstdint>
 #include <string>
-#include <thread>
-#include <queue>
+#include <vector>
+#include <future>
 #include <atomic>
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 // clock_gettime is missing on windows
@@ -187,6 +205,21 @@ namespace umi {
          * */
         class logger;
 
+        /**
+         * Queue and connections used by the logger
+         * */
+        class pipeline;
+
+        /**
+         * Io threads and connections used by the pipelines
+         * */
+        class transport;
+
+        /**
+         * Pipelines and telemetry of a logger, hidden from the applications
+         * */
+        class logger_impl;
+
         /**
           \brief Facility
 
@@ -242,13 +275,13 @@ namespace umi {
         };
 
         /**
-          \brief Helper method to transform from the input string to the
-          output severity.
-          It doesn't matter if the string is in upper/lower case, internally
-          it will be transformed to the right case and checked against the strings.
-          If not found Debug level is returned
+          \brief Transforms the input string to a severity, in any case
+
+          \param value with the name of the severity
+          \param result set to the severity found
+          \return false if the name is not a severity, result is not changed
         */
-        static umi::log::severity string_to_severity(const std::string &value) {
+        inline bool parse_severity(const std::string &value, umi::log::severity &result) {
             static const std::unordered_map<std::string, umi::log::severity> unordered_map_string_to_severity =
                     {
                             {"emergency",     umi::log::severity::Emergency},
@@ -260,14 +293,549 @@ namespace umi {
                             {"informational", umi::log::severity::Informational},
                             {"debug",         umi::log::severity::Debug}
                     };
-            std::string lcValue = boost::to_lower_copy(value);
+            std::string lcValue(value);
+            std::transform(lcValue.begin(), lcValue.end(), lcValue.begin(), [](unsigned char c) {
+                return static_cast<char>(std::tolower(c));
+            });
             const auto element = unordered_map_string_to_severity.find(lcValue);
             if (element == unordered_map_string_to_severity.end()) {
-                return umi::log::severity::Debug;
+                return false;
             }
-            return element->second;
+            result = element->second;
+            return true;
+        }
+
+        /**
+          \brief Helper method to transform from the input string to the
+          output severity.
+          It doesn't matter if the string is in upper/lower case, internally
+          it will be transformed to the right case and checked against the strings.
+          If not found Debug level is returned
+        */
+        inline umi::log::severity string_to_severity(const std::string &value) {
+            umi::log::severity _result = umi::log::severity::Debug;
+            umi::log::parse_severity(value, _result);
+            return _result;
         }
 
+        /**
+          \brief SD-ID used by the library on the messages it generates by itself
+
+          32473 is the private enterprise number reserved for documentation
+          in RFC 5612, change it if you own a real one.
+        */
+        static const char *const umilog_sd_id = "umilog@32473";
+
+        /**
+          \brief Settings of the token bucket used to rate limit the log calls
+
+          Every key (the pair app/msgid or the call site) owns one bucket
+          that is refilled with rate tokens per second up to burst tokens.
+          Each log call takes one token, when the bucket is empty the message
+          is dropped before being formatted. The number of dropped messages is
+          reported with the next admitted message of the key, or by the
+          periodic sweep if the key doesn't log again.
+
+          A rate of 0 disables the limiter.
+        */
+        class rate_limit {
+        public:
+            /**
+              \brief What identifies one bucket
+            */
+            enum class key_type : int {
+                Msgid,     //!< One bucket per app and msgid
+                Call_Site  //!< One bucket per format string used in the call
+            };
+
+        public:
+            /**
+              \brief Default constructor, the limiter is disabled
+            */
+            rate_limit() { }
+
+            /**
+              \brief Constructor of the rate limit
+
+              \param rate with the tokens per second added to the bucket
+              \param burst with the maximum number of tokens of the bucket
+              \param key with the way we group the messages in buckets
+            */
+            rate_limit(double rate, uint32_t burst, key_type key = key_type::Msgid)
+                    : m_rate(rate),
+                      m_burst(burst),
+                      m_keyType(key) { }
+
+            /**
+              \brief Checks if the limiter has to be applied
+            */
+            bool is_enabled() const {
+                return m_rate > 0.0;
+            }
+
+            /**
+              \brief Gets the rate in messages per second
+            */
+            double get_rate() const {
+                return m_rate;
+            }
+
+            /**
+              \brief Sets the rate in messages per second
+            */
+            void set_rate(double val) {
+                m_rate = val;
+            }
+
+            /**
+              \brief Gets the burst size
+            */
+            uint32_t get_burst() const {
+                return m_burst;
+            }
+
+            /**
+              \brief Sets the burst size
+            */
+            void set_burst(uint32_t val) {
+                m_burst = val;
+            }
+
+            /**
+              \brief Gets the key type
+            */
+            key_type get_key_type() const {
+                return m_keyType;
+            }
+
+            /**
+              \brief Sets the key type
+            */
+            void set_key_type(key_type val) {
+                m_keyType = val;
+            }
+
+            /**
+              \brief Gets the time between the sweeps of the buckets
+            */
+            std::chrono::milliseconds get_sweep_interval() const {
+                return m_sweepInterval;
+            }
+
+            /**
+              \brief Sets the time between the sweeps of the buckets
+
+              Every sweep reports the messages suppressed of the keys that have
+              not logged again, and forgets the idle keys.
+            */
+            void set_sweep_interval(std::chrono::milliseconds val) {
+                m_sweepInterval = val;
+            }
+
+        protected:
+            double m_rate = 0.0; //!< Tokens per second
+            uint32_t m_burst = 0; //!< Size of the bucket
+            key_type m_keyType = key_type::Msgid; //!< How the buckets are selected
+            std::chrono::milliseconds m_sweepInterval{1000}; //!< Time between the sweeps of the buckets
+        };
+
+        /**
+          \brief Token buckets of the rate limiter
+
+          The buckets are distributed in shards by key, each shard with its own
+          mutex, so threads logging different keys rarely meet in the same lock.
+        */
+        class rate_limiter {
+        public:
+            /**
+              \brief Number of shards used to split the buckets
+            */
+            static constexpr std::size_t shard_count = 16;
+
+            /**
+              \brief Creates the limiter with the desired settings
+            */
+            explicit rate_limiter(const umi::log::rate_limit &settings)
+                    : m_settings(settings) { }
+
+            /**
+              \brief Builds the key of one log call
+            */
+            uint64_t get_key(const std::string &app, const std::string &msgid, const char *site) const {
+                if (m_settings.get_key_type() == umi::log::rate_limit::key_type::Call_Site) {
+                    return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(site));
+                }
+                uint64_t _key = std::hash<std::string>()(app);
+                return _key ^ (std::hash<std::string>()(msgid) + 0x9e3779b97f4a7c15ULL + (_key << 6) + (_key >> 2));
+            }
+
+            /**
+              \brief Log call with messages suppressed, reported by the sweep
+            */
+            struct suppressed_call {
+                int m_priority; //!< PRI of the first message suppressed
+                std::string m_app; //!< App of the call
+                std::string m_msgid; //!< Msgid of the call
+                const char *m_site; //!< Format string of the call
+                uint64_t m_count; //!< Messages suppressed since the last report
+            };
+
+            /**
+              \brief Takes one token from the bucket of the key
+
+              \param key with the bucket identifier
+              \param priority with the PRI of the call, kept for the sweep when it is suppressed
+              \param app with the app of the call, kept for the sweep when it is suppressed
+              \param msgid with the msgid of the call, kept for the sweep when it is suppressed
+              \param site with the format string of the call, kept for the sweep when it is suppressed
+              \param suppressed receives the number of messages dropped since the
+              last report, only when the call is admitted
+              \return true if the message has to be sent
+            */
+            bool try_acquire(uint64_t key, int priority, const std::string &app, const std::string &msgid,
+                             const char *site, uint64_t &suppressed) {
+                const auto _now = std::chrono::steady_clock::now();
+                shard &_shard = m_shards[((key * 0x9e3779b97f4a7c15ULL) >> 32) % shard_count];
+                std::unique_lock<std::mutex> _lock(_shard.m_mutex);
+                auto _inserted = _shard.m_buckets.emplace(key, bucket());
+                bucket &_bucket = _inserted.first->second;
+                if (_inserted.second) {
+                    // A new key starts with the whole burst
+                    _bucket.m_tokens = static_cast<double>(m_settings.get_burst());
+                    _bucket.m_last = _now;
+                } else {
+                    refill(_bucket, _now);
+                }
+                if (_bucket.m_tokens < 1.0) {
+                    if (_bucket.m_suppressed++ == 0) {
+                        // The strings are copied once per report, not per message
+                        _bucket.m_priority = priority;
+                        _bucket.m_app = app;
+                        _bucket.m_msgid = msgid;
+                        _bucket.m_site = site;
+                    }
+                    return false;
+                }
+                _bucket.m_tokens -= 1.0;
+                suppressed = _bucket.m_suppressed;
+                _bucket.m_suppressed = 0;
+                return true;
+            }
+
+            /**
+              \brief Takes the messages suppressed of every key and forgets the idle keys
+
+              A bucket that is full again and has nothing suppressed is removed,
+              it is created full when its key logs again.
+
+              \return the calls with messages suppressed since their last report
+            */
+            std::vector<suppressed_call> sweep() {
+                const auto _now = std::chrono::steady_clock::now();
+                std::vector<suppressed_call> _calls;
+                for (auto &i: m_shards) {
+                    std::unique_lock<std::mutex> _lock(i.m_mutex);
+                    for (auto j = i.m_buckets.begin(); j != i.m_buckets.end();) {
+                        bucket &_bucket = j->second;
+                        refill(_bucket, _now);
+                        if (_bucket.m_suppressed > 0) {
+                            _calls.push_back(suppressed_call{_bucket.m_priority, std::move(_bucket.m_app),
+                                                             std::move(_bucket.m_msgid), _bucket.m_site,
+                                                             _bucket.m_suppressed});
+                            _bucket.m_suppressed = 0;
+                            ++j;
+                        } else if (_bucket.m_tokens >= static_cast<double>(m_settings.get_burst())) {
+                            j = i.m_buckets.erase(j);
+                        } else {
+                            ++j;
+                        }
+                    }
+                }
+                return _calls;
+            }
+
+            /**
+              \brief Gets the number of keys with a bucket
+            */
+            std::size_t get_bucket_count() {
+                std::size_t _count = 0;
+                for (auto &i: m_shards) {
+                    std::unique_lock<std::mutex> _lock(i.m_mutex);
+                    _count += i.m_buckets.size();
+                }
+                return _count;
+            }
+
+        protected:
+            /**
+             * State of one key
+             * */
+            struct bucket {
+                double m_tokens = 0; //!< Tokens available
+                std::chrono::steady_clock::time_point m_last; //!< Last refill
+                uint64_t m_suppressed = 0; //!< Messages dropped since the last report
+                int m_priority = 0; //!< PRI of the first message suppressed
+                std::string m_app; //!< App of the first message suppressed
+                std::string m_msgid; //!< Msgid of the first message suppressed
+                const char *m_site = nullptr; //!< Format string of the first message suppressed
+            };
+
+            /**
+              \brief Adds the tokens earned since the last refill
+            */
+            void refill(bucket &target, std::chrono::steady_clock::time_point now) const {
+                const double _elapsed = std::chrono::duration<double>(now - target.m_last).count();
+                target.m_tokens = std::min(static_cast<double>(m_settings.get_burst()),
+                                           target.m_tokens + _elapsed * m_settings.get_rate());
+                target.m_last = now;
+            }
+
+            /**
+             * Group of buckets protected by the same mutex, padded to avoid false sharing
+             * */
+            struct shard {
+                std::mutex m_mutex;
+                std::unordered_map<uint64_t, bucket> m_buckets;
+                char m_padding[64];
+            };
+
+            /**
+             * Settings of the limiter
+             * */
+            umi::log::rate_limit m_settings;
+            /**
+             * Shards with the buckets
+             * */
+            std::array<shard, shard_count> m_shards;
+        };
+
+        /**
+          \brief Settings of the probabilistic sampling of verbose severities
+
+          Messages with a severity equal or less important than the configured
+          one are kept one in N times. When a rate per second is set, N is
+          computed for every call site from the messages it produced the last
+          second, so each site sends around that rate.
+
+          The kept messages carry [umilog@32473 sample_rate="N"] so the
+          collector can scale the counts back.
+        */
+        class sampling {
+        public:
+            /**
+              \brief Default constructor, the sampling is disabled
+            */
+            sampling() { }
+
+            /**
+              \brief Constructor of the sampling
+
+              \param fromSeverity with the most important severity sampled
+              \param oneIn with the fraction of messages kept, 1 keeps all
+              \param perSecond with the target rate per call site, 0 to use only oneIn
+            */
+            sampling(umi::log::severity fromSeverity, uint32_t oneIn, double perSecond = 0.0)
+                    : m_fromSeverity(fromSeverity),
+                      m_oneIn(oneIn),
+                      m_perSecond(perSecond) { }
+
+            /**
+              \brief Checks if the sampling has to be applied
+            */
+            bool is_enabled() const {
+                return m_oneIn > 1 || m_perSecond > 0.0;
+            }
+
+            /**
+              \brief Gets the most important severity sampled
+            */
+            umi::log::severity get_from_severity() const {
+                return m_fromSeverity;
+            }
+
+            /**
+              \brief Sets the most important severity sampled
+            */
+            void set_from_severity(umi::log::severity val) {
+                m_fromSeverity = val;
+            }
+
+            /**
+              \brief Gets the fraction of messages kept
+            */
+            uint32_t get_one_in() const {
+                return m_oneIn;
+            }
+
+            /**
+              \brief Sets the fraction of messages kept
+            */
+            void set_one_in(uint32_t val) {
+                m_oneIn = val;
+            }
+
+            /**
+              \brief Gets the target rate per call site
+            */
+            double get_per_second() const {
+                return m_perSecond;
+            }
+
+            /**
+              \brief Sets the target rate per call site
+            */
+            void set_per_second(double val) {
+                m_perSecond = val;
+            }
+
+        protected:
+            umi::log::severity m_fromSeverity = umi::log::severity::Debug; //!< Most important severity sampled
+            uint32_t m_oneIn = 1; //!< Keep one message of every oneIn
+            double m_perSecond = 0.0; //!< Target rate per call site
+        };
+
+        /**
+          \brief Takes the sampling decisions
+
+          The decision uses a thread local random generator, the per site rate
+          is tracked in a fixed table of atomic slots so no lock is taken.
+          Sites that don't fit in the table use the fixed fraction.
+        */
+        class sampler {
+        public:
+            /**
+              \brief Number of call sites tracked for the rate per second
+            */
+            static constexpr std::size_t slot_count = 256;
+
+            /**
+              \brief Creates the sampler with the desired settings
+            */
+            explicit sampler(const umi::log::sampling &settings)
+                    : m_settings(settings) {
+                for (auto &i: m_slots) {
+                    i.m_site = nullptr;
+                    i.m_second = 0;
+                    i.m_count = 0;
+                    i.m_oneIn = 1;
+                }
+            }
+
+            /**
+              \brief Decides if one log call is kept
+
+              \param severity with the severity of the call
+              \param site with the format string, used as call site identifier
+              \param sampleRate receives N when the message is kept one in N times
+              \return true if the message has to be sent
+            */
+            bool sample(umi::log::severity severity, const char *site, uint32_t &sampleRate) {
+                if (static_cast<int>(severity) < static_cast<int>(m_settings.get_from_severity())) {
+                    return true;
+                }
+                uint32_t _oneIn = std::max<uint32_t>(1, m_settings.get_one_in());
+                if (m_settings.get_per_second() > 0.0) {
+                    _oneIn = std::max(_oneIn, site_one_in(site));
+                }
+                if (_oneIn <= 1) {
+                    return true;
+                }
+                if (((next_random() >> 32) * _oneIn) >> 32 != 0) {
+                    return false;
+                }
+                sampleRate = _oneIn;
+                return true;
+            }
+
+        protected:
+            /**
+              \brief xorshift64* generator, one state per thread
+            */
+            static uint64_t next_random() {
+                static thread_local uint64_t _state =
+                        std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+                _state ^= _state >> 12;
+                _state ^= _state << 25;
+                _state ^= _state >> 27;
+                return _state * 0x2545F4914F6CDD1DULL;
+            }
+
+            /**
+              \brief Counts the call and returns the fraction to keep for the site
+            */
+            uint32_t site_one_in(const void *site) {
+                const int64_t _second = std::chrono::duration_cast<std::chrono::seconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+                std::size_t _index = (reinterpret_cast<uintptr_t>(site) >> 3) % slot_count;
+                for (std::size_t i = 0; i < slot_count; ++i, _index = (_index + 1) % slot_count) {
+                    slot &_slot = m_slots[_index];
+                    const void *_owner = _slot.m_site.load(std::memory_order_acquire);
+                    if (_owner == nullptr) {
+                        const void *_expected = nullptr;
+                        if (!_slot.m_site.compare_exchange_strong(_expected, site) && _expected != site) {
+                            continue;
+                        }
+                    } else if (_owner != site) {
+                        continue;
+                    }
+                    int64_t _slotSecond = _slot.m_second.load(std::memory_order_relaxed);
+                    if (_slotSecond != _second &&
+                        _slot.m_second.compare_exchange_strong(_slotSecond, _second)) {
+                        // Only one thread per second computes the fraction from the last second
+                        const uint64_t _count = _slot.m_count.exchange(0);
+                        uint32_t _oneIn = 1;
+                        if (_slotSecond == _second - 1) {
+                            _oneIn = static_cast<uint32_t>(std::min<double>(
+                                    std::ceil(static_cast<double>(_count) / m_settings.get_per_second()),
+                                    std::numeric_limits<uint32_t>::max()));
+                        }
+                        _slot.m_oneIn = std::max<uint32_t>(1, _oneIn);
+                    }
+                    _slot.m_count.fetch_add(1, std::memory_order_relaxed);
+                    return _slot.m_oneIn.load(std::memory_order_relaxed);
+                }
+                return 1;
+            }
+
+            /**
+             * Rate of one call site
+             * */
+            struct slot {
+                std::atomic<const void *> m_site; //!< Owner of the slot
+                std::atomic<int64_t> m_second; //!< Second being counted
+                std::atomic<uint64_t> m_count; //!< Calls during the second
+                std::atomic<uint32_t> m_oneIn; //!< Fraction computed from the last second
+            };
+
+            /**
+             * Settings of the sampler
+             * */
+            umi::log::sampling m_settings;
+            /**
+             * Per call site rates
+             * */
+            std::array<slot, slot_count> m_slots;
+        };
+
+        /**
+          \brief How the messages are spread among the connections of a group
+        */
+        enum class group_balance : int {
+            Round_Robin,   //!< Each connection in turn
+            Least_Pending, //!< The connection with less bytes waiting to be written
+            Hash_Msgid,    //!< By MSGID, the messages of one MSGID go to the same connection
+            Failover       //!< The first healthy connection in the order they were given, the messages
+                           //!< waiting in a failed or stalled one go to the next healthy one
+        };
+
+        /**
+          \brief How the producers are mapped to the pipelines of a sharded logger
+        */
+        enum class pipeline_affinity : int {
+            Thread, //!< Each thread always uses the same pipeline
+            Cpu     //!< The pipeline of the core running the caller
+        };
+
         /**
           \brief Represents the local parameter data of the Logger
         */
@@ -392,15 +960,255 @@ namespace umi {
                 return m_maxSeverity;
             }
 
-        protected:
-            std::string m_hostname; //!< Hostname of the actual logger
-            uint32_t m_version;  //!< Version we are using in this
-            bool m_print;  //!< Flag to print on std out before send
-            uint32_t m_precision; //!< Precision we want in the timestamp
-            umi::log::facility m_maxFacility; //!< The facility up we have to report
-            umi::log::severity m_maxSeverity; //!< Max severity up we have to report
-
-        };
+            /**
+              \brief Gets the rate limit applied to the log calls
+            */
+            const umi::log::rate_limit &get_rate_limit() const {
+                return m_rateLimit;
+            }
+
+            /**
+              \brief Sets the rate limit applied to the log calls
+            */
+            void set_rate_limit(const umi::log::rate_limit &val) {
+                m_rateLimit = val;
+            }
+
+            /**
+              \brief Mutable version of the rate limit
+            */
+            umi::log::rate_limit &mutable_rate_limit() {
+                return m_rateLimit;
+            }
+
+            /**
+              \brief Gets the window used to collapse repeated messages, 0 disables it
+            */
+            std::chrono::milliseconds get_dedup_window() const {
+                return m_dedupWindow;
+            }
+
+            /**
+              \brief Sets the window used to collapse repeated messages, 0 disables it
+
+              Every pipeline collapses its own messages, with several pipelines
+              a repeat only collapses if it comes through the same one.
+            */
+            void set_dedup_window(std::chrono::milliseconds val) {
+                m_dedupWindow = val;
+            }
+
+            /**
+              \brief Gets if the BOM is added to messages with UTF-8 characters
+            */
+            bool get_utf8_bom() const {
+                return m_utf8Bom;
+            }
+
+            /**
+              \brief Sets if the BOM is added to messages with UTF-8 characters
+            */
+            void set_utf8_bom(bool val) {
+                m_utf8Bom = val;
+            }
+
+            /**
+              \brief Gets the number of threads running the io service
+            */
+            uint32_t get_io_threads() const {
+                return m_ioThreads;
+            }
+
+            /**
+              \brief Sets the number of threads running the io service
+
+              Each connection is served by one thread at a time, more threads
+              let several connections encrypt and write in parallel.
+            */
+            void set_io_threads(uint32_t val) {
+                m_ioThreads = val;
+            }
+
+            /**
+              \brief Gets how the messages are spread among the connections of a group
+            */
+            umi::log::group_balance get_group_balance() const {
+                return m_groupBalance;
+            }
+
+            /**
+              \brief Sets how the messages are spread among the connections of a group
+            */
+            void set_group_balance(umi::log::group_balance val) {
+                m_groupBalance = val;
+            }
+
+            /**
+              \brief Gets the time a write can take before a failover group skips the connection
+            */
+            std::chrono::milliseconds get_failover_stall() const {
+                return m_failoverStall;
+            }
+
+            /**
+              \brief Sets the time a write can take before a failover group skips the connection,
+              its waiting messages go to the next healthy connection of the group
+            */
+            void set_failover_stall(std::chrono::milliseconds val) {
+                m_failoverStall = val;
+            }
+
+            /**
+              \brief Gets if the latency of the messages is recorded
+            */
+            bool get_latency_tracking() const {
+                return m_latencyTracking;
+            }
+
+            /**
+              \brief Sets if the latency of the messages is recorded
+
+              The messages are stamped when they are encoded and queued, the
+              pipeline and the connections record the time of every stage in
+              histograms, see logger::get_metrics.
+            */
+            void set_latency_tracking(bool val) {
+                m_latencyTracking = val;
+            }
+
+            /**
+              \brief Gets the interval of the telemetry lines, 0 if they are not sent
+            */
+            std::chrono::milliseconds get_telemetry_interval() const {
+                return m_telemetryInterval;
+            }
+
+            /**
+              \brief Sets the interval of the telemetry lines, 0 to not send them
+
+              Every interval the logger sends a message with MSGID TELEMETRY and
+              the counters of the interval in the umilog element: messages
+              enqueued, filtered, sampled out, rate limited, written and dropped,
+              errors and reconnects, and the queue depth and bytes pending at
+              the moment. With the latency tracked, the 99th percentile from
+              queued to written in microseconds is added.
+            */
+            void set_telemetry_interval(std::chrono::milliseconds val) {
+                m_telemetryInterval = val;
+            }
+
+            /**
+              \brief Gets the time the logger waits for the pending messages when it is destroyed
+            */
+            std::chrono::milliseconds get_shutdown_timeout() const {
+                return m_shutdownTimeout;
+            }
+
+            /**
+              \brief Sets the time the logger waits for the pending messages when it is destroyed
+
+              The destructor flushes the logger for up to this time before
+              closing the connections, 0 closes them at once and the pending
+              messages are lost. The RELP sessions are then closed with the
+              close command, waiting for its response up to this time too.
+            */
+            void set_shutdown_timeout(std::chrono::milliseconds val) {
+                m_shutdownTimeout = val;
+            }
+
+            /**
+              \brief Gets if the io threads and connections are shared with other loggers
+            */
+            bool get_shared_transport() const {
+                return m_sharedTransport;
+            }
+
+            /**
+              \brief Sets if the io threads and connections are shared with other loggers
+
+              The loggers sharing the transport send to the same collector over
+              one connection, closed when the last of them is destroyed. They
+              must use the same io threads, and the same settings for a
+              collector except the group, else the logger throws when created.
+            */
+            void set_shared_transport(bool val) {
+                m_sharedTransport = val;
+            }
+
+            /**
+              \brief Gets the number of pipelines of the logger
+            */
+            uint32_t get_pipelines() const {
+                return m_pipelines;
+            }
+
+            /**
+              \brief Sets the number of pipelines of the logger
+
+              Every pipeline has its own queue, io threads and connections to
+              each collector, the producers are spread among them.
+            */
+            void set_pipelines(uint32_t val) {
+                m_pipelines = val;
+            }
+
+            /**
+              \brief Gets how the producers are mapped to the pipelines
+            */
+            umi::log::pipeline_affinity get_pipeline_affinity() const {
+                return m_pipelineAffinity;
+            }
+
+            /**
+              \brief Sets how the producers are mapped to the pipelines
+            */
+            void set_pipeline_affinity(umi::log::pipeline_affinity val) {
+                m_pipelineAffinity = val;
+            }
+
+            /**
+              \brief Gets the sampling of verbose severities
+            */
+            const umi::log::sampling &get_sampling() const {
+                return m_sampling;
+            }
+
+            /**
+              \brief Sets the sampling of verbose severities
+            */
+            void set_sampling(const umi::log::sampling &val) {
+                m_sampling = val;
+            }
+
+            /**
+              \brief Mutable version of the sampling
+            */
+            umi::log::sampling &mutable_sampling() {
+                return m_sampling;
+            }
+
+        protected:
+            std::string m_hostname; //!< Hostname of the actual logger
+            uint32_t m_version;  //!< Version we are using in this
+            bool m_print;  //!< Flag to print on std out before send
+            uint32_t m_precision; //!< Precision we want in the timestamp
+            umi::log::facility m_maxFacility; //!< The facility up we have to report
+            umi::log::severity m_maxSeverity; //!< Max severity up we have to report
+            umi::log::rate_limit m_rateLimit; //!< Token bucket applied before formatting
+            std::chrono::milliseconds m_dedupWindow{0}; //!< Window to collapse repeated messages
+            umi::log::sampling m_sampling; //!< Sampling applied before formatting
+            bool m_utf8Bom = true; //!< Mark the UTF-8 messages with the BOM
+            uint32_t m_ioThreads = 1; //!< Threads running the io service
+            uint32_t m_pipelines = 1; //!< Pipelines used to send the messages
+            bool m_sharedTransport = false; //!< Io threads and connections shared by the process
+            umi::log::group_balance m_groupBalance = umi::log::group_balance::Round_Robin; //!< Group policy
+            std::chrono::milliseconds m_failoverStall{100}; //!< Stalled write time for the failover
+            std::chrono::milliseconds m_shutdownTimeout{0}; //!< Time to drain the messages at destruction
+            bool m_latencyTracking = false; //!< Record the latency of every stage
+            std::chrono::milliseconds m_telemetryInterval{0}; //!< Interval of the telemetry lines
+            umi::log::pipeline_affinity m_pipelineAffinity = umi::log::pipeline_affinity::Thread; //!< Producer mapping
+
+        };
 
 
         /**
@@ -481,6 +1289,9 @@ namespace umi {
           The connection can be UDP/IP or TCP(SSL only)/IP, we can specify ports or keep it empty
           and the class will choose the default ones
 
+          On TCP and TLS every message goes after its length and a space
+          (octet counting, RFC 6587 and RFC 5425), a batch shares the writes.
+
           Default ports
 
           TLS->6514
@@ -492,7 +1303,9 @@ namespace umi {
             enum class connection_type : int {
                 UDP,
                 TCP,
-                TLS
+                TLS,
+                RELP,
+                RELP_TLS
             };
         public:
             /**
@@ -505,6 +1318,9 @@ namespace umi {
                 if (port <= 0) {
                     if (m_connectionType == connection_type::TLS) {
                         m_port = 6514;
+                    } else if (m_connectionType == connection_type::RELP ||
+                               m_connectionType == connection_type::RELP_TLS) {
+                        m_port = 2514;
                     } else {
                         m_port = 514;
                     }
@@ -520,7 +1336,16 @@ namespace umi {
                     : m_connectionType(val.m_connectionType),
                       m_host(val.m_host),
                       m_port(val.m_port),
-                      m_ca(val.m_ca) { }
+                      m_ca(val.m_ca),
+                      m_group(val.m_group),
+                      m_reconnectInterval(val.m_reconnectInterval),
+                      m_relpWindow(val.m_relpWindow),
+                      m_pendingLimit(val.m_pendingLimit),
+                      m_dnsTtl(val.m_dnsTtl),
+                      m_batchBytes(val.m_batchBytes),
+                      m_batchMessages(val.m_batchMessages),
+                      m_batchLinger(val.m_batchLinger),
+                      m_datagramLimit(val.m_datagramLimit) { }
 
             /**
               \brief rvalue constructor
@@ -529,7 +1354,16 @@ namespace umi {
                     : m_connectionType(std::move(val.m_connectionType)),
                       m_host(std::move(val.m_host)),
                       m_port(std::move(val.m_port)),
-                      m_ca(std::move(val.m_ca)) { }
+                      m_ca(std::move(val.m_ca)),
+                      m_group(std::move(val.m_group)),
+                      m_reconnectInterval(val.m_reconnectInterval),
+                      m_relpWindow(val.m_relpWindow),
+                      m_pendingLimit(val.m_pendingLimit),
+                      m_dnsTtl(val.m_dnsTtl),
+                      m_batchBytes(val.m_batchBytes),
+                      m_batchMessages(val.m_batchMessages),
+                      m_batchLinger(val.m_batchLinger),
+                      m_datagramLimit(val.m_datagramLimit) { }
 
             /**
               \brief Clean the resources used by this connection data
@@ -545,6 +1379,15 @@ namespace umi {
                     m_host = val.m_host;
                     m_port = val.m_port;
                     m_ca = val.m_ca;
+                    m_group = val.m_group;
+                    m_reconnectInterval = val.m_reconnectInterval;
+                    m_relpWindow = val.m_relpWindow;
+                    m_pendingLimit = val.m_pendingLimit;
+                    m_dnsTtl = val.m_dnsTtl;
+                    m_batchBytes = val.m_batchBytes;
+                    m_batchMessages = val.m_batchMessages;
+                    m_batchLinger = val.m_batchLinger;
+                    m_datagramLimit = val.m_datagramLimit;
                 }
                 return *this;
             }
@@ -558,6 +1401,15 @@ namespace umi {
                     m_host = std::move(val.m_host);
                     m_port = std::move(val.m_port);
                     m_ca = std::move(val.m_ca);
+                    m_group = std::move(val.m_group);
+                    m_reconnectInterval = val.m_reconnectInterval;
+                    m_relpWindow = val.m_relpWindow;
+                    m_pendingLimit = val.m_pendingLimit;
+                    m_dnsTtl = val.m_dnsTtl;
+                    m_batchBytes = val.m_batchBytes;
+                    m_batchMessages = val.m_batchMessages;
+                    m_batchLinger = val.m_batchLinger;
+                    m_datagramLimit = val.m_datagramLimit;
                 }
                 return *this;
             }
@@ -646,164 +1498,1894 @@ namespace umi {
                 return m_host;
             }
 
-        protected:
-            connection_type m_connectionType;  //!< Connection we are using(the type)
-            std::string m_host;  //!< host we will send the data
-            uint32_t m_port;  //!< Port we are using in the communication
-            std::string m_ca; //!< Certificate authority
-        };
+            /**
+              \brief Gets the group of the connection, empty if it receives every message
+            */
+            const std::string &get_group() const {
+                return m_group;
+            }
 
-        /**
-           \brief Class to use structured data on the logs
+            /**
+              \brief Sets the group of the connection
 
-           STRUCTURED-DATA provides a mechanism to express information in a well
-           defined, easily parseable and interpretable data format.  There are
-           multiple usage scenarios.  For example, it may express meta-
-           information about the syslog message or application-specific
-           information such as traffic counters or IP addresses.
+              The connections of a logger with the same group share the
+              messages, each one is delivered to only one of them as set in
+              logger_local_data::set_group_balance. Connections without group
+              receive every message.
+            */
+            void set_group(const std::string &val) {
+                m_group = val;
+            }
 
-           STRUCTURED-DATA can contain zero, one, or multiple structured data
-           elements, which are referred to as "SD-ELEMENT" in this document.
-         */
-        class structured_data {
-        public:
             /**
-             * Internal element stored in the structured data
-             * */
-            class sd_element {
-            public:
-                sd_element() {}
-                /**
-                 * constructor of the sd_element
-                 * \param id with the identifier we want to use in this element
-                 * */
-                sd_element(const std::string &id) : m_id(boost::algorithm::trim_copy(id)) { }
+              \brief Mutable version of the group
+            */
+            std::string &mutable_group() {
+                return m_group;
+            }
 
-                /**
-                 * constructor of the element using id and parameters
-                 * \param id with the identifier we want to use in this element
-                 * \param param with the parameters we will associate with the id
-                 * */
-                sd_element(const std::string &id, const std::vector<std::pair<std::string, std::string>> &param)
-                        : m_id(boost::algorithm::trim_copy(id)),
-                          m_params(param) { }
+            /**
+              \brief Gets the time to wait before connecting again after an error
+            */
+            std::chrono::milliseconds get_reconnect_interval() const {
+                return m_reconnectInterval;
+            }
 
-                sd_element(const sd_element &c)
-                        : m_id(c.m_id),
-                          m_params(c.m_params) { }
+            /**
+              \brief Sets the time to wait before connecting again after an error
+            */
+            void set_reconnect_interval(std::chrono::milliseconds val) {
+                m_reconnectInterval = val;
+            }
 
-                sd_element(sd_element &&c)
-                        : m_id(std::move(c.m_id)),
-                          m_params(std::move(c.m_params)) { }
+            /**
+              \brief Mutable version of the reconnect interval
+            */
+            std::chrono::milliseconds &mutable_reconnect_interval() {
+                return m_reconnectInterval;
+            }
 
-                // Takes input string and returns an escaped string
-                std::string escape(const std::string &val) const {
-                    std::string ret_val;
-                    ret_val.reserve(val.length());
-                    for (auto &&a: val) {
-                        if (a == '\"' || a == '\\' || a == ']') {
-                            ret_val += "\\";
-                        }
-                        ret_val += a;
-                    }
-                    return ret_val;
-                }
+            /**
+              \brief Gets the messages a RELP connection sends without waiting for their ack
+            */
+            uint32_t get_relp_window() const {
+                return m_relpWindow;
+            }
 
-                sd_element & operator=(sd_element &s) {
-                    if (this != &s) {
-                        m_id = s.m_id;
-                        m_params = s.m_params;
-                    }
-                    return *this;
-                }
+            /**
+              \brief Sets the messages a RELP connection sends without waiting for their ack
+            */
+            void set_relp_window(uint32_t val) {
+                m_relpWindow = val;
+            }
 
-                sd_element & operator=(sd_element &&s) {
-                    if (this != &s) {
-                        m_id = std::move(s.m_id);
-                        m_params = std::move(s.m_params);
-                    }
-                    return *this;
-                }
+            /**
+              \brief Mutable version of the RELP window
+            */
+            uint32_t &mutable_relp_window() {
+                return m_relpWindow;
+            }
 
-                /**
-                  \brief Adds one param to the element escaping the value. This is important
-                  as it will be supposed to non be escaped.
+            /**
+              \brief Gets the bytes of messages kept while the connection is not ready
+            */
+            std::size_t get_pending_limit() const {
+                return m_pendingLimit;
+            }
 
-                  \param param_name containing the name of the parameter we want to use
-                  \param param_value containing the value of the parameter
-                 */
-                void add_param(const std::string &param_name, const std::string &param_value) {
-                    m_params.push_back(std::make_pair(param_name, sd_element::escape(param_value)));
-                }
+            /**
+              \brief Sets the bytes of messages kept while the connection is not ready,
+              the messages over the limit are dropped
+            */
+            void set_pending_limit(std::size_t val) {
+                m_pendingLimit = val;
+            }
 
-                /**
-                  \brief Adds one param to the element without scaping the value. This is important
-                  as it will be supposed to be already scaped and may produce errors in the destination.
+            /**
+              \brief Mutable version of the pending limit
+            */
+            std::size_t &mutable_pending_limit() {
+                return m_pendingLimit;
+            }
 
-                  \param param_name containing the name of the parameter we want to use
-                  \param param_value containing the value of the parameter
-                 */
-                void add_param_non_escape(const std::string &param_name, const std::string &param_value) {
-                    m_params.push_back(std::make_pair(param_name, param_value));
-                }
+            /**
+              \brief Gets the time the addresses of the host are cached
+            */
+            std::chrono::seconds get_dns_ttl() const {
+                return m_dnsTtl;
+            }
 
-                template<typename SS>
-                friend SS &operator<<(SS &st, const sd_element &val) {
-                    st << "[" << val.m_id << " ";
-                    for (std::size_t i = 0; i < val.m_params.size(); ++i) {
-                        if (i > 0) {
-                            st << " ";
-                        }
-                        st << val.m_params[i].first << "=\"" << val.m_params[i].second << "\"";
-                    }
-                    st << "]";
-                    return st;
+            /**
+              \brief Sets the time the addresses of the host are cached
+            */
+            void set_dns_ttl(std::chrono::seconds val) {
+                m_dnsTtl = val;
+            }
+
+            /**
+              \brief Mutable version of the DNS TTL
+            */
+            std::chrono::seconds &mutable_dns_ttl() {
+                return m_dnsTtl;
+            }
+
+            /**
+              \brief Gets the maximum bytes written at once
+            */
+            std::size_t get_batch_bytes() const {
+                return m_batchBytes;
+            }
+
+            /**
+              \brief Sets the maximum bytes written at once
+
+              The pending messages are written together up to this size, a
+              bigger message is written alone. UDP sends a datagram per message.
+            */
+            void set_batch_bytes(std::size_t val) {
+                m_batchBytes = val;
+            }
+
+            /**
+              \brief Mutable version of the batch bytes
+            */
+            std::size_t &mutable_batch_bytes() {
+                return m_batchBytes;
+            }
+
+            /**
+              \brief Gets the maximum messages written at once
+            */
+            uint32_t get_batch_messages() const {
+                return m_batchMessages;
+            }
+
+            /**
+              \brief Sets the maximum messages written at once
+            */
+            void set_batch_messages(uint32_t val) {
+                m_batchMessages = val;
+            }
+
+            /**
+              \brief Mutable version of the batch messages
+            */
+            uint32_t &mutable_batch_messages() {
+                return m_batchMessages;
+            }
+
+            /**
+              \brief Gets the time a batch may wait for more messages under load
+            */
+            std::chrono::microseconds get_batch_linger() const {
+                return m_batchLinger;
+            }
+
+            /**
+              \brief Sets the time a batch may wait for more messages under load
+
+              An idle connection writes a message at once. When the last write
+              ended less than the linger ago the connection is under load and
+              a batch not full waits up to the linger for more messages. With
+              0 a batch is written as soon as the last write ends.
+            */
+            void set_batch_linger(std::chrono::microseconds val) {
+                m_batchLinger = val;
+            }
+
+            /**
+              \brief Mutable version of the batch linger
+            */
+            std::chrono::microseconds &mutable_batch_linger() {
+                return m_batchLinger;
+            }
+
+            /**
+              \brief Gets the maximum bytes of a UDP datagram, 0 to choose it by the path
+            */
+            std::size_t get_datagram_limit() const {
+                return m_datagramLimit;
+            }
+
+            /**
+              \brief Sets the maximum bytes of a UDP datagram, the longer messages are truncated
+
+              With 0 the path MTU is used when the system knows it, up to the
+              2048 bytes every receiver should accept (RFC 5426), else the
+              sizes every receiver must accept: 480 with IPv4, 1180 with IPv6.
+              The header and the structured data are never cut, the message
+              is cut on a character boundary.
+            */
+            void set_datagram_limit(std::size_t val) {
+                m_datagramLimit = val;
+            }
+
+            /**
+              \brief Mutable version of the datagram limit
+            */
+            std::size_t &mutable_datagram_limit() {
+                return m_datagramLimit;
+            }
+
+        protected:
+            connection_type m_connectionType;  //!< Connection we are using(the type)
+            std::string m_host;  //!< host we will send the data
+            uint32_t m_port;  //!< Port we are using in the communication
+            std::string m_ca; //!< Certificate authority
+            std::string m_group; //!< Group sharing the messages, empty to receive all
+            std::chrono::milliseconds m_reconnectInterval{1000}; //!< Wait before connecting again
+            uint32_t m_relpWindow = 128; //!< RELP messages waiting for their ack
+            std::size_t m_pendingLimit = 1024 * 1024; //!< Bytes kept while the connection is not ready
+            std::chrono::seconds m_dnsTtl{60}; //!< Time the addresses of the host are cached
+            std::size_t m_batchBytes = 16384; //!< Bytes written at once, a TLS record
+            uint32_t m_batchMessages = 1024; //!< Messages written at once
+            std::chrono::microseconds m_batchLinger{0}; //!< Wait for more messages under load
+            std::size_t m_datagramLimit = 0; //!< Bytes of a UDP datagram, 0 to choose it by the path
+        };
+
+        /**
+          \brief Checks if one character of a PARAM-VALUE has to be escaped
+
+          RFC 5424 requires '"', '\\' and ']' to be escaped with a backslash.
+        */
+        inline constexpr bool needs_escape(char value) {
+            return value == '"' || value == '\\' || value == ']';
+        }
+
+        /**
+          \brief Finds the first character that has to be escaped one byte at a time
+
+          \return pointer to the character or end if there is none
+        */
+        inline const char *find_escape_scalar(const char *begin, const char *end) {
+            for (; begin != end; ++begin) {
+                if (umi::log::needs_escape(*begin)) {
+                    return begin;
+                }
+            }
+            return end;
+        }
+
+        /**
+          \brief Finds the first character of a PARAM-VALUE that has to be escaped
+
+          Compares 32 bytes per step with AVX2 or 16 with SSE2 when the compiler
+          targets them, the tail is checked by the scalar version.
+
+          \return pointer to the character or end if there is none
+        */
+        inline const char *find_escape(const char *begin, const char *end) {
+#if defined(__AVX2__)
+            const __m256i _quote32 = _mm256_set1_epi8('"');
+            const __m256i _backslash32 = _mm256_set1_epi8('\\');
+            const __m256i _bracket32 = _mm256_set1_epi8(']');
+            while (end - begin >= 32) {
+                const __m256i _chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+                const __m256i _match = _mm256_or_si256(
+                        _mm256_or_si256(_mm256_cmpeq_epi8(_chunk, _quote32), _mm256_cmpeq_epi8(_chunk, _backslash32)),
+                        _mm256_cmpeq_epi8(_chunk, _bracket32));
+                const uint32_t _mask = static_cast<uint32_t>(_mm256_movemask_epi8(_match));
+                if (_mask != 0) {
+                    return begin + __builtin_ctz(_mask);
+                }
+                begin += 32;
+            }
+#endif
+#if defined(__SSE2__)
+            const __m128i _quote = _mm_set1_epi8('"');
+            const __m128i _backslash = _mm_set1_epi8('\\');
+            const __m128i _bracket = _mm_set1_epi8(']');
+            while (end - begin >= 16) {
+                const __m128i _chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+                const __m128i _match = _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(_chunk, _quote), _mm_cmpeq_epi8(_chunk, _backslash)),
+                        _mm_cmpeq_epi8(_chunk, _bracket));
+                const uint32_t _mask = static_cast<uint32_t>(_mm_movemask_epi8(_match));
+                if (_mask != 0) {
+                    return begin + __builtin_ctz(_mask);
+                }
+                begin += 16;
+            }
+#endif
+            return umi::log::find_escape_scalar(begin, end);
+        }
+
+        /**
+          \brief Copies a PARAM-VALUE escaping it one byte at a time
+
+          \param out with room for twice the input
+          \return pointer after the last byte written
+        */
+        inline char *escape_to_scalar(char *out, const char *begin, const char *end) {
+            for (; begin != end; ++begin) {
+                if (umi::log::needs_escape(*begin)) {
+                    *out++ = '\\';
+                }
+                *out++ = *begin;
+            }
+            return out;
+        }
+
+        /**
+          \brief Copies a PARAM-VALUE escaping it
+
+          Blocks of 32 (AVX2) or 16 (SSE2) bytes without special characters are
+          copied with one store, the blocks with any are escaped byte by byte
+          so inputs full of quotes don't restart the search on every match.
+
+          \param out with room for twice the input
+          \return pointer after the last byte written
+        */
+        inline char *escape_to(char *out, const char *begin, const char *end) {
+#if defined(__AVX2__)
+            const __m256i _quote32 = _mm256_set1_epi8('"');
+            const __m256i _backslash32 = _mm256_set1_epi8('\\');
+            const __m256i _bracket32 = _mm256_set1_epi8(']');
+            while (end - begin >= 32) {
+                const __m256i _chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+                const __m256i _match = _mm256_or_si256(
+                        _mm256_or_si256(_mm256_cmpeq_epi8(_chunk, _quote32), _mm256_cmpeq_epi8(_chunk, _backslash32)),
+                        _mm256_cmpeq_epi8(_chunk, _bracket32));
+                if (_mm256_movemask_epi8(_match) == 0) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _chunk);
+                    out += 32;
+                } else {
+                    out = umi::log::escape_to_scalar(out, begin, begin + 32);
+                }
+                begin += 32;
+            }
+#endif
+#if defined(__SSE2__)
+            const __m128i _quote = _mm_set1_epi8('"');
+            const __m128i _backslash = _mm_set1_epi8('\\');
+            const __m128i _bracket = _mm_set1_epi8(']');
+            while (end - begin >= 16) {
+                const __m128i _chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+                const __m128i _match = _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(_chunk, _quote), _mm_cmpeq_epi8(_chunk, _backslash)),
+                        _mm_cmpeq_epi8(_chunk, _bracket));
+                if (_mm_movemask_epi8(_match) == 0) {
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _chunk);
+                    out += 16;
+                } else {
+                    out = umi::log::escape_to_scalar(out, begin, begin + 16);
+                }
+                begin += 16;
+            }
+#endif
+            return umi::log::escape_to_scalar(out, begin, end);
+        }
+
+        /**
+          \brief Encoding found in a block of bytes
+        */
+        enum class utf8_kind : int {
+            Ascii,   //!< Only 7 bit characters
+            Utf8,    //!< Valid UTF-8 with multibyte characters
+            Invalid  //!< Not valid UTF-8
+        };
+
+        /**
+          \brief Validates the multibyte UTF-8 sequence starting at data
+
+          Follows the well formed byte sequences table of RFC 3629, rejecting
+          overlong forms, surrogates and code points over U+10FFFF.
+
+          \return size of the sequence or 0 if it is not valid
+        */
+        inline std::size_t utf8_sequence_size(const unsigned char *data, const unsigned char *end) {
+            const unsigned char _lead = data[0];
+            std::size_t _size = 0;
+            unsigned char _low = 0x80;
+            unsigned char _high = 0xBF;
+            if (_lead >= 0xC2 && _lead <= 0xDF) {
+                _size = 2;
+            } else if (_lead >= 0xE0 && _lead <= 0xEF) {
+                _size = 3;
+                if (_lead == 0xE0) {
+                    _low = 0xA0;
+                } else if (_lead == 0xED) {
+                    _high = 0x9F;
+                }
+            } else if (_lead >= 0xF0 && _lead <= 0xF4) {
+                _size = 4;
+                if (_lead == 0xF0) {
+                    _low = 0x90;
+                } else if (_lead == 0xF4) {
+                    _high = 0x8F;
+                }
+            } else {
+                return 0;
+            }
+            if (static_cast<std::size_t>(end - data) < _size || data[1] < _low || data[1] > _high) {
+                return 0;
+            }
+            for (std::size_t i = 2; i < _size; ++i) {
+                if ((data[i] & 0xC0) != 0x80) {
+                    return 0;
+                }
+            }
+            return _size;
+        }
+
+        /**
+          \brief Classifies a block of bytes one character at a time
+        */
+        inline umi::log::utf8_kind classify_utf8_scalar(const char *data, std::size_t size) {
+            const unsigned char *_current = reinterpret_cast<const unsigned char *>(data);
+            const unsigned char *_end = _current + size;
+            umi::log::utf8_kind _kind = umi::log::utf8_kind::Ascii;
+            while (_current != _end) {
+                if (*_current < 0x80) {
+                    ++_current;
+                    continue;
+                }
+                const std::size_t _size = umi::log::utf8_sequence_size(_current, _end);
+                if (_size == 0) {
+                    return umi::log::utf8_kind::Invalid;
+                }
+                _kind = umi::log::utf8_kind::Utf8;
+                _current += _size;
+            }
+            return _kind;
+        }
+
+#if defined(__SSSE3__)
+        /**
+          \brief Gets the tables of the vector UTF-8 validation
+
+          Each pair of consecutive bytes is checked with three tables indexed
+          by the high nibble of the first byte, its low nibble and the high
+          nibble of the second byte. Every bit is one kind of error, the pair
+          is wrong when the three entries share a bit (Keiser and Lemire,
+          "Validating UTF-8 in less than one instruction per byte").
+        */
+        inline void get_utf8_tables(__m128i &firstHigh, __m128i &firstLow, __m128i &secondHigh) {
+            const char _tooShort = 0x01; // a lead not followed by a continuation
+            const char _tooLong = 0x02; // a continuation after ASCII
+            const char _overlong3 = 0x04; // E0 80..9F
+            const char _tooLarge = 0x08; // F4 90..BF and the leads over F4
+            const char _surrogate = 0x10; // ED A0..BF
+            const char _overlong2 = 0x20; // C0 and C1
+            const char _tooLarge1000 = 0x40; // the leads over F4 followed by 80..8F
+            const char _overlong4 = 0x40; // F0 80..8F
+            const char _twoContinuations = static_cast<char>(0x80); // unless a 3 or 4 byte lead is before
+            const char _carry = _tooShort | _tooLong | _twoContinuations;
+            firstHigh = _mm_setr_epi8(
+                    _tooLong, _tooLong, _tooLong, _tooLong, _tooLong, _tooLong, _tooLong, _tooLong,
+                    _twoContinuations, _twoContinuations, _twoContinuations, _twoContinuations,
+                    _tooShort | _overlong2, _tooShort, _tooShort | _overlong3 | _surrogate,
+                    _tooShort | _tooLarge | _tooLarge1000 | _overlong4);
+            firstLow = _mm_setr_epi8(
+                    _carry | _overlong3 | _overlong2 | _overlong4, _carry | _overlong2, _carry, _carry,
+                    _carry | _tooLarge, _carry | _tooLarge | _tooLarge1000, _carry | _tooLarge | _tooLarge1000,
+                    _carry | _tooLarge | _tooLarge1000, _carry | _tooLarge | _tooLarge1000,
+                    _carry | _tooLarge | _tooLarge1000, _carry | _tooLarge | _tooLarge1000,
+                    _carry | _tooLarge | _tooLarge1000, _carry | _tooLarge | _tooLarge1000,
+                    _carry | _tooLarge | _tooLarge1000 | _surrogate, _carry | _tooLarge | _tooLarge1000,
+                    _carry | _tooLarge | _tooLarge1000);
+            secondHigh = _mm_setr_epi8(
+                    _tooShort, _tooShort, _tooShort, _tooShort, _tooShort, _tooShort, _tooShort, _tooShort,
+                    _tooLong | _overlong2 | _twoContinuations | _overlong3 | _tooLarge1000 | _overlong4,
+                    _tooLong | _overlong2 | _twoContinuations | _overlong3 | _tooLarge,
+                    _tooLong | _overlong2 | _twoContinuations | _surrogate | _tooLarge,
+                    _tooLong | _overlong2 | _twoContinuations | _surrogate | _tooLarge,
+                    _tooShort, _tooShort, _tooShort, _tooShort);
+        }
+#endif
+
+#if defined(__AVX2__)
+        /**
+          \brief Finds the UTF-8 errors of a block of 32 bytes, see get_utf8_tables
+
+          \param previous with the block before, zeros for the first one
+          \return a block with non zero bytes where there are errors
+        */
+        inline __m256i get_utf8_errors(__m256i input, __m256i previous) {
+            __m128i _firstHigh, _firstLow, _secondHigh;
+            umi::log::get_utf8_tables(_firstHigh, _firstLow, _secondHigh);
+            const __m256i _nibble = _mm256_set1_epi8(0x0F);
+            // The bytes before each byte, alignr works inside each lane
+            const __m256i _carried = _mm256_permute2x128_si256(previous, input, 0x21);
+            const __m256i _prev1 = _mm256_alignr_epi8(input, _carried, 15);
+            const __m256i _prev2 = _mm256_alignr_epi8(input, _carried, 14);
+            const __m256i _prev3 = _mm256_alignr_epi8(input, _carried, 13);
+            const __m256i _pairs = _mm256_and_si256(
+                    _mm256_and_si256(
+                            _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_firstHigh),
+                                                _mm256_and_si256(_mm256_srli_epi16(_prev1, 4), _nibble)),
+                            _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_firstLow),
+                                                _mm256_and_si256(_prev1, _nibble))),
+                    _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_secondHigh),
+                                        _mm256_and_si256(_mm256_srli_epi16(input, 4), _nibble)));
+            // Only the bytes 2 and 3 after a 3 or 4 byte lead can be two continuations in a row
+            const __m256i _expected = _mm256_or_si256(
+                    _mm256_subs_epu8(_prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+                    _mm256_subs_epu8(_prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80))));
+            return _mm256_xor_si256(_mm256_and_si256(_expected, _mm256_set1_epi8(static_cast<char>(0x80))), _pairs);
+        }
+#elif defined(__SSSE3__)
+        /**
+          \brief Finds the UTF-8 errors of a block of 16 bytes, see get_utf8_tables
+
+          \param previous with the block before, zeros for the first one
+          \return a block with non zero bytes where there are errors
+        */
+        inline __m128i get_utf8_errors(__m128i input, __m128i previous) {
+            __m128i _firstHigh, _firstLow, _secondHigh;
+            umi::log::get_utf8_tables(_firstHigh, _firstLow, _secondHigh);
+            const __m128i _nibble = _mm_set1_epi8(0x0F);
+            const __m128i _prev1 = _mm_alignr_epi8(input, previous, 15);
+            const __m128i _prev2 = _mm_alignr_epi8(input, previous, 14);
+            const __m128i _prev3 = _mm_alignr_epi8(input, previous, 13);
+            const __m128i _pairs = _mm_and_si128(
+                    _mm_and_si128(_mm_shuffle_epi8(_firstHigh, _mm_and_si128(_mm_srli_epi16(_prev1, 4), _nibble)),
+                                  _mm_shuffle_epi8(_firstLow, _mm_and_si128(_prev1, _nibble))),
+                    _mm_shuffle_epi8(_secondHigh, _mm_and_si128(_mm_srli_epi16(input, 4), _nibble)));
+            // Only the bytes 2 and 3 after a 3 or 4 byte lead can be two continuations in a row
+            const __m128i _expected = _mm_or_si128(
+                    _mm_subs_epu8(_prev2, _mm_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+                    _mm_subs_epu8(_prev3, _mm_set1_epi8(static_cast<char>(0xF0 - 0x80))));
+            return _mm_xor_si128(_mm_and_si128(_expected, _mm_set1_epi8(static_cast<char>(0x80))), _pairs);
+        }
+#endif
+
+        /**
+          \brief Classifies a block of bytes as ASCII, UTF-8 or invalid
+
+          With AVX2 or SSSE3 every block of 32 or 16 bytes is validated with
+          table lookups, see get_utf8_tables, and ASCII blocks only check that
+          the block before did not end in the middle of a sequence. The last
+          bytes go in a block padded with zeros, so a sequence cut by the end
+          is an error too. With SSE2 only the ASCII runs are skipped with
+          vectors, the multibyte characters are validated by the scalar code.
+        */
+        inline umi::log::utf8_kind classify_utf8(const char *data, std::size_t size) {
+#if defined(__AVX2__)
+            const char *_current = data;
+            const char *const _end = data + size;
+            // Bytes that would start a sequence not finished inside the block
+            const __m256i _last = _mm256_setr_epi8(
+                    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, static_cast<char>(0xF0 - 1),
+                    static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+            __m256i _previous = _mm256_setzero_si256();
+            __m256i _incomplete = _mm256_setzero_si256();
+            __m256i _errors = _mm256_setzero_si256();
+            bool _multibyte = false;
+            std::array<char, 32> _padded;
+            bool _done = false;
+            while (!_done) {
+                __m256i _input;
+                if (_end - _current >= 32) {
+                    _input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(_current));
+                    _current += 32;
+                } else {
+                    _padded.fill(0);
+                    std::memcpy(_padded.data(), _current, static_cast<std::size_t>(_end - _current));
+                    _input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(_padded.data()));
+                    _done = true;
+                }
+                if (_mm256_movemask_epi8(_input) == 0) {
+                    _errors = _mm256_or_si256(_errors, _incomplete);
+                    _incomplete = _mm256_setzero_si256();
+                } else {
+                    _multibyte = true;
+                    _errors = _mm256_or_si256(_errors, umi::log::get_utf8_errors(_input, _previous));
+                    _incomplete = _mm256_subs_epu8(_input, _last);
+                }
+                _previous = _input;
+            }
+            if (!_mm256_testz_si256(_errors, _errors)) {
+                return umi::log::utf8_kind::Invalid;
+            }
+            return _multibyte ? umi::log::utf8_kind::Utf8 : umi::log::utf8_kind::Ascii;
+#elif defined(__SSSE3__)
+            const char *_current = data;
+            const char *const _end = data + size;
+            // Bytes that would start a sequence not finished inside the block
+            const __m128i _last = _mm_setr_epi8(
+                    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, static_cast<char>(0xF0 - 1),
+                    static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+            __m128i _previous = _mm_setzero_si128();
+            __m128i _incomplete = _mm_setzero_si128();
+            __m128i _errors = _mm_setzero_si128();
+            bool _multibyte = false;
+            std::array<char, 16> _padded;
+            bool _done = false;
+            while (!_done) {
+                __m128i _input;
+                if (_end - _current >= 16) {
+                    _input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(_current));
+                    _current += 16;
+                } else {
+                    _padded.fill(0);
+                    std::memcpy(_padded.data(), _current, static_cast<std::size_t>(_end - _current));
+                    _input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(_padded.data()));
+                    _done = true;
+                }
+                if (_mm_movemask_epi8(_input) == 0) {
+                    _errors = _mm_or_si128(_errors, _incomplete);
+                    _incomplete = _mm_setzero_si128();
+                } else {
+                    _multibyte = true;
+                    _errors = _mm_or_si128(_errors, umi::log::get_utf8_errors(_input, _previous));
+                    _incomplete = _mm_subs_epu8(_input, _last);
+                }
+                _previous = _input;
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(_errors, _mm_setzero_si128())) != 0xFFFF) {
+                return umi::log::utf8_kind::Invalid;
+            }
+            return _multibyte ? umi::log::utf8_kind::Utf8 : umi::log::utf8_kind::Ascii;
+#elif defined(__SSE2__)
+            const unsigned char *_current = reinterpret_cast<const unsigned char *>(data);
+            const unsigned char *_end = _current + size;
+            umi::log::utf8_kind _kind = umi::log::utf8_kind::Ascii;
+            while (_end - _current >= 16) {
+                const uint32_t _mask = static_cast<uint32_t>(
+                        _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(_current))));
+                if (_mask == 0) {
+                    _current += 16;
+                    continue;
+                }
+                // Validate every sequence that starts in this block
+                const unsigned char *_blockEnd = _current + 16;
+                _current += __builtin_ctz(_mask);
+                while (_current < _blockEnd) {
+                    if (*_current < 0x80) {
+                        ++_current;
+                        continue;
+                    }
+                    const std::size_t _size = umi::log::utf8_sequence_size(_current, _end);
+                    if (_size == 0) {
+                        return umi::log::utf8_kind::Invalid;
+                    }
+                    _kind = umi::log::utf8_kind::Utf8;
+                    _current += _size;
+                }
+            }
+            const umi::log::utf8_kind _tail = umi::log::classify_utf8_scalar(
+                    reinterpret_cast<const char *>(_current), static_cast<std::size_t>(_end - _current));
+            return _tail == umi::log::utf8_kind::Ascii ? _kind : _tail;
+#else
+            return umi::log::classify_utf8_scalar(data, size);
+#endif
+        }
+
+        /**
+           \brief Class to use structured data on the logs
+
+           STRUCTURED-DATA provides a mechanism to express information in a well
+           defined, easily parseable and interpretable data format.  There are
+           multiple usage scenarios.  For example, it may express meta-
+           information about the syslog message or application-specific
+           information such as traffic counters or IP addresses.
+
+           STRUCTURED-DATA can contain zero, one, or multiple structured data
+           elements, which are referred to as "SD-ELEMENT" in this document.
+         */
+        class structured_data {
+        public:
+            /**
+             * Copies a string without the leading and trailing spaces
+             * */
+            static std::string trim_copy(const std::string &value) {
+                const auto _isSpace = [](unsigned char c) { return std::isspace(c) != 0; };
+                const auto _begin = std::find_if_not(value.begin(), value.end(), _isSpace);
+                const auto _end = std::find_if_not(value.rbegin(), std::string::const_reverse_iterator(_begin),
+                                                   _isSpace).base();
+                return std::string(_begin, _end);
+            }
+
+            /**
+             * Internal element stored in the structured data
+             * */
+            class sd_element {
+            public:
+                sd_element() {}
+                /**
+                 * constructor of the sd_element
+                 * \param id with the identifier we want to use in this element
+                 * */
+                sd_element(const std::string &id) : m_id(umi::log::structured_data::trim_copy(id)) { }
+
+                /**
+                 * constructor of the element using id and parameters
+                 * \param id with the identifier we want to use in this element
+                 * \param param with the parameters we will associate with the id
+                 * */
+                sd_element(const std::string &id, const std::vector<std::pair<std::string, std::string>> &param)
+                        : m_id(umi::log::structured_data::trim_copy(id)),
+                          m_params(param) { }
+
+                sd_element(const sd_element &c)
+                        : m_id(c.m_id),
+                          m_params(c.m_params) { }
+
+                sd_element(sd_element &&c)
+                        : m_id(std::move(c.m_id)),
+                          m_params(std::move(c.m_params)) { }
+
+                // Takes input string and returns an escaped string
+                std::string escape(const std::string &val) const {
+                    std::string ret_val(val.length() * 2, '\0');
+                    char *_end = umi::log::escape_to(&ret_val[0], val.data(), val.data() + val.size());
+                    ret_val.resize(static_cast<std::size_t>(_end - ret_val.data()));
+                    return ret_val;
+                }
+
+                sd_element & operator=(sd_element &s) {
+                    if (this != &s) {
+                        m_id = s.m_id;
+                        m_params = s.m_params;
+                    }
+                    return *this;
+                }
+
+                sd_element & operator=(sd_element &&s) {
+                    if (this != &s) {
+                        m_id = std::move(s.m_id);
+                        m_params = std::move(s.m_params);
+                    }
+                    return *this;
+                }
+
+                /**
+                  \brief Adds one param to the element escaping the value. This is important
+                  as it will be supposed to non be escaped.
+
+                  \param param_name containing the name of the parameter we want to use
+                  \param param_value containing the value of the parameter
+                 */
+                void add_param(const std::string &param_name, const std::string &param_value) {
+                    m_params.push_back(std::make_pair(param_name, sd_element::escape(param_value)));
+                }
+
+                /**
+                  \brief Adds one param to the element without scaping the value. This is important
+                  as it will be supposed to be already scaped and may produce errors in the destination.
+
+                  \param param_name containing the name of the parameter we want to use
+                  \param param_value containing the value of the parameter
+                 */
+                void add_param_non_escape(const std::string &param_name, const std::string &param_value) {
+                    m_params.push_back(std::make_pair(param_name, param_value));
+                }
+
+                /**
+                  \brief Appends the serialized element to the output
+                */
+                void append_to(std::string &out) const {
+                    out += '[';
+                    out += m_id;
+                    for (auto &i: m_params) {
+                        out += ' ';
+                        out += i.first;
+                        out += "=\"";
+                        out += i.second;
+                        out += '"';
+                    }
+                    out += ']';
+                }
+
+                template<typename SS>
+                friend SS &operator<<(SS &st, const sd_element &val) {
+                    st << "[" << val.m_id << " ";
+                    for (std::size_t i = 0; i < val.m_params.size(); ++i) {
+                        if (i > 0) {
+                            st << " ";
+                        }
+                        st << val.m_params[i].first << "=\"" << val.m_params[i].second << "\"";
+                    }
+                    st << "]";
+                    return st;
+                }
+
+            protected:
+                /**
+                    ID of the element
+                 */
+                std::string m_id;
+                /**
+                    PARAMS of the element
+                 */
+                std::vector<std::pair<std::string, std::string>> m_params;
+            };
+
+            structured_data() { }
+
+            structured_data(const std::vector<sd_element> &c) : m_elements(c) { }
+
+            structured_data(std::vector<sd_element> &&c) : m_elements(std::move(c)) { }
+
+            /**
+             * Adds one element to the element list
+             * */
+            void add_element(const sd_element &c) {
+                m_elements.push_back(c);
+            }
+
+            /**
+             * Adds one element to the element list
+             * */
+            void add_element(sd_element &&c) {
+                m_elements.emplace_back(std::move(c));
+            }
+
+            /**
+             * Checks if there is any element
+             * */
+            bool empty() const {
+                return m_elements.empty();
+            }
+
+            /**
+             * Appends the serialized elements to the output
+             * */
+            void append_to(std::string &out) const {
+                for (auto &i: m_elements) {
+                    i.append_to(out);
+                }
+            }
+
+            template<typename SS>
+            friend SS &operator<<(SS &st, const structured_data &val) {
+                for (auto &i: val.m_elements) {
+                    st << i;
+                }
+                return st;
+            }
+
+        protected:
+            /**
+                List of elements contained in our structured container
+             */
+            std::vector<sd_element> m_elements;
+        };
+
+        /**
+          \brief Checks a SD-NAME (SD-ID or PARAM-NAME) against RFC 5424
+
+          SD-NAME = 1*32PRINTUSASCII except '=', SP, ']' and '"'
+        */
+        inline constexpr bool is_valid_sd_name(const char *name) {
+            std::size_t i = 0;
+            for (; name[i] != '\0'; ++i) {
+                if (i >= 32 || name[i] < 33 || name[i] > 126 ||
+                    name[i] == '=' || name[i] == ']' || name[i] == '"') {
+                    return false;
+                }
+            }
+            return i > 0;
+        }
+
+        /**
+          \brief Structured data element with a fixed SD-ID and fixed params
+
+          The SD-ID and the param names are validated when the schema is
+          built, declaring it constexpr turns a bad name into a compile error.
+          The constant text between the values, like '[request@32473 id="',
+          is rendered once inside the schema so filling an element only
+          writes the escaped values.
+
+          \code
+          constexpr auto request_schema = umi::log::make_sd_schema("request@32473", "id", "route");
+          umi::log::sd_builder sd;
+          sd.add_element(request_schema, id, route);
+          \endcode
+        */
+        template<std::size_t N>
+        class sd_schema {
+        public:
+            /**
+             * Room for the longest SD-ID and names allowed
+             * */
+            static constexpr std::size_t max_text_size = 36 + 36 * N;
+
+            /**
+              \brief Validates the names and renders the constant text
+
+              \param id with the SD-ID
+              \param names with the PARAM-NAMEs in the order the values are given
+            */
+            constexpr sd_schema(const char *id, const std::array<const char *, N> &names)
+                    : m_text{},
+                      m_pieceEnd{},
+                      m_size(0) {
+                if (!umi::log::is_valid_sd_name(id)) {
+                    throw std::invalid_argument("invalid SD-ID");
+                }
+                append('[');
+                append(id);
+                for (std::size_t i = 0; i < N; ++i) {
+                    if (!umi::log::is_valid_sd_name(names[i])) {
+                        throw std::invalid_argument("invalid PARAM-NAME");
+                    }
+                    if (i > 0) {
+                        append('"');
+                    }
+                    append(' ');
+                    append(names[i]);
+                    append('=');
+                    append('"');
+                    m_pieceEnd[i] = m_size;
+                }
+                if (N > 0) {
+                    append('"');
+                }
+                append(']');
+                m_pieceEnd[N] = m_size;
+            }
+
+            /**
+              \brief Gets the constant text of the element
+            */
+            constexpr const char *get_text() const {
+                return m_text;
+            }
+
+            /**
+              \brief Gets where the constant text before the value i ends, N for the closing text
+            */
+            constexpr std::size_t get_piece_end(std::size_t i) const {
+                return m_pieceEnd[i];
+            }
+
+            /**
+              \brief Gets the size of the constant text
+            */
+            constexpr std::size_t get_size() const {
+                return m_size;
+            }
+
+        protected:
+            constexpr void append(char value) {
+                m_text[m_size++] = value;
+            }
+
+            constexpr void append(const char *value) {
+                while (*value != '\0') {
+                    m_text[m_size++] = *value++;
+                }
+            }
+
+            char m_text[max_text_size]; //!< Constant text of the element
+            std::size_t m_pieceEnd[N + 1]; //!< End of the text before each value
+            std::size_t m_size; //!< Size of the constant text
+        };
+
+        /**
+          \brief Creates a schema deducing the number of params
+        */
+        template<typename... Names>
+        inline constexpr umi::log::sd_schema<sizeof...(Names)> make_sd_schema(const char *id, Names... names) {
+            return umi::log::sd_schema<sizeof...(Names)>(id, {{names...}});
+        }
+
+        /**
+           \brief Builder that serializes the structured data while it is filled
+
+           Unlike structured_data, nothing is stored per parameter: the names and
+           values are taken as views and written, escaped, in a buffer owned by
+           the builder. The buffer lives inside the builder up to inline_size
+           bytes, so building the structured data of one message on the stack
+           doesn't allocate. The logger copies the finished section in one go.
+
+           \code
+           umi::log::sd_builder sd;
+           sd.add_element("request@32473").add_param("id", id).add_param("route", route);
+           log.log(facility, severity, "app", "REQ", sd, "done in %d ms", ms);
+           \endcode
+         */
+        class sd_builder {
+        public:
+            /**
+             * Bytes stored without allocating
+             * */
+            static constexpr std::size_t inline_size = 512;
+
+            sd_builder()
+                    : m_data(nullptr),
+                      m_size(0),
+                      m_capacity(inline_size) {
+                m_data = m_inline.data();
+            }
+
+            sd_builder(const sd_builder &) = delete;
+
+            sd_builder &operator=(const sd_builder &) = delete;
+
+            /**
+              \brief Takes the section of other, which is left empty
+
+              Inline data is copied and the pointer moved to the own storage.
+            */
+            sd_builder(sd_builder &&other) noexcept
+                    : m_data(nullptr),
+                      m_size(0),
+                      m_capacity(inline_size) {
+                m_data = m_inline.data();
+                *this = std::move(other);
+            }
+
+            sd_builder &operator=(sd_builder &&other) noexcept {
+                if (this == &other) {
+                    return *this;
+                }
+                if (other.m_heap) {
+                    m_heap = std::move(other.m_heap);
+                    m_data = m_heap.get();
+                    m_capacity = other.m_capacity;
+                } else {
+                    std::memcpy(m_inline.data(), other.m_data, other.m_size);
+                    m_heap.reset();
+                    m_data = m_inline.data();
+                    m_capacity = inline_size;
+                }
+                m_size = other.m_size;
+                other.m_data = other.m_inline.data();
+                other.m_size = 0;
+                other.m_capacity = inline_size;
+                return *this;
+            }
+
+            /**
+              \brief Opens a new element, the previous one is closed
+
+              \param id with the SD-ID of the element
+            */
+            sd_builder &add_element(boost::string_view id) {
+                reserve(id.size() + 2);
+                put('[');
+                put(id.data(), id.size());
+                put(']');
+                return *this;
+            }
+
+            /**
+              \brief Adds one element of a schema, only the values are escaped
+
+              \param schema with the SD-ID and the param names
+              \param values with one value per param of the schema
+            */
+            template<std::size_t N, typename... Values>
+            sd_builder &add_element(const umi::log::sd_schema<N> &schema, const Values &... values) {
+                static_assert(sizeof...(Values) == N, "one value is needed per param of the schema");
+                const std::array<boost::string_view, N> _values{{boost::string_view(values)...}};
+                std::size_t _size = schema.get_size();
+                for (auto &i: _values) {
+                    _size += i.size() * 2;
+                }
+                reserve(_size);
+                std::size_t _begin = 0;
+                for (std::size_t i = 0; i < N; ++i) {
+                    put(schema.get_text() + _begin, schema.get_piece_end(i) - _begin);
+                    char *_end = umi::log::escape_to(m_data + m_size, _values[i].data(),
+                                                     _values[i].data() + _values[i].size());
+                    m_size = static_cast<std::size_t>(_end - m_data);
+                    _begin = schema.get_piece_end(i);
+                }
+                put(schema.get_text() + _begin, schema.get_piece_end(N) - _begin);
+                return *this;
+            }
+
+            /**
+              \brief Adds one param to the last element escaping the value
+
+              \param param_name containing the name of the parameter
+              \param param_value containing the value of the parameter
+            */
+            sd_builder &add_param(boost::string_view param_name, boost::string_view param_value) {
+                if (open_param(param_name, param_value.size() * 2)) {
+                    char *_end = umi::log::escape_to(m_data + m_size, param_value.data(),
+                                                     param_value.data() + param_value.size());
+                    m_size = static_cast<std::size_t>(_end - m_data);
+                    put("\"]", 2);
+                }
+                return *this;
+            }
+
+            /**
+              \brief Adds one param to the last element without escaping the value,
+              it must be already escaped.
+
+              \param param_name containing the name of the parameter
+              \param param_value containing the value of the parameter
+            */
+            sd_builder &add_param_non_escape(boost::string_view param_name, boost::string_view param_value) {
+                if (open_param(param_name, param_value.size())) {
+                    put(param_value.data(), param_value.size());
+                    put("\"]", 2);
+                }
+                return *this;
+            }
+
+            /**
+              \brief Removes every element keeping the buffer
+            */
+            void clear() {
+                m_size = 0;
+            }
+
+            /**
+              \brief Checks if there is any element
+            */
+            bool empty() const {
+                return m_size == 0;
+            }
+
+            /**
+              \brief Gets the serialized structured data
+            */
+            boost::string_view get_data() const {
+                return boost::string_view(m_data, m_size);
+            }
+
+        protected:
+            /**
+              \brief Reopens the last element and writes the param name
+
+              \param valueSize with the maximum bytes the value will use
+              \return false if there is no element
+            */
+            bool open_param(boost::string_view param_name, std::size_t valueSize) {
+                if (m_size == 0) {
+                    return false;
+                }
+                // The last byte is the ']' of the element
+                --m_size;
+                reserve(param_name.size() + valueSize + 5);
+                put(' ');
+                put(param_name.data(), param_name.size());
+                put("=\"", 2);
+                return true;
+            }
+
+            /**
+              \brief Makes room for extra bytes
+            */
+            void reserve(std::size_t extra) {
+                if (m_size + extra > m_capacity) {
+                    const std::size_t _capacity = std::max(m_size + extra, m_capacity * 2);
+                    std::unique_ptr<char[]> _heap(new char[_capacity]);
+                    std::memcpy(_heap.get(), m_data, m_size);
+                    m_heap = std::move(_heap);
+                    m_data = m_heap.get();
+                    m_capacity = _capacity;
+                }
+            }
+
+            /**
+              \brief Writes bytes already reserved
+            */
+            void put(const char *data, std::size_t size) {
+                std::memcpy(m_data + m_size, data, size);
+                m_size += size;
+            }
+
+            /**
+              \brief Writes one byte already reserved
+            */
+            void put(char value) {
+                m_data[m_size++] = value;
+            }
+
+            std::array<char, inline_size> m_inline; //!< Storage used for small sections
+            std::unique_ptr<char[]> m_heap; //!< Storage used when the inline one is not enough
+            char *m_data; //!< Storage in use
+            std::size_t m_size; //!< Bytes written
+            std::size_t m_capacity; //!< Size of the storage in use
+        };
+
+        /**
+          \brief Structured data attached to every message logged by the thread
+
+          The contexts nest, each one adds its elements while it is alive. They
+          are kept encoded one after the other in a thread local buffer, so the
+          logger copies all of them with a single append per message.
+
+          \code
+          umi::log::sd_builder sd;
+          sd.add_element("request@32473").add_param("id", id).add_param("tenant", tenant);
+          umi::log::scoped_context context(sd);
+          log.log(...); // carries [request@32473 id=".." tenant=".."]
+          \endcode
+        */
+        class scoped_context {
+        public:
+            /**
+              \brief Pushes the elements of the builder
+            */
+            explicit scoped_context(const umi::log::sd_builder &sd)
+                    : scoped_context(sd.get_data()) { }
+
+            /**
+              \brief Pushes structured data already encoded, it is not validated
+            */
+            explicit scoped_context(boost::string_view encoded)
+                    : m_previousSize(buffer().size()) {
+                buffer().append(encoded.data(), encoded.size());
+            }
+
+            scoped_context(const scoped_context &) = delete;
+
+            scoped_context &operator=(const scoped_context &) = delete;
+
+            /**
+              \brief Pops the elements
+            */
+            ~scoped_context() {
+                buffer().resize(m_previousSize);
+            }
+
+            /**
+              \brief Gets the encoded elements of every context alive in the thread
+            */
+            static boost::string_view get_data() {
+                const std::string &_buffer = buffer();
+                return boost::string_view(_buffer.data(), _buffer.size());
+            }
+
+        protected:
+            /**
+              \brief Contexts of the current thread
+            */
+            static std::string &buffer() {
+                static thread_local std::string _buffer;
+                return _buffer;
+            }
+
+            /**
+             * Size of the buffer before this context
+             * */
+            std::size_t m_previousSize;
+        };
+
+        /**
+          \brief Fast non cryptographic hash of a block of bytes
+
+          The input is consumed 8 bytes at a time, it is meant to compare
+          messages on the logger thread, not to be stored anywhere.
+        */
+        inline uint64_t hash_bytes(const char *data, std::size_t size) {
+            const uint64_t _multiplier = 0x9e3779b97f4a7c15ULL;
+            uint64_t _hash = static_cast<uint64_t>(size) * _multiplier;
+            std::size_t i = 0;
+            for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+                uint64_t _word;
+                std::memcpy(&_word, data + i, sizeof(_word));
+                _hash = (_hash ^ _word) * _multiplier;
+                _hash ^= _hash >> 32;
+            }
+            if (i < size) {
+                uint64_t _word = 0;
+                std::memcpy(&_word, data + i, size - i);
+                _hash = (_hash ^ _word) * _multiplier;
+                _hash ^= _hash >> 32;
+            }
+            return _hash;
+        }
+
+        /**
+          \brief Encoded message waiting in the queue to be sent
+
+          Besides the bytes to send it keeps where the fields of the header
+          are, so the logger thread can work with the message without parsing it.
+        */
+        class log_message {
+        public:
+            /**
+              \brief Creates the message
+
+              \param data with the whole encoded message
+              \param priority with the PRI of the message
+              \param stampBegin with the offset of the timestamp
+              \param stampEnd with the offset after the timestamp
+              \param headerSize with the offset of the structured data
+              \param bodyBegin with the offset of the MSG
+              \param site with the call site that generated the message
+              \param msgidHash with the hash of the MSGID, 0 if not needed
+            */
+            log_message(std::string &&data,
+                        int priority,
+                        std::size_t stampBegin,
+                        std::size_t stampEnd,
+                        std::size_t headerSize,
+                        std::size_t bodyBegin,
+                        const void *site,
+                        uint64_t msgidHash)
+                    : m_data(std::move(data)),
+                      m_priority(priority),
+                      m_stampBegin(stampBegin),
+                      m_stampEnd(stampEnd),
+                      m_headerSize(headerSize),
+                      m_bodyBegin(bodyBegin),
+                      m_site(site),
+                      m_msgidHash(msgidHash) { }
+
+            /**
+              \brief Gets the encoded message
+            */
+            const std::string &get_data() const {
+                return m_data;
+            }
+
+            /**
+              \brief Gets the priority of the message
+            */
+            int get_priority() const {
+                return m_priority;
+            }
+
+            /**
+              \brief Gets the offset where the timestamp starts
+            */
+            std::size_t get_stamp_begin() const {
+                return m_stampBegin;
+            }
+
+            /**
+              \brief Gets the offset after the timestamp
+            */
+            std::size_t get_stamp_end() const {
+                return m_stampEnd;
+            }
+
+            /**
+              \brief Gets the size of the header, the structured data starts here
+            */
+            std::size_t get_header_size() const {
+                return m_headerSize;
+            }
+
+            /**
+              \brief Gets the offset of the MSG, after the structured data
+            */
+            std::size_t get_body_begin() const {
+                return m_bodyBegin;
+            }
+
+            /**
+              \brief Gets the bytes kept when the message is cut to limit, never less than the
+              header and the structured data, and never in the middle of a UTF-8 character
+            */
+            std::size_t get_truncated_size(std::size_t limit) const {
+                if (m_data.size() <= limit) {
+                    return m_data.size();
+                }
+                std::size_t _size = std::max(limit, m_bodyBegin);
+                while (_size > m_bodyBegin && (static_cast<unsigned char>(m_data[_size]) & 0xC0) == 0x80) {
+                    --_size;
+                }
+                return _size;
+            }
+
+            /**
+              \brief Gets the call site that generated the message
+            */
+            const void *get_site() const {
+                return m_site;
+            }
+
+            /**
+              \brief Gets the hash of the MSGID used to choose a connection of a group
+            */
+            uint64_t get_msgid_hash() const {
+                return m_msgidHash;
+            }
+
+            /**
+              \brief Stamps the message when it is queued, only if the latency is tracked
+
+              \param enqueued with the time the message is queued
+              \param encode with the time spent encoding it
+            */
+            void set_enqueued(std::chrono::steady_clock::time_point enqueued,
+                              std::chrono::steady_clock::duration encode) {
+                m_enqueued = enqueued;
+                m_encode = encode;
+            }
+
+            /**
+              \brief Gets the time the message was queued, epoch if it was not stamped
+            */
+            std::chrono::steady_clock::time_point get_enqueued() const {
+                return m_enqueued;
+            }
+
+            /**
+              \brief Gets the time spent encoding the message
+            */
+            std::chrono::steady_clock::duration get_encode() const {
+                return m_encode;
+            }
+
+            /**
+              \brief Stamps the message when the pipeline hands it to the connections
+            */
+            void set_dequeued(std::chrono::steady_clock::time_point dequeued) {
+                m_dequeued = dequeued;
+            }
+
+            /**
+              \brief Gets the time the pipeline handed the message to the connections
+            */
+            std::chrono::steady_clock::time_point get_dequeued() const {
+                return m_dequeued;
+            }
+
+            /**
+              \brief Sets the id of the copy kept by the crash handler
+            */
+            void set_crash_id(uint64_t id) {
+                m_crashId = id;
+            }
+
+            /**
+              \brief Gets the id of the copy kept by the crash handler, 0 if there is none
+            */
+            uint64_t get_crash_id() const {
+                return m_crashId;
+            }
+
+            /**
+              \brief Sets the connections that have to write the message before the crash handler
+              forgets it
+            */
+            void set_crash_writers(uint32_t count) {
+                m_crashWriters.store(count, std::memory_order_relaxed);
+            }
+
+            /**
+              \brief A connection has written the message
+
+              \return true for the last connection, the copy in the crash handler can be confirmed
+            */
+            bool count_crash_writer() {
+                return m_crashWriters.fetch_sub(1, std::memory_order_acq_rel) == 1;
+            }
+
+        protected:
+            std::string m_data; //!< Encoded message
+            int m_priority; //!< PRI of the message
+            std::size_t m_stampBegin; //!< Offset of the timestamp
+            std::size_t m_stampEnd; //!< Offset after the timestamp
+            std::size_t m_headerSize; //!< Offset of the structured data
+            std::size_t m_bodyBegin; //!< Offset of the MSG
+            const void *m_site; //!< Format string used to create the message
+            uint64_t m_msgidHash; //!< Hash of the MSGID
+            std::chrono::steady_clock::time_point m_enqueued; //!< Queued, epoch if not tracked
+            std::chrono::steady_clock::duration m_encode{0}; //!< Time spent encoding
+            std::chrono::steady_clock::time_point m_dequeued; //!< Handed to the connections
+            uint64_t m_crashId = 0; //!< Copy kept by the crash handler
+            std::atomic<uint32_t> m_crashWriters{1}; //!< Connections that have not written it yet
+        };
+
+        /**
+          \brief Writes the messages not written yet to a descriptor when the process crashes
+
+          Once installed every logger copies its messages in a ring of slots
+          allocated by install, and the connections mark them as they are
+          written. On a fatal signal the handler writes the slots not marked,
+          oldest first and one message per line, to a descriptor opened
+          before: a file, or a connected UDP or unix socket. The handler only
+          uses async-signal-safe calls, it doesn't allocate nor lock. Then the
+          previous action of the signal runs.
+
+          A producer writing a slot while the process crashes may leave it
+          torn, the dump is best effort.
+        */
+        class crash_handler {
+        public:
+            /**
+              \brief Allocates the ring and installs the handler for SIGSEGV, SIGABRT, SIGBUS, SIGFPE and SIGILL
+
+              The calling thread gets an alternate stack so a stack overflow can
+              be reported. The ring and the descriptor are kept until the
+              process ends.
+
+              \param fd with the descriptor opened for the dump
+              \param slots with the messages kept
+              \param slotSize with the bytes kept of each message, the newline included
+              \return false if it was already installed or the platform doesn't support it
+            */
+            static bool install(int fd, std::size_t slots = 1024, std::size_t slotSize = 2048) {
+#ifndef _WIN32
+                state &_state = get_state();
+                if (_state.m_slots.load(std::memory_order_acquire) != nullptr || slots == 0 || slotSize < 2) {
+                    return false;
+                }
+                _state.m_data = new char[slots * slotSize];
+                _state.m_slotCount = slots;
+                _state.m_slotSize = slotSize;
+                _state.m_fd = fd;
+                // A stack overflow leaves no stack to run the handler
+                stack_t _stack;
+                _stack.ss_sp = new char[SIGSTKSZ * 4];
+                _stack.ss_size = SIGSTKSZ * 4;
+                _stack.ss_flags = 0;
+                sigaltstack(&_stack, nullptr);
+                _state.m_slots.store(new slot[slots], std::memory_order_release);
+                struct sigaction _action;
+                std::memset(&_action, 0, sizeof(_action));
+                _action.sa_handler = &crash_handler::handle_signal;
+                _action.sa_flags = SA_ONSTACK;
+                sigemptyset(&_action.sa_mask);
+                for (std::size_t i = 0; i < signal_count; ++i) {
+                    sigaction(get_signals()[i], &_action, &_state.m_previous[i]);
+                }
+                return true;
+#else
+                (void) fd;
+                (void) slots;
+                (void) slotSize;
+                return false;
+#endif
+            }
+
+            /**
+              \brief Copies a message in the ring
+
+              \return the id to confirm it, 0 if the handler is not installed
+            */
+            static uint64_t store(const std::string &data) {
+                state &_state = get_state();
+                slot *_slots = _state.m_slots.load(std::memory_order_acquire);
+                if (_slots == nullptr) {
+                    return 0;
+                }
+                const uint64_t _sequence = _state.m_head.fetch_add(1, std::memory_order_relaxed);
+                const std::size_t _index = static_cast<std::size_t>(_sequence % _state.m_slotCount);
+                slot &_slot = _slots[_index];
+                _slot.m_id.store(0, std::memory_order_relaxed); // the dump skips it meanwhile
+                std::atomic_thread_fence(std::memory_order_release);
+                char *_data = _state.m_data + _index * _state.m_slotSize;
+                const std::size_t _size = std::min(data.size(), _state.m_slotSize - 1);
+                std::memcpy(_data, data.data(), _size);
+                _data[_size] = '\n';
+                _slot.m_size = _size + 1;
+                _slot.m_written.store(false, std::memory_order_relaxed);
+                _slot.m_id.store(_sequence + 1, std::memory_order_release);
+                return _sequence + 1;
+            }
+
+            /**
+              \brief Marks a message as written by every connection, or dropped on purpose, the
+              dump skips it
+            */
+            static void confirm(uint64_t id) {
+                if (id == 0) {
+                    return;
+                }
+                state &_state = get_state();
+                slot &_slot = _state.m_slots.load(std::memory_order_acquire)[(id - 1) % _state.m_slotCount];
+                if (_slot.m_id.load(std::memory_order_acquire) == id) {
+                    _slot.m_written.store(true, std::memory_order_relaxed);
+                }
+            }
+
+            /**
+              \brief Writes the messages not written, only the first call does it. It can be
+              called from another signal handler.
+            */
+            static void dump() {
+#ifndef _WIN32
+                state &_state = get_state();
+                slot *_slots = _state.m_slots.load(std::memory_order_acquire);
+                if (_slots == nullptr || _state.m_dumped.exchange(true)) {
+                    return;
+                }
+                const uint64_t _head = _state.m_head.load(std::memory_order_acquire);
+                const uint64_t _first = _head > _state.m_slotCount ? _head - _state.m_slotCount : 0;
+                for (uint64_t i = _first; i < _head; ++i) {
+                    const std::size_t _index = static_cast<std::size_t>(i % _state.m_slotCount);
+                    const slot &_slot = _slots[_index];
+                    if (_slot.m_id.load(std::memory_order_acquire) != i + 1 ||
+                        _slot.m_written.load(std::memory_order_relaxed)) {
+                        continue;
+                    }
+                    const char *_data = _state.m_data + _index * _state.m_slotSize;
+                    std::size_t _left = _slot.m_size;
+                    while (_left > 0) {
+                        const ssize_t _result = ::write(_state.m_fd, _data, _left);
+                        if (_result < 0 && errno == EINTR) {
+                            continue;
+                        }
+                        if (_result <= 0) {
+                            break;
+                        }
+                        _data += _result;
+                        _left -= static_cast<std::size_t>(_result);
+                    }
                 }
+#endif
+            }
+
+        protected:
+            static constexpr std::size_t signal_count = 5;
+
+            /**
+             * Message kept in the ring
+             * */
+            struct slot {
+                std::atomic<uint64_t> m_id{0}; //!< Sequence + 1 of the message, 0 while it is copied
+                std::atomic<bool> m_written{true}; //!< A connection has written the message
+                std::size_t m_size = 0; //!< Bytes of the message with the newline
+            };
+
+            /**
+             * Ring and descriptor, constant initialized so the handler can use them
+             * */
+            struct state {
+                std::atomic<slot *> m_slots{nullptr}; //!< Slots, null until installed
+                char *m_data = nullptr; //!< Messages of the slots
+                std::size_t m_slotCount = 0; //!< Slots of the ring
+                std::size_t m_slotSize = 0; //!< Bytes of each slot
+                int m_fd = -1; //!< Descriptor of the dump
+                std::atomic<uint64_t> m_head{0}; //!< Next sequence
+                std::atomic<bool> m_dumped{false}; //!< The dump has been done
+#ifndef _WIN32
+                struct sigaction m_previous[signal_count]; //!< Actions replaced by the handler
+#endif
+            };
+
+            static state &get_state() {
+                static state _state;
+                return _state;
+            }
+
+#ifndef _WIN32
+            static const int *get_signals() {
+                static const int _signals[signal_count] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+                return _signals;
+            }
+
+            /**
+              \brief Dumps the ring and runs the previous action of the signal
+            */
+            static void handle_signal(int signal) {
+                const int _errno = errno;
+                dump();
+                for (std::size_t i = 0; i < signal_count; ++i) {
+                    if (get_signals()[i] == signal) {
+                        sigaction(signal, &get_state().m_previous[i], nullptr);
+                    }
+                }
+                errno = _errno;
+                // Delivered when the handler returns, a fault raises again by itself
+                raise(signal);
+            }
+#endif
+        };
+
+        /**
+          \brief Health of one connection
+        */
+        struct connection_health {
+            bool m_open; //!< The connection is ready to write
+            std::size_t m_pendingBytes; //!< Bytes waiting to be written
+            std::chrono::steady_clock::time_point m_lastSuccess; //!< Last write completed, epoch if none
+            uint64_t m_errors; //!< Connections and writes failed
+        };
+
+        /**
+          \brief Copy of the buckets of latency histograms, used to read them
+
+          The buckets follow the HDR layout: below 16 ns every nanosecond has
+          its bucket, above each power of two is split in 16 buckets, so a
+          value is known with a 6% of error. The values over 2^40 ns (18
+          minutes) go to the last bucket.
+        */
+        class latency_snapshot {
+        public:
+            /**
+             * Buckets in each power of two
+             * */
+            static constexpr std::size_t sub_buckets = 16;
+            /**
+             * Buckets of the histogram, up to 2^40 ns
+             * */
+            static constexpr std::size_t bucket_count = sub_buckets * 37;
+
+            latency_snapshot()
+                    : m_counts(bucket_count, 0) {
+            }
+
+            /**
+              \brief Gets the bucket of a value in nanoseconds
+            */
+            static std::size_t get_bucket(uint64_t value) {
+                if (value < sub_buckets) {
+                    return static_cast<std::size_t>(value);
+                }
+#if defined(__GNUC__)
+                const std::size_t _magnitude = static_cast<std::size_t>(63 - __builtin_clzll(value)) - 4;
+#else
+                std::size_t _magnitude = 0;
+                while ((value >> _magnitude) >= 2 * sub_buckets) {
+                    ++_magnitude;
+                }
+#endif
+                const std::size_t _bucket = (_magnitude + 1) * sub_buckets +
+                                            static_cast<std::size_t>(value >> _magnitude) - sub_buckets;
+                return std::min(_bucket, bucket_count - 1);
+            }
+
+            /**
+              \brief Gets the highest value in nanoseconds of a bucket
+            */
+            static uint64_t get_bucket_limit(std::size_t bucket) {
+                if (bucket < sub_buckets) {
+                    return bucket;
+                }
+                const std::size_t _magnitude = bucket / sub_buckets - 1;
+                return ((sub_buckets + bucket % sub_buckets + 1) << _magnitude) - 1;
+            }
+
+            /**
+              \brief Adds values to a bucket
+            */
+            void add(std::size_t bucket, uint64_t count) {
+                m_counts[bucket] += count;
+                m_count += count;
+            }
+
+            /**
+              \brief Removes the values of an older snapshot of the same histogram
+            */
+            void subtract(const latency_snapshot &older) {
+                for (std::size_t i = 0; i < bucket_count; ++i) {
+                    m_counts[i] -= older.m_counts[i];
+                }
+                m_count -= older.m_count;
+            }
 
-            protected:
-                /**
-                    ID of the element
-                 */
-                std::string m_id;
-                /**
-                    PARAMS of the element
-                 */
-                std::vector<std::pair<std::string, std::string>> m_params;
-            };
+            /**
+              \brief Adds the values of another snapshot
+            */
+            void merge(const latency_snapshot &other) {
+                for (std::size_t i = 0; i < bucket_count; ++i) {
+                    m_counts[i] += other.m_counts[i];
+                }
+                m_count += other.m_count;
+            }
 
-            structured_data() { }
+            /**
+              \brief Gets the number of values recorded
+            */
+            uint64_t get_count() const {
+                return m_count;
+            }
 
-            structured_data(const std::vector<sd_element> &c) : m_elements(c) { }
+            /**
+              \brief Gets the value under which the percentile of the values are, 0 if there are none
 
-            structured_data(std::vector<sd_element> &&c) : m_elements(std::move(c)) { }
+              \param percentile from 0 to 100
+            */
+            std::chrono::nanoseconds get_percentile(double percentile) const {
+                const uint64_t _target = std::max<uint64_t>(
+                        1, static_cast<uint64_t>(std::ceil(static_cast<double>(m_count) * percentile / 100.0)));
+                uint64_t _seen = 0;
+                for (std::size_t i = 0; i < bucket_count && m_count > 0; ++i) {
+                    _seen += m_counts[i];
+                    if (_seen >= _target) {
+                        return std::chrono::nanoseconds(get_bucket_limit(i));
+                    }
+                }
+                return std::chrono::nanoseconds(0);
+            }
 
             /**
-             * Adds one element to the element list
-             * */
-            void add_element(const sd_element &c) {
-                m_elements.push_back(c);
+              \brief Gets the highest value recorded, 0 if there are none
+            */
+            std::chrono::nanoseconds get_max() const {
+                return get_percentile(100.0);
             }
 
+        protected:
+            std::vector<uint64_t> m_counts; //!< Values by bucket
+            uint64_t m_count = 0; //!< Values recorded
+        };
+
+        /**
+          \brief Counters of one connection, see logger::get_metrics
+        */
+        struct connection_metrics {
+            bool m_open; //!< The connection is ready to write
+            uint64_t m_sent; //!< Messages handed to the connection
+            uint64_t m_written; //!< Messages written, retransmissions included
+            uint64_t m_writtenBytes; //!< Bytes written, framing included
+            uint64_t m_batches; //!< Writes completed, each one with a batch of messages
+            uint64_t m_dropped; //!< Messages lost by errors or by the pending limit
+            std::size_t m_pendingBytes; //!< Bytes waiting to be written
+            std::size_t m_pendingLimit; //!< Pending bytes kept while the connection is not open
+            uint64_t m_reconnects; //!< Connections opened again after an error
+            uint64_t m_errors; //!< Connections and writes failed
+            uint64_t m_truncated; //!< Messages cut to the datagram limit
+            umi::log::latency_snapshot m_pendingLatency; //!< From handed to the connection to its write start
+            umi::log::latency_snapshot m_writeLatency; //!< From the write start to its completion
+            umi::log::latency_snapshot m_totalLatency; //!< From queued to the write completion
+        };
+
+        /**
+          \brief Snapshot of the counters of a logger
+
+          The counters grow since the logger was created. Every log call ends
+          filtered, sampled out, rate limited, as a format error or enqueued;
+          the rate limit summaries are enqueued too. The latencies are recorded
+          only if the logger tracks them.
+        */
+        struct logger_metrics {
+            uint64_t m_filtered; //!< Calls above the maximum facility or severity
+            uint64_t m_sampledOut; //!< Calls dropped by the sampling
+            uint64_t m_rateLimited; //!< Calls dropped by the rate limit
+            uint64_t m_formatErrors; //!< Calls whose format failed
+            uint64_t m_enqueued; //!< Messages stored in the queues
+            uint64_t m_collapsed; //!< Repeats counted instead of sent
+            std::size_t m_queueDepth; //!< Messages in the queues not handed to the connections yet
+            umi::log::latency_snapshot m_encodeLatency; //!< Time to encode the messages
+            umi::log::latency_snapshot m_queueLatency; //!< From queued to handed to the connections
+            std::vector<umi::log::connection_metrics> m_connections; //!< In the order of the connection data
+        };
+
+        /**
+          \brief Counters split in cells by thread
+
+          Every thread adds to its own cell, one cache line apart from the
+          others, so the producers don't contend for the counters. A read adds
+          the cells.
+
+          \tparam Counter enum of the counters, Count must be the last one
+        */
+        template<typename Counter>
+        class sharded_counters {
+        public:
             /**
-             * Adds one element to the element list
-             * */
-            void add_element(sd_element &&c) {
-                m_elements.emplace_back(c);
+              \brief Number of cells, the threads share them when there are more
+            */
+            static constexpr std::size_t cell_count = 16;
+
+            /**
+              \brief Adds to one counter in the cell of the calling thread
+            */
+            void add(Counter counter, uint64_t value = 1) {
+                m_cells[get_cell()].m_values[static_cast<std::size_t>(counter)].fetch_add(
+                        value, std::memory_order_relaxed);
             }
 
-            template<typename SS>
-            friend SS &operator<<(SS &st, const structured_data &val) {
-                for (auto &i: val.m_elements) {
-                    st << i;
+            /**
+              \brief Gets the total of one counter
+            */
+            uint64_t get(Counter counter) const {
+                uint64_t _total = 0;
+                for (auto &i: m_cells) {
+                    _total += i.m_values[static_cast<std::size_t>(counter)].load(std::memory_order_relaxed);
                 }
-                return st;
+                return _total;
             }
 
         protected:
+            static constexpr std::size_t counter_count = static_cast<std::size_t>(Counter::Count);
+
             /**
-                List of elements contained in our structured container
-             */
-            std::vector<sd_element> m_elements;
+              \brief Gets the cell of the calling thread, threads are numbered as they use it
+            */
+            static std::size_t get_cell() {
+                static std::atomic<std::size_t> _nextThread(0);
+                static thread_local const std::size_t _cell = _nextThread++ % cell_count;
+                return _cell;
+            }
+
+            struct cell {
+                std::array<std::atomic<uint64_t>, counter_count> m_values{}; //!< Counters of the cell
+                char m_padding[64]; //!< Keeps the next cell in another cache line
+            };
+
+            /**
+             * Cells of the counters
+             * */
+            std::array<cell, cell_count> m_cells;
         };
 
         /**
@@ -827,7 +3409,8 @@ namespace umi {
           https://tools.ietf.org/html/rfc5427
         */
         class logger {
-            friend class socket;
+            friend class child_logger;
+            friend class logger_impl;
 
         public:
             /**
@@ -842,20 +3425,52 @@ namespace umi {
         public:
             /**
               \brief Creates a logger instance
+
+              \throw std::invalid_argument if the transport is shared and another logger uses it, or
+              one of its collectors, with other settings
             */
             logger(const logger_local_data &loggerData, const std::vector<umi::log::connection> &loggerConnection);
 
             /**
-              \brief Release the resources used by the logger
+              \brief Release the resources used by the logger, waiting for the shutdown timeout
+            */
+            virtual ~logger();
+
+
+            /**
+              \brief Gets a future ready when every message logged before the call has been
+              written by its connections
+
+              The messages dropped by a connection (errors, pending limit) count
+              as done. Over RELP a message is done when the collector acks it.
+            */
+            std::shared_future<void> flush_async();
+
+            /**
+              \brief Waits until every message logged before the call has been written
+
+              \return false if the timeout expires first, the messages are still sent
             */
-            virtual ~logger() {
-                m_run = false;
-                std::unique_lock<std::mutex> _lock(m_queueMutex);
-                m_ioservice.stop();// stop the io service
-                m_connections.clear(); // stop the connections
-                m_loggerThread.join(); // join the thread to release the memory
+            bool flush(std::chrono::milliseconds timeout) {
+                return flush_async().wait_for(timeout) == std::future_status::ready;
             }
 
+            /**
+              \brief Gets the health of every connection, in the order of the connection data
+
+              With several pipelines a connection is open only if it is open in
+              all of them, the bytes and errors are added.
+            */
+            std::vector<umi::log::connection_health> get_health() const;
+
+            /**
+              \brief Gets a snapshot of the counters of the logger and its connections
+
+              The counters of a connection shared with other loggers include
+              their messages too.
+            */
+            umi::log::logger_metrics get_metrics() const;
+
             /**
               \brief Gets the connection data
             */
@@ -872,35 +3487,8 @@ namespace umi {
                      const std::string &app,
                      const std::string &msgid,
                      const char *message, Args &&... args) {
-                if (get_priority(facility, severity) <=
-                    get_priority(m_loggerLocalData.get_max_facility(),
-                                 m_loggerLocalData.get_max_severity())) {
-                    std::stringstream _messageToSend;
-                    // The maximum buffer we can send is 64k
-                    std::array<char, 1024 * 64> _maxBuffer;
-
-                    int _result = snprintf(_maxBuffer.data(), _maxBuffer.size(), message, std::forward<Args>(args)...);
-                    if (_result >= 0) {
-                        _messageToSend
-                        << "<" << get_priority(facility, severity) << ">"
-                        << m_loggerLocalData.get_version() << " "
-                        << umi::log::Timestamp::get_timestamp(m_loggerLocalData.get_precision()) << " "
-                        << m_loggerLocalData.get_hostname() << " "
-                        << app << " "
-                        << getpid() << " "
-                        << msgid << " - "
-                        << _maxBuffer.data();
-                        if (m_loggerLocalData.get_print()) {
-                            std::cout << _messageToSend.str() << '\n';
-                        }
-                        {
-                            std::unique_lock<std::mutex> _lock(m_queueMutex);
-                            // The elements are store as shared pointer to avoid problems with the async logging
-                            m_messageQueue.push(std::make_shared<std::string>(_messageToSend.str()));
-                        }
-                        m_ioservice.post([this]() { this->process_messages(); });
-                    }
-                }
+                format_message(facility, severity, app, msgid, boost::string_view(), '-',
+                               message, std::forward<Args>(args)...);
             }
 
             /**
@@ -913,465 +3501,407 @@ namespace umi {
                      const std::string &msgid,
                      const umi::log::structured_data &st,
                      const char *message, Args &&... args) {
-                if (get_priority(facility, severity) <=
+                format_message(facility, severity, app, msgid, boost::string_view(), st,
+                               message, std::forward<Args>(args)...);
+            }
+
+            /**
+             \brief Log a message into the system with structured data already serialized.
+            */
+            template<typename... Args>
+            void log(umi::log::facility facility,
+                     umi::log::severity severity,
+                     const std::string &app,
+                     const std::string &msgid,
+                     const umi::log::sd_builder &st,
+                     const char *message, Args &&... args) {
+                format_message(facility, severity, app, msgid, boost::string_view(), st,
+                               message, std::forward<Args>(args)...);
+            }
+
+        protected:
+            /**
+              \brief Filters, formats and stores one message
+
+              \param preset with structured data already encoded
+              \param st with the structured data of the call
+            */
+            template<typename SD, typename... Args>
+            void format_message(umi::log::facility facility,
+                                umi::log::severity severity,
+                                const std::string &app,
+                                const std::string &msgid,
+                                boost::string_view preset,
+                                const SD &st,
+                                const char *message, Args &&... args) {
+                uint32_t _sampleRate = 1;
+                if (get_priority(facility, severity) >
                     get_priority(m_loggerLocalData.get_max_facility(),
                                  m_loggerLocalData.get_max_severity())) {
-                    std::stringstream _messageToSend;
+                    m_counters.add(logger_counter::Filtered);
+                } else if (admit_message(facility, severity, app, msgid, message, _sampleRate)) {
+                    const auto _encodeStart = m_loggerLocalData.get_latency_tracking() ?
+                                              std::chrono::steady_clock::now() :
+                                              std::chrono::steady_clock::time_point();
                     // The maximum buffer we can send is 64k
                     std::array<char, 1024 * 64> _maxBuffer;
 
                     int _result = snprintf(_maxBuffer.data(), _maxBuffer.size(), message, std::forward<Args>(args)...);
                     if (_result >= 0) {
-                        _messageToSend
-                        << "<" << get_priority(facility, severity) << ">"
-                        << m_loggerLocalData.get_version() << " "
-                        << umi::log::Timestamp::get_timestamp(m_loggerLocalData.get_precision()) << " "
-                        << m_loggerLocalData.get_hostname() << " "
-                        << app << " "
-                        << getpid() << " "
-                        << msgid << " "
-                        << st << " "
-                        << _maxBuffer.data();
-                        if (m_loggerLocalData.get_print()) {
-                            std::cout << _messageToSend.str() << '\n';
-                        }
-                        {
-                            std::unique_lock<std::mutex> _lock(m_queueMutex);
-                            // The elements are store as shared pointer to avoid problems with the async logging
-                            m_messageQueue.push(std::make_shared<std::string>(_messageToSend.str()));
-                        }
-                        m_ioservice.post([this]() { this->process_messages(); });
+                        push_message(get_priority(facility, severity), app, msgid, preset, st,
+                                     boost::string_view(_maxBuffer.data(),
+                                                        std::min<std::size_t>(static_cast<std::size_t>(_result),
+                                                                              _maxBuffer.size() - 1)),
+                                     message, _sampleRate, _encodeStart);
+                    } else {
+                        m_counters.add(logger_counter::Format_Errors);
                     }
                 }
             }
 
         protected:
             /**
-              \brief Internal function to process the queue
+              \brief Applies the sampling and the rate limit to one log call
+
+              When the call is admitted after some messages were dropped a summary
+              with the number of suppressed messages is sent before it, unless the
+              sweep has already reported them.
+
+              \param site with the format string, used as call site identifier
+              \param sampleRate receives N when the message is kept one in N times
+              \return true if the message has to be formatted and sent
             */
-            void process_messages();
+            bool admit_message(umi::log::facility facility,
+                               umi::log::severity severity,
+                               const std::string &app,
+                               const std::string &msgid,
+                               const char *site,
+                               uint32_t &sampleRate) {
+                if (m_sampler && !m_sampler->sample(severity, site, sampleRate)) {
+                    m_counters.add(logger_counter::Sampled_Out);
+                    return false;
+                }
+                if (!m_rateLimiter) {
+                    return true;
+                }
+                uint64_t _suppressed = 0;
+                if (!m_rateLimiter->try_acquire(m_rateLimiter->get_key(app, msgid, site),
+                                                get_priority(facility, severity), app, msgid, site, _suppressed)) {
+                    m_counters.add(logger_counter::Rate_Limited);
+                    return false;
+                }
+                if (_suppressed > 0) {
+                    send_suppressed(get_priority(facility, severity), app, msgid, site, _suppressed);
+                }
+                return true;
+            }
 
-        protected:
             /**
-             * Local logger data
-             * */
-            umi::log::logger_local_data m_loggerLocalData;
-            /**
-             * Local connection information
-             * */
-            std::vector<umi::log::connection> m_loggerConnection;
-            /**
-             * Atomic to control de status
-             * */
-            std::atomic_bool m_run;
-            /**
-             * The boost io service
-             * */
-            boost::asio::io_service m_ioservice;
-            /**
-             * The worker to keep the io service pending of new messages
-             * */
-            boost::asio::io_service::work m_worker;
-            /**
-             * Connections we will use to send data
-             * */
-            std::vector<std::unique_ptr<umi::log::socket>> m_connections;
-            /**
-             * Thread used to run the io service
-             * */
-            std::thread m_loggerThread;
+              \brief Sends the summary with the number of messages suppressed of one log call
+            */
+            void send_suppressed(int priority, const std::string &app, const std::string &msgid, const char *site,
+                                 uint64_t suppressed) {
+                std::array<char, 32> _count;
+                const int _countSize = snprintf(_count.data(), _count.size(), "%llu",
+                                                static_cast<unsigned long long>(suppressed));
+                umi::log::sd_builder _st;
+                _st.add_element(umi::log::umilog_sd_id)
+                        .add_param_non_escape("suppressed", boost::string_view(_count.data(), _countSize));
+                std::string _body("suppressed ");
+                _body.append(_count.data(), _countSize);
+                _body += " messages";
+                push_message(priority, app, msgid, boost::string_view(), _st, _body, site, 1,
+                             m_loggerLocalData.get_latency_tracking() ?
+                             std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point());
+            }
+
             /**
-             * Mutex used to protect the message queue
-             * */
-            std::mutex m_queueMutex;
+              \brief Builds the RFC 5424 message and stores it in the queue
+
+              \param preset with structured data already encoded
+              \param st with the structured data of the call, '-' when there is none
+              \param body with the already formatted message
+              \param site with the call site that generated the message
+              \param sampleRate with N when the message was kept one in N times
+              \param encodeStart with the time the encoding started, epoch if the latency is not tracked
+            */
+            template<typename SD>
+            void push_message(int priority,
+                              const std::string &app,
+                              const std::string &msgid,
+                              boost::string_view preset,
+                              const SD &st,
+                              boost::string_view body,
+                              const char *site,
+                              uint32_t sampleRate,
+                              std::chrono::steady_clock::time_point encodeStart) {
+                auto _message = encode_message(priority, app, msgid, preset, st, body, site, sampleRate, encodeStart);
+                _message->set_crash_id(umi::log::crash_handler::store(_message->get_data()));
+                m_counters.add(logger_counter::Enqueued);
+                enqueue(std::move(_message));
+            }
+
             /**
-             * Internal message queue
-             * */
-            std::queue<std::shared_ptr<std::string>> m_messageQueue;
-        };
+              \brief Builds the RFC 5424 message, see push_message
 
-        /**
-          \brief Class to represent a socket connection
-          against the rsyslog server.
+              The message is written straight in the string that will be queued.
+            */
+            template<typename SD>
+            std::shared_ptr<umi::log::log_message> encode_message(int priority,
+                                                                  const std::string &app,
+                                                                  const std::string &msgid,
+                                                                  boost::string_view preset,
+                                                                  const SD &st,
+                                                                  boost::string_view body,
+                                                                  const char *site,
+                                                                  uint32_t sampleRate,
+                                                                  std::chrono::steady_clock::time_point encodeStart) {
+                std::string _data;
+                _data.reserve(96 + m_loggerLocalData.get_hostname().size() + app.size() + msgid.size() +
+                              umi::log::scoped_context::get_data().size() + preset.size() + body.size());
+                _data += '<';
+                append_number(_data, static_cast<uint64_t>(priority));
+                _data += '>';
+                append_number(_data, m_loggerLocalData.get_version());
+                _data += ' ';
+                const std::size_t _stampBegin = _data.size();
+                _data += umi::log::Timestamp::get_timestamp(m_loggerLocalData.get_precision());
+                const std::size_t _stampEnd = _data.size();
+                _data += ' ';
+                _data += m_loggerLocalData.get_hostname();
+                _data += ' ';
+                _data += app;
+                _data += ' ';
+                append_number(_data, static_cast<uint64_t>(getpid()));
+                _data += ' ';
+                _data += msgid;
+                _data += ' ';
+                const std::size_t _headerSize = _data.size();
+                // Elements of the thread context and of the child logger are already encoded
+                const boost::string_view _context = umi::log::scoped_context::get_data();
+                _data.append(_context.data(), _context.size());
+                _data.append(preset.data(), preset.size());
+                write_structured_data(_data, st);
+                if (sampleRate > 1) {
+                    write_sample_rate(_data, sampleRate);
+                }
+                if (_data.size() == _headerSize) {
+                    _data += '-';
+                }
+                _data += ' ';
+                const std::size_t _bodyBegin = _data.size();
+                // MSG-UTF8 has to start with the BOM, anything else is sent as MSG-ANY
+                if (m_loggerLocalData.get_utf8_bom() &&
+                    umi::log::classify_utf8(body.data(), body.size()) == umi::log::utf8_kind::Utf8) {
+                    _data += "\xEF\xBB\xBF";
+                }
+                _data.append(body.data(), body.size());
+                if (m_loggerLocalData.get_print()) {
+                    std::cout << _data << '\n';
+                }
+                const uint64_t _msgidHash =
+                        m_loggerLocalData.get_group_balance() == umi::log::group_balance::Hash_Msgid ?
+                        umi::log::hash_bytes(msgid.data(), msgid.size()) : 0;
+                // The elements are store as shared pointer to avoid problems with the async logging
+                auto _message = std::make_shared<umi::log::log_message>(
+                        std::move(_data), priority, _stampBegin, _stampEnd, _headerSize, _bodyBegin, site,
+                        _msgidHash);
+                if (encodeStart != std::chrono::steady_clock::time_point()) {
+                    const auto _now = std::chrono::steady_clock::now();
+                    _message->set_enqueued(_now, _now - encodeStart);
+                }
+                return _message;
+            }
 
-          As we know udp connections differs from tcp and
-          we can't use ssl with them
-        */
-        class socket {
-            friend class socket_factory;
+            /**
+              \brief Stores the message in the queue of the pipeline of the calling thread
+            */
+            void enqueue(std::shared_ptr<umi::log::log_message> &&message);
 
-        public:
             /**
-              \brief Clean the connection
+              \brief Sends the counters of the last interval, called with the telemetry mutex
+
+              The line goes through the pipelines like any other message, so it
+              is counted in the next interval.
             */
-            virtual ~socket() { }
+            void send_telemetry();
 
             /**
-              \brief Sends the data
+              \brief Sends the summaries of the calls suppressed by the rate limiter and forgets
+              its idle keys, called with the sweep mutex
             */
-            virtual void send(std::shared_ptr<std::string> message) = 0;
+            void sweep_rate_limiter();
 
-        protected:
             /**
-              \brief Gets the internal boost asio
+              \brief Appends the decimal representation of a number
             */
-            boost::asio::io_service &get_internal_service() {
-                return m_logger.m_ioservice;
+            static void append_number(std::string &out, uint64_t value) {
+                std::array<char, 20> _digits;
+                std::size_t _position = _digits.size();
+                do {
+                    _digits[--_position] = static_cast<char>('0' + value % 10);
+                    value /= 10;
+                } while (value != 0);
+                out.append(_digits.data() + _position, _digits.size() - _position);
             }
 
             /**
-              \brief Constructor with the default connection
-              information data
+              \brief Writes the sampling element when the message was sampled
             */
-            socket(umi::log::logger &logger, const umi::log::connection &loggerInfo)
-                    : m_logger(logger),
-                      m_loggerInfo(loggerInfo) {
+            static void write_sample_rate(std::string &out, uint32_t sampleRate) {
+                out += '[';
+                out += umi::log::umilog_sd_id;
+                out += " sample_rate=\"";
+                append_number(out, sampleRate);
+                out += "\"]";
             }
 
             /**
-             * Logger to use for the dispatcher information
-             * */
-            umi::log::logger &m_logger; //!< Logger to get the dispatcher
+              \brief Writes the structured data of a message without user elements
+            */
+            static void write_structured_data(std::string &, char) { }
+
             /**
-             * Information to use in the connection
-             * */
-            const umi::log::connection &m_loggerInfo;
-        };
+              \brief Writes the user structured data of a message
+            */
+            static void write_structured_data(std::string &out, const umi::log::structured_data &st) {
+                st.append_to(out);
+            }
 
-        class socket_udp : public socket {
-        public:
-            socket_udp(umi::log::logger &logger,
-                       const umi::log::connection &loggerInfo)
-                    : socket(logger, loggerInfo),
-                      m_socket(std::make_unique<boost::asio::ip::udp::socket>(get_internal_service())) {
-                m_socket->open(boost::asio::ip::udp::v4());
-                boost::asio::ip::udp::resolver _resolver(get_internal_service());
-                boost::asio::ip::udp::resolver::query _query(
-                        boost::asio::ip::udp::v4(),
-                        m_loggerInfo.get_host().c_str(),
-                        boost::lexical_cast<std::string>(m_loggerInfo.get_port()));
-                m_endpoint = std::make_unique<boost::asio::ip::udp::endpoint>(*_resolver.resolve(_query));
-                m_isOpen = true;
-            }
-
-            virtual ~socket_udp() {
-                if (m_socket) {
-                    m_socket->close();
-                }
-            }
-
-            void send(std::shared_ptr<std::string> message) {
-                if (m_isOpen && m_socket) {
-                    m_socket->async_send_to(
-                            boost::asio::buffer(*message),
-                            *m_endpoint,
-                            std::bind(&umi::log::socket_udp::handler_send, this,
-                                      message,
-                                      0,
-                                      std::placeholders::_1,
-                                      std::placeholders::_2));
-                }
-            }
-
-            void handler_send(std::shared_ptr<std::string> message,
-                              std::size_t actual_position,
-                              const boost::system::error_code &error,
-                              std::size_t dataSent) {
-                if (!error) {
-                    if (m_isOpen && m_socket && (actual_position + dataSent) < message->size()) {
-                        m_socket->async_send_to(
-                                boost::asio::buffer((*message).substr(actual_position + dataSent)),
-                                *m_endpoint,
-                                std::bind(&umi::log::socket_udp::handler_send, this,
-                                          message, //!< Thanks to this and the shared_ptr the message will not die
-                                          (actual_position + dataSent),
-                                          std::placeholders::_1,
-                                          std::placeholders::_2));
-                    }
-                }
+            /**
+              \brief Copies the structured data already serialized by the builder
+            */
+            static void write_structured_data(std::string &out, const umi::log::sd_builder &st) {
+                out.append(st.get_data().data(), st.get_data().size());
             }
 
         protected:
             /**
-             * Flag to describe if the socket is open or not
+             * Local logger data
              * */
-            bool m_isOpen = false;
+            umi::log::logger_local_data m_loggerLocalData;
             /**
-             * Socket used
+             * Local connection information
              * */
-            std::unique_ptr<boost::asio::ip::udp::socket> m_socket;
+            std::vector<umi::log::connection> m_loggerConnection;
             /**
-             * Endpoint where we connect
+             * Token buckets, null when the rate limit is disabled
              * */
-            std::unique_ptr<boost::asio::ip::udp::endpoint> m_endpoint;
-        };
-
-        class socket_tcp : public socket {
-        public:
-            socket_tcp(umi::log::logger &logger,
-                       const umi::log::connection &loggerInfo)
-                    : socket(logger, loggerInfo),
-                      m_socket(std::make_unique<boost::asio::ip::tcp::socket>(get_internal_service())) {
-                if (m_socket) {
-                    boost::asio::socket_base::keep_alive _keepAlive(true);
-                    m_socket->set_option(_keepAlive);
-                    boost::asio::ip::tcp::resolver _resolver(get_internal_service());
-                    boost::asio::ip::tcp::resolver::query _query(
-                            m_loggerInfo.get_host().c_str(),
-                            boost::lexical_cast<std::string>(
-                                    m_loggerInfo.get_port()));
-                    boost::asio::ip::tcp::resolver::iterator _endpoint(_resolver.resolve(_query));
-                    boost::asio::ip::tcp::endpoint endPoint = *_endpoint;
-                    m_socket->async_connect(
-                            endPoint,
-                            std::bind(&umi::log::socket_tcp::handle_on_connect, this,
-                                      std::placeholders::_1,
-                                      ++_endpoint));
-                }
-            }
-
-            virtual ~socket_tcp() {
-                if (m_socket) {
-                    m_socket->close(); // this is not async
-                }
-            }
-
-            void send(std::shared_ptr<std::string> message) {
-                if (m_isOpen && m_socket) {
-                    m_socket->async_send(
-                            boost::asio::buffer(*message),
-                            std::bind(&umi::log::socket_tcp::handler_send, this,
-                                      message, //!< Thanks to this and the shared_ptr the message will not die
-                                      0,
-                                      std::placeholders::_1,
-                                      std::placeholders::_2));
-                }
-            }
-
-            void handle_on_connect(const boost::system::error_code &errorCode,
-                                   boost::asio::ip::tcp::resolver::iterator endpointIT) {
-                if (m_socket) {
-                    if (!errorCode) {
-                        m_isOpen = true;
-                    } else if (endpointIT != boost::asio::ip::tcp::resolver::iterator()) {
-                        // try next
-                        m_socket->close();
-                        boost::asio::ip::tcp::endpoint endPoint = *endpointIT;
-                        m_socket->async_connect(
-                                endPoint,
-                                std::bind(&umi::log::socket_tcp::handle_on_connect, this,
-                                          std::placeholders::_1,
-                                          ++endpointIT));
-                    }
-                }
-            }
-
-            void handler_send(std::shared_ptr<std::string> message,
-                              std::size_t last_position,
-                              const boost::system::error_code &errorCode,
-                              std::size_t dataSent) {
-                if (!errorCode) {
-                    if (m_socket && m_isOpen && (last_position + dataSent) < message->size()) {
-                        m_socket->async_send(
-                                boost::asio::buffer((*message).substr(last_position + dataSent)),
-                                std::bind(&umi::log::socket_tcp::handler_send, this,
-                                          message,
-                                          last_position + dataSent,
-                                          std::placeholders::_1,
-                                          std::placeholders::_2));
-                    }
-                }
-            }
-
-        protected:
+            std::unique_ptr<umi::log::rate_limiter> m_rateLimiter;
+            /**
+             * Sampling decisions, null when the sampling is disabled
+             * */
+            std::unique_ptr<umi::log::sampler> m_sampler;
+            /**
+             * Counters of the log calls
+             * */
+            enum class logger_counter : std::size_t {
+                Filtered,
+                Sampled_Out,
+                Rate_Limited,
+                Format_Errors,
+                Enqueued,
+                Count
+            };
             /**
-             * Flag to mark when the socket is opened
+             * Outcome of the log calls by thread
              * */
-            bool m_isOpen = false;
+            umi::log::sharded_counters<logger_counter> m_counters;
             /**
-             * The tcp socket
+             * Pipelines and telemetry timer
              * */
-            std::unique_ptr<boost::asio::ip::tcp::socket> m_socket;
+            std::unique_ptr<umi::log::logger_impl> m_impl;
         };
 
-        class socket_tls : public socket {
+        /**
+          \brief Logger bound to an app, a msgid and some structured data
+
+          The structured data is encoded once when the child is created and
+          copied as it is in every message, which avoids serializing the same
+          elements on each call. Children can be nested, the elements of the
+          parent come first.
+        */
+        class child_logger {
         public:
-            socket_tls(umi::log::logger &logger,
-                       const umi::log::connection &loggerInfo)
-                    : socket(logger, loggerInfo),
-                      m_sslContext(std::make_unique<boost::asio::ssl::context>(
-                              get_internal_service(),
-                              boost::asio::ssl::context::sslv23)),
-                      m_socket() {
-                if (m_sslContext) {
-                    m_sslContext->set_verify_mode(boost::asio::ssl::context::verify_peer);
-                    m_sslContext->set_options(boost::asio::ssl::context::default_workarounds |
-                                              boost::asio::ssl::context::no_sslv2 |
-                                              boost::asio::ssl::context::no_sslv3 |
-                                              boost::asio::ssl::context::single_dh_use);
-                    if (!loggerInfo.get_TLS_CA_file().empty()) {
-                        m_sslContext->load_verify_file(loggerInfo.get_TLS_CA_file());
-                    }
-                    m_socket = std::make_unique<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>
-                            (get_internal_service(),
-                             *m_sslContext);
-                    if (m_socket) {
-                        boost::asio::socket_base::keep_alive _keepAlive(true);
-                        m_socket->lowest_layer().set_option(_keepAlive);
-                        boost::asio::ip::tcp::resolver _resolver(get_internal_service());
-                        boost::asio::ip::tcp::resolver::query _query(m_loggerInfo.get_host().c_str(),
-                                                                     boost::lexical_cast<std::string>(
-                                                                             m_loggerInfo.get_port()));
-                        boost::asio::ip::tcp::resolver::iterator _endpoint(_resolver.resolve(_query));
-                        boost::asio::ip::tcp::endpoint endPoint = *_endpoint;
-                        m_socket->lowest_layer().async_connect(endPoint,
-                                                               std::bind(&umi::log::socket_tls::handle_on_connect,
-                                                                         this,
-                                                                         std::placeholders::_1,
-                                                                         ++_endpoint));
-                    }
-                }
-            }
+            /**
+              \brief Creates a child of the logger
 
-            virtual ~socket_tls() {
-                if (m_socket) {
-                    m_socket->lowest_layer().close(); // this is not async
-                }
-            }
-
-            void send(std::shared_ptr<std::string> message) {
-                if (m_isOpen && m_socket) {
-                    boost::asio::async_write(
-                            *m_socket,
-                            boost::asio::buffer(*message),
-                            std::bind(&umi::log::socket_tls::handler_send, this,
-                                      message, //!< Thanks to this and the shared_ptr the message will not die
-                                      0,
-                                      std::placeholders::_1,
-                                      std::placeholders::_2));
-                }
-            }
-
-            void handle_on_connect(const boost::system::error_code &errorCode,
-                                   boost::asio::ip::tcp::resolver::iterator endpointIT) {
-                if (m_socket) {
-                    if (!errorCode) {
-                        m_socket->async_handshake(boost::asio::ssl::stream_base::client,
-                                                  std::bind(&umi::log::socket_tls::handle_on_handshake,
-                                                            this,
-                                                            std::placeholders::_1));
-                    } else if (endpointIT != boost::asio::ip::tcp::resolver::iterator()) {
-                        // try next
-                        m_socket->lowest_layer().close();
-                        boost::asio::ip::tcp::endpoint endPoint = *endpointIT;
-                        m_socket->lowest_layer().async_connect(
-                                endPoint,
-                                std::bind(&umi::log::socket_tls::handle_on_connect,
-                                          this,
-                                          std::placeholders::_1,
-                                          ++endpointIT));
-                    }
-                }
-            }
+              \param parent with the logger used to send the messages, it must outlive the child
+              \param app with the APP-NAME of the messages
+              \param msgid with the MSGID of the messages
+              \param sd with the elements added to every message
+            */
+            child_logger(umi::log::logger &parent,
+                         const std::string &app,
+                         const std::string &msgid,
+                         const umi::log::sd_builder &sd)
+                    : m_parent(parent),
+                      m_app(app),
+                      m_msgid(msgid),
+                      m_encoded(sd.get_data().data(), sd.get_data().size()) { }
 
-            void handle_on_handshake(const boost::system::error_code &error) {
-                if (!error) {
-                    m_isOpen = true;
-                }
+            /**
+              \brief Creates a child of another child adding more elements
+            */
+            child_logger(const child_logger &parent, const umi::log::sd_builder &sd)
+                    : m_parent(parent.m_parent),
+                      m_app(parent.m_app),
+                      m_msgid(parent.m_msgid),
+                      m_encoded(parent.m_encoded) {
+                m_encoded.append(sd.get_data().data(), sd.get_data().size());
             }
 
-            void handler_send(std::shared_ptr<std::string> message,
-                              std::size_t last_position,
-                              const boost::system::error_code &errorCode,
-                              std::size_t dataSent) {
-                if (!errorCode) {
-                    if (m_socket && m_isOpen && (last_position + dataSent) < message->size()) {
-                        boost::asio::async_write(
-                                *m_socket,
-                                boost::asio::buffer((*message).substr(last_position + dataSent)),
-                                std::bind(&umi::log::socket_tls::handler_send, this,
-                                          message, //!< Thanks to this and the shared_ptr the message will not die
-                                          last_position + dataSent,
-                                          std::placeholders::_1,
-                                          std::placeholders::_2));
-                    }
-                }
+            /**
+              \brief Gets the APP-NAME of the messages
+            */
+            const std::string &get_app() const {
+                return m_app;
             }
 
-        protected:
             /**
-             * Flag to mark the socket is open
-             * */
-            bool m_isOpen = false;
+              \brief Gets the MSGID of the messages
+            */
+            const std::string &get_msgid() const {
+                return m_msgid;
+            }
+
             /**
-             * SSL context used in the connection
-             * */
-            std::unique_ptr<boost::asio::ssl::context> m_sslContext;
+              \brief Gets the encoded structured data added to every message
+            */
+            const std::string &get_encoded_data() const {
+                return m_encoded;
+            }
+
             /**
-             * Socket used in the connection
-             * */
-            std::unique_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>> m_socket;
-        };
+             \brief Log a message into the system.
+            */
+            template<typename... Args>
+            void log(umi::log::facility facility,
+                     umi::log::severity severity,
+                     const char *message, Args &&... args) {
+                m_parent.format_message(facility, severity, m_app, m_msgid, m_encoded, '-',
+                                        message, std::forward<Args>(args)...);
+            }
 
-        /**
-          \brief Factory to create sockets depending on the logger
-          configuration
-        */
-        class socket_factory {
-        public:
             /**
-              \brief Creates a socket with the desired configuration
+             \brief Log a message into the system adding structured data to the bound one.
             */
-            static socket *create_socket(umi::log::logger &logger,
-                                         const umi::log::connection &loggerInfo) {
-                if (loggerInfo.get_connection_type() == umi::log::connection::connection_type::UDP) {
-                    return new umi::log::socket_udp(logger, loggerInfo);
-                } else if (loggerInfo.get_connection_type() == umi::log::connection::connection_type::TCP) {
-                    return new umi::log::socket_tcp(logger, loggerInfo);
-                } else if (loggerInfo.get_connection_type() == umi::log::connection::connection_type::TLS) {
-                    return new umi::log::socket_tls(logger, loggerInfo);
-                }
-                return 0;
+            template<typename... Args>
+            void log(umi::log::facility facility,
+                     umi::log::severity severity,
+                     const umi::log::sd_builder &st,
+                     const char *message, Args &&... args) {
+                m_parent.format_message(facility, severity, m_app, m_msgid, m_encoded, st,
+                                        message, std::forward<Args>(args)...);
             }
 
+        protected:
+            umi::log::logger &m_parent; //!< Logger that sends the messages
+            std::string m_app; //!< APP-NAME of the messages
+            std::string m_msgid; //!< MSGID of the messages
+            std::string m_encoded; //!< Structured data added to every message
         };
-    }
-}
-
-/**
-  \brief Creates a logger instance
-*/
-umi::log::logger::logger(const umi::log::logger_local_data &loggerData,
-                         const std::vector<umi::log::connection> &loggerConnection)
-        : m_loggerLocalData(loggerData),
-          m_loggerConnection(loggerConnection),
-          m_run(true),
-          m_ioservice(),
-          m_worker(m_ioservice),
-          m_loggerThread([&]() { m_ioservice.run(); }) {
-    // Create connections depending on the connection data this constructor
-    // implies only one connection
-    for (auto &i: m_loggerConnection) {
-        m_connections.push_back(std::unique_ptr<umi::log::socket>(umi::log::socket_factory::create_socket(*this, i)));
-    }
-}
 
-/**
- * \brief Process the messages
- * */
-void umi::log::logger::process_messages() {
-    std::queue<std::shared_ptr<std::string>> _localQueue;
-    {
-        std::unique_lock<std::mutex> _lock(m_queueMutex);
-        std::swap(m_messageQueue, _localQueue);
-    }
-    while (!_localQueue.empty() && m_run) {
-        std::shared_ptr<std::string> _elementToSend = _localQueue.front();
-        _localQueue.pop();
-        // Process element
-        for (auto &singleSocket : m_connections) {
-            singleSocket->send(_elementToSend);
-        }
     }
 }
 
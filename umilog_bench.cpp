@@ -0,0 +1,530 @@
+#include "umilog.hpp"
+#include "relp_server.hpp"
+#include "tls_server.hpp"
+#include <benchmark/benchmark.h>
+
+/**
+ * Inputs used by the encoding kernels
+ * */
+static std::string make_input(std::size_t size, const std::string &pattern) {
+    std::string _value;
+    _value.reserve(size);
+    while (_value.size() < size) {
+        _value += pattern;
+    }
+    _value.resize(size);
+    return _value;
+}
+
+static std::string plain_input(std::size_t size) {
+    return make_input(size, "user=jose action=login result=ok ");
+}
+
+// Every other character has to be escaped
+static std::string escape_adversarial_input(std::size_t size) {
+    return make_input(size, "a\"b]c\\");
+}
+
+static std::string utf8_input(std::size_t size) {
+    return make_input(size, "espa\xC3\xB1" "a \xE2\x82\xAC caf\xC3\xA9 ");
+}
+
+// Cyrillic and CJK text, almost every byte belongs to a multibyte character
+static std::string multibyte_input(std::size_t size) {
+    return make_input(size, "\xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82 "
+                            "\xE6\x97\xA5\xE5\xBF\x97\xE8\xAE\xB0\xE5\xBD\x95 ");
+}
+
+// Valid multibyte characters only, nothing is skipped as ASCII
+static std::string utf8_adversarial_input(std::size_t size) {
+    return make_input(size, "\xF0\x9F\x98\x80");
+}
+
+static void escape_scan(benchmark::State &state,
+                        const char *(*find)(const char *, const char *),
+                        const std::string &input) {
+    for (auto _ : state) {
+        const char *_begin = input.data();
+        const char *_end = input.data() + input.size();
+        std::size_t _found = 0;
+        while (_begin != _end) {
+            _begin = find(_begin, _end);
+            if (_begin != _end) {
+                ++_found;
+                ++_begin;
+            }
+        }
+        benchmark::DoNotOptimize(_found);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+static void escape_copy(benchmark::State &state,
+                        char *(*escape)(char *, const char *, const char *),
+                        const std::string &input) {
+    std::string _output(input.size() * 2, '\0');
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(escape(&_output[0], input.data(), input.data() + input.size()));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+static void utf8_scan(benchmark::State &state,
+                      umi::log::utf8_kind (*classify)(const char *, std::size_t),
+                      const std::string &input) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(classify(input.data(), input.size()));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+BENCHMARK_CAPTURE(escape_scan, scalar_short, umi::log::find_escape_scalar, plain_input(24));
+BENCHMARK_CAPTURE(escape_scan, simd_short, umi::log::find_escape, plain_input(24));
+BENCHMARK_CAPTURE(escape_scan, scalar_long, umi::log::find_escape_scalar, plain_input(4096));
+BENCHMARK_CAPTURE(escape_scan, simd_long, umi::log::find_escape, plain_input(4096));
+BENCHMARK_CAPTURE(escape_scan, scalar_adversarial, umi::log::find_escape_scalar, escape_adversarial_input(4096));
+BENCHMARK_CAPTURE(escape_scan, simd_adversarial, umi::log::find_escape, escape_adversarial_input(4096));
+
+BENCHMARK_CAPTURE(escape_copy, scalar_short, umi::log::escape_to_scalar, plain_input(24));
+BENCHMARK_CAPTURE(escape_copy, simd_short, umi::log::escape_to, plain_input(24));
+BENCHMARK_CAPTURE(escape_copy, scalar_long, umi::log::escape_to_scalar, plain_input(4096));
+BENCHMARK_CAPTURE(escape_copy, simd_long, umi::log::escape_to, plain_input(4096));
+BENCHMARK_CAPTURE(escape_copy, scalar_adversarial, umi::log::escape_to_scalar, escape_adversarial_input(4096));
+BENCHMARK_CAPTURE(escape_copy, simd_adversarial, umi::log::escape_to, escape_adversarial_input(4096));
+
+BENCHMARK_CAPTURE(utf8_scan, scalar_short, umi::log::classify_utf8_scalar, plain_input(24));
+BENCHMARK_CAPTURE(utf8_scan, simd_short, umi::log::classify_utf8, plain_input(24));
+BENCHMARK_CAPTURE(utf8_scan, scalar_long_ascii, umi::log::classify_utf8_scalar, plain_input(4096));
+BENCHMARK_CAPTURE(utf8_scan, simd_long_ascii, umi::log::classify_utf8, plain_input(4096));
+BENCHMARK_CAPTURE(utf8_scan, scalar_long_utf8, umi::log::classify_utf8_scalar, utf8_input(4096));
+BENCHMARK_CAPTURE(utf8_scan, simd_long_utf8, umi::log::classify_utf8, utf8_input(4096));
+BENCHMARK_CAPTURE(utf8_scan, scalar_long_multibyte, umi::log::classify_utf8_scalar, multibyte_input(4096));
+BENCHMARK_CAPTURE(utf8_scan, simd_long_multibyte, umi::log::classify_utf8, multibyte_input(4096));
+BENCHMARK_CAPTURE(utf8_scan, scalar_adversarial, umi::log::classify_utf8_scalar, utf8_adversarial_input(4096));
+BENCHMARK_CAPTURE(utf8_scan, simd_adversarial, umi::log::classify_utf8, utf8_adversarial_input(4096));
+
+static void sd_builder_escape(benchmark::State &state) {
+    const std::string _value = plain_input(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        umi::log::sd_builder _sd;
+        _sd.add_element("request@32473").add_param("value", _value);
+        benchmark::DoNotOptimize(_sd.get_data().data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * _value.size()));
+}
+
+BENCHMARK(sd_builder_escape)->Arg(16)->Arg(256)->Arg(4096);
+
+static void sd_element_escape(benchmark::State &state, const std::string &input) {
+    const umi::log::structured_data::sd_element _element("request@32473");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(_element.escape(input).data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+BENCHMARK_CAPTURE(sd_element_escape, short, plain_input(16));
+BENCHMARK_CAPTURE(sd_element_escape, long, plain_input(4096));
+BENCHMARK_CAPTURE(sd_element_escape, adversarial, escape_adversarial_input(4096));
+
+/**
+ * Serialization of a structured data with the usual shape, the argument is the number of elements
+ * */
+static void sd_serialize(benchmark::State &state) {
+    umi::log::structured_data _sd;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        umi::log::structured_data::sd_element _element("request@32473");
+        _element.add_param("id", "42");
+        _element.add_param("path", "/api/v1/users");
+        _element.add_param("status", "200");
+        _sd.add_element(std::move(_element));
+    }
+    std::string _out;
+    for (auto _ : state) {
+        _out.clear();
+        _sd.append_to(_out);
+        benchmark::DoNotOptimize(_out.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * _out.size()));
+}
+
+BENCHMARK(sd_serialize)->Arg(1)->Arg(4);
+
+/**
+ * TIMESTAMP of the header, the argument is the precision
+ * */
+static void timestamp(benchmark::State &state) {
+    const uint32_t _precision = static_cast<uint32_t>(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(umi::log::Timestamp::get_timestamp(_precision).data());
+    }
+}
+
+BENCHMARK(timestamp)->DenseRange(0, 6);
+
+/**
+ * Logger without collectors, the pipeline discards what it dequeues
+ * */
+static umi::log::logger_local_data null_sink_data() {
+    return umi::log::logger_local_data("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                       umi::log::severity::Debug);
+}
+
+/**
+ * Gives access to the encoding of the logger without queueing the messages
+ * */
+class encoding_logger : public umi::log::logger {
+public:
+    encoding_logger() : umi::log::logger(null_sink_data(), std::vector<umi::log::connection>()) { }
+
+    template<typename SD>
+    std::shared_ptr<umi::log::log_message> encode(const SD &st, boost::string_view body) {
+        return encode_message(get_priority(umi::log::facility::Local_Use_0, umi::log::severity::Error),
+                              m_app, m_msgid, boost::string_view(), st, body, "site", 1,
+                              std::chrono::steady_clock::time_point());
+    }
+
+private:
+    const std::string m_app{"Bench"};
+    const std::string m_msgid{"HDR"};
+};
+
+/**
+ * HEADER and framing of one message with the body already formatted
+ * */
+static void header_encoding(benchmark::State &state) {
+    encoding_logger _log;
+    const std::string _body = plain_input(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(_log.encode('-', _body).get());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(header_encoding)->Arg(32)->Arg(512);
+
+static void header_encoding_sd(benchmark::State &state) {
+    encoding_logger _log;
+    umi::log::sd_builder _sd;
+    _sd.add_element("request@32473").add_param("id", "42").add_param("path", "/api/v1/users");
+    const std::string _body = plain_input(32);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(_log.encode(_sd, _body).get());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(header_encoding_sd);
+
+/**
+ * Whole log() calls, format, encoding and queue, against the null sink
+ * */
+static void log_null_sink(benchmark::State &state) {
+    umi::log::logger _log(null_sink_data(), std::vector<umi::log::connection>());
+    int _sequence = 0;
+    for (auto _ : state) {
+        _log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Bench", "NULL",
+                 "user=%s seq=%d", "jose", _sequence++);
+    }
+    state.SetItemsProcessed(state.iterations());
+    _log.flush(std::chrono::seconds(5));
+}
+
+BENCHMARK(log_null_sink);
+
+static void log_null_sink_sd(benchmark::State &state) {
+    umi::log::logger _log(null_sink_data(), std::vector<umi::log::connection>());
+    int _sequence = 0;
+    for (auto _ : state) {
+        umi::log::sd_builder _sd;
+        _sd.add_element("request@32473").add_param("id", "42");
+        _log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Bench", "NULL", _sd,
+                 "user=%s seq=%d", "jose", _sequence++);
+    }
+    state.SetItemsProcessed(state.iterations());
+    _log.flush(std::chrono::seconds(5));
+}
+
+BENCHMARK(log_null_sink_sd);
+
+static void log_filtered(benchmark::State &state) {
+    umi::log::logger_local_data _loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                            umi::log::severity::Error);
+    umi::log::logger _log(_loggerData, std::vector<umi::log::connection>());
+    for (auto _ : state) {
+        _log.log(umi::log::facility::Local_Use_0, umi::log::severity::Debug, "Bench", "NULL", "seq=%d", 1);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(log_filtered);
+
+/**
+ * Queue handoff from 1 to N producers to the null sink, the argument is the number of pipelines
+ * */
+static std::unique_ptr<umi::log::logger> handoff_logger;
+
+static void handoff(benchmark::State &state) {
+    if (state.thread_index() == 0) {
+        umi::log::logger_local_data _loggerData = null_sink_data();
+        _loggerData.set_pipelines(static_cast<uint32_t>(state.range(0)));
+        handoff_logger = std::make_unique<umi::log::logger>(_loggerData, std::vector<umi::log::connection>());
+    }
+    int _sequence = 0;
+    for (auto _ : state) {
+        handoff_logger->log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Bench", "HANDOFF",
+                            "producer=%d seq=%d", state.thread_index(), _sequence++);
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        handoff_logger->flush(std::chrono::seconds(5));
+        handoff_logger.reset();
+    }
+}
+
+BENCHMARK(handoff)->Arg(1)->Arg(4)->ThreadRange(1, 16)->UseRealTime();
+
+/**
+ * Producers logging through one logger, the argument is the number of pipelines
+ * */
+static std::unique_ptr<umi::log::logger> shared_logger;
+static std::unique_ptr<boost::asio::io_service> sink_service;
+static std::unique_ptr<boost::asio::ip::udp::socket> sink_socket;
+
+static void producers(benchmark::State &state) {
+    if (state.thread_index() == 0) {
+        // The datagrams are never read, the kernel drops them once the buffer is full
+        sink_service = std::make_unique<boost::asio::io_service>();
+        sink_socket = std::make_unique<boost::asio::ip::udp::socket>(
+                *sink_service, boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        umi::log::logger_local_data _loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                                umi::log::severity::Debug);
+        _loggerData.set_pipelines(static_cast<uint32_t>(state.range(0)));
+        std::vector<umi::log::connection> _loggerConnection;
+        _loggerConnection.emplace_back(umi::log::connection::connection_type::UDP, "127.0.0.1",
+                                       sink_socket->local_endpoint().port(), std::string());
+        shared_logger = std::make_unique<umi::log::logger>(_loggerData, _loggerConnection);
+    }
+    int _sequence = 0;
+    for (auto _ : state) {
+        shared_logger->log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Bench", "PROD",
+                           "producer=%d seq=%d", state.thread_index(), _sequence++);
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        shared_logger.reset();
+        sink_socket.reset();
+        sink_service.reset();
+    }
+}
+
+BENCHMARK(producers)->Arg(1)->Arg(8)->ThreadRange(1, 64)->Iterations(5000)->UseRealTime();
+
+/**
+ * RELP throughput against the local stand-in, the argument is the window
+ * */
+static void relp_window(benchmark::State &state) {
+    relp_server _server;
+    umi::log::logger_local_data _loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                            umi::log::severity::Debug);
+    std::vector<umi::log::connection> _loggerConnection;
+    _loggerConnection.emplace_back(umi::log::connection::connection_type::RELP, "127.0.0.1", _server.port(),
+                                   std::string());
+    _loggerConnection.back().set_relp_window(static_cast<uint32_t>(state.range(0)));
+    umi::log::logger _log(_loggerData, _loggerConnection);
+    const std::size_t _batch = 1000;
+    std::size_t _sent = 0;
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < _batch; ++i) {
+            _log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Bench", "RELP", "seq=%zu", i);
+        }
+        _sent += _batch;
+        // Every message of the batch must reach the collector before the next one
+        while (_server.count() < _sent) {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(_sent));
+}
+
+BENCHMARK(relp_window)->Arg(1)->Arg(8)->Arg(64)->Arg(512)->UseRealTime();
+
+/**
+ * TLS connection latency, a new logger does a full handshake with the shared context
+ * */
+static void tls_handshake_full(benchmark::State &state) {
+    tls_server _server;
+    umi::log::logger_local_data _loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                            umi::log::severity::Debug);
+    std::vector<umi::log::connection> _loggerConnection;
+    _loggerConnection.emplace_back(umi::log::connection::connection_type::TLS, "localhost", _server.port(),
+                                   _server.ca_file());
+    for (auto _ : state) {
+        const std::size_t _handshakes = _server.handshakes();
+        umi::log::logger _log(_loggerData, _loggerConnection);
+        _log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Bench", "TLS", "hello");
+        while (_server.handshakes() == _handshakes) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+BENCHMARK(tls_handshake_full)->UseRealTime();
+
+/**
+ * TLS reconnection latency, the collector drops every connection and the logger resumes its session
+ * */
+static void tls_handshake_resumed(benchmark::State &state) {
+    tls_server _server(std::numeric_limits<std::size_t>::max());
+    umi::log::logger_local_data _loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                            umi::log::severity::Debug);
+    std::vector<umi::log::connection> _loggerConnection;
+    _loggerConnection.emplace_back(umi::log::connection::connection_type::TLS, "localhost", _server.port(),
+                                   _server.ca_file());
+    _loggerConnection.back().set_reconnect_interval(std::chrono::milliseconds(0));
+    umi::log::logger _log(_loggerData, _loggerConnection);
+    for (auto _ : state) {
+        const std::size_t _handshakes = _server.handshakes();
+        while (_server.handshakes() == _handshakes) {
+            _log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Bench", "TLS", "hello");
+            std::this_thread::yield();
+        }
+    }
+    state.counters["resumed"] = static_cast<double>(_server.resumed()) / std::max<std::size_t>(1, _server.handshakes());
+}
+
+BENCHMARK(tls_handshake_resumed)->UseRealTime();
+
+/**
+ * TLS bytes per second, the pending messages are packed in records of up to 16 KB
+ * */
+static void tls_throughput(benchmark::State &state) {
+    tls_server _server;
+    umi::log::logger_local_data _loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                            umi::log::severity::Debug);
+    std::vector<umi::log::connection> _loggerConnection;
+    _loggerConnection.emplace_back(umi::log::connection::connection_type::TLS, "localhost", _server.port(),
+                                   _server.ca_file());
+    umi::log::logger _log(_loggerData, _loggerConnection);
+    const std::string _body = plain_input(static_cast<std::size_t>(state.range(0)));
+    while (_server.handshakes() == 0) {
+        std::this_thread::yield();
+    }
+    const std::size_t _start = _server.bytes();
+    const std::size_t _batch = 1000;
+    for (auto _ : state) {
+        const std::size_t _target = _server.bytes() + _batch * _body.size();
+        for (std::size_t i = 0; i < _batch; ++i) {
+            _log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Bench", "TLS", "%s", _body.c_str());
+        }
+        while (_server.bytes() < _target) {
+            std::this_thread::yield();
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(_server.bytes() - _start));
+}
+
+BENCHMARK(tls_throughput)->Arg(64)->Arg(512)->UseRealTime();
+
+/**
+ * Latency of every stage over UDP, the argument is the burst logged before each flush
+ * */
+static void stage_latency(benchmark::State &state) {
+    boost::asio::io_service _sinkService;
+    boost::asio::ip::udp::socket _sink(_sinkService,
+                                       boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    umi::log::logger_local_data _loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                            umi::log::severity::Debug);
+    _loggerData.set_latency_tracking(true);
+    std::vector<umi::log::connection> _loggerConnection;
+    _loggerConnection.emplace_back(umi::log::connection::connection_type::UDP, "127.0.0.1",
+                                   _sink.local_endpoint().port(), std::string());
+    umi::log::logger _log(_loggerData, _loggerConnection);
+    const int64_t _burst = state.range(0);
+    for (auto _ : state) {
+        for (int64_t i = 0; i < _burst; ++i) {
+            _log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Bench", "LAT", "seq=%d",
+                     static_cast<int>(i));
+        }
+        _log.flush(std::chrono::seconds(5));
+    }
+    state.SetItemsProcessed(state.iterations() * _burst);
+    const umi::log::logger_metrics _metrics = _log.get_metrics();
+    const umi::log::connection_metrics &_connection = _metrics.m_connections.at(0);
+    state.counters["encode_p50_ns"] = static_cast<double>(_metrics.m_encodeLatency.get_percentile(50).count());
+    state.counters["queue_p99_ns"] = static_cast<double>(_metrics.m_queueLatency.get_percentile(99).count());
+    state.counters["pending_p99_ns"] = static_cast<double>(_connection.m_pendingLatency.get_percentile(99).count());
+    state.counters["write_p50_ns"] = static_cast<double>(_connection.m_writeLatency.get_percentile(50).count());
+    state.counters["total_p50_ns"] = static_cast<double>(_connection.m_totalLatency.get_percentile(50).count());
+    state.counters["total_p99_ns"] = static_cast<double>(_connection.m_totalLatency.get_percentile(99).count());
+}
+
+BENCHMARK(stage_latency)->Arg(1)->Arg(64)->Arg(1024)->UseRealTime();
+
+/**
+ * TLS throughput and latency by batch policy, the arguments are the batch bytes, the batch
+ * messages and the linger in microseconds
+ * */
+static void tls_batching(benchmark::State &state) {
+    tls_server _server;
+    umi::log::logger_local_data _loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                            umi::log::severity::Debug);
+    _loggerData.set_latency_tracking(true);
+    std::vector<umi::log::connection> _loggerConnection;
+    _loggerConnection.emplace_back(umi::log::connection::connection_type::TLS, "localhost", _server.port(),
+                                   _server.ca_file());
+    _loggerConnection.back().set_batch_bytes(static_cast<std::size_t>(state.range(0)));
+    _loggerConnection.back().set_batch_messages(static_cast<uint32_t>(state.range(1)));
+    _loggerConnection.back().set_batch_linger(std::chrono::microseconds(state.range(2)));
+    umi::log::logger _log(_loggerData, _loggerConnection);
+    _log.flush(std::chrono::seconds(5));
+    const std::string _body = plain_input(128);
+    const std::size_t _burst = 1000;
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < _burst; ++i) {
+            _log.log(umi::log::facility::Local_Use_0, umi::log::severity::Error, "Bench", "BATCH", "%s",
+                     _body.c_str());
+        }
+        _log.flush(std::chrono::seconds(5));
+    }
+    const umi::log::connection_metrics _metrics = _log.get_metrics().m_connections.at(0);
+    state.SetItemsProcessed(static_cast<int64_t>(_metrics.m_written));
+    state.SetBytesProcessed(static_cast<int64_t>(_metrics.m_writtenBytes));
+    state.counters["per_write"] = static_cast<double>(_metrics.m_written) / std::max<uint64_t>(1, _metrics.m_batches);
+    state.counters["p50_us"] = static_cast<double>(_metrics.m_totalLatency.get_percentile(50).count()) / 1000.0;
+    state.counters["p99_us"] = static_cast<double>(_metrics.m_totalLatency.get_percentile(99).count()) / 1000.0;
+}
+
+BENCHMARK(tls_batching)
+        ->Args({16384, 1, 0})
+        ->Args({16384, 1024, 0})
+        ->Args({16384, 1024, 100})
+        ->Args({65536, 1024, 0})
+        ->Args({65536, 1024, 500})
+        ->UseRealTime();
+
+/**
+ * Records the build of the library in the context of the results, so runs of
+ * different releases compared from their JSON output are known to match
+ * */
+int main(int argc, char **argv) {
+#if defined(__AVX2__)
+    benchmark::AddCustomContext("umilog_simd", "avx2");
+#elif defined(__SSE2__)
+    benchmark::AddCustomContext("umilog_simd", "sse2");
+#else
+    benchmark::AddCustomContext("umilog_simd", "scalar");
+#endif
+#ifdef NDEBUG
+    benchmark::AddCustomContext("umilog_build", "release");
+#else
+    benchmark::AddCustomContext("umilog_build", "debug");
+#endif
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
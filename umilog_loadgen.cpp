@@ -0,0 +1,548 @@
+#include "umilog.hpp"
+#include "relp_server.hpp"
+#include "tls_server.hpp"
+#include <boost/asio.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+/**
+ * Load generator: producer threads log through one logger to a collector
+ * started on localhost, then the achieved throughput, the drops and the
+ * latency of the log calls are reported.
+ *
+ * umilog_loadgen --transport=tcp --threads=8 --rate=200000 --arrival=poisson --duration=10
+ * */
+
+/**
+ * Settings of the run, from the command line
+ * */
+struct loadgen_options {
+    std::string m_transport = "udp"; //!< udp, tcp, tls or relp
+    uint32_t m_threads = 4; //!< Producer threads
+    double m_rate = 0; //!< Messages per second of all the producers, 0 to log as fast as possible
+    std::string m_arrival = "fixed"; //!< fixed or poisson spacing of the messages when there is a rate
+    double m_duration = 5; //!< Seconds logging
+    std::size_t m_minSize = 64; //!< Smallest body
+    std::size_t m_maxSize = 256; //!< Largest body
+    double m_sdShare = 0.5; //!< Share of the messages with structured data
+    std::string m_severities = "error:1,warning:2,informational:7"; //!< Weight of every severity
+    uint32_t m_pipelines = 1; //!< Pipelines of the logger
+    double m_drain = 10; //!< Seconds waiting for the connections to write what is queued
+    uint64_t m_seed = 1; //!< Seed of the generators, each producer adds its index
+    std::string m_format = "text"; //!< text or json
+};
+
+/**
+ * UDP collector counting the datagrams
+ * */
+class udp_counter {
+public:
+    udp_counter()
+            : m_socket(m_ioservice, boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {
+        m_socket.set_option(boost::asio::socket_base::receive_buffer_size(8 * 1024 * 1024));
+        receive();
+        m_thread = std::thread([this]() { m_ioservice.run(); });
+    }
+
+    ~udp_counter() {
+        m_ioservice.stop();
+        m_thread.join();
+    }
+
+    int port() const {
+        return m_socket.local_endpoint().port();
+    }
+
+    std::size_t messages() const {
+        return m_messages;
+    }
+
+    std::size_t bytes() const {
+        return m_bytes;
+    }
+
+private:
+    void receive() {
+        m_socket.async_receive(boost::asio::buffer(m_buffer),
+                               [this](const boost::system::error_code &error, std::size_t size) {
+                                   if (!error) {
+                                       ++m_messages;
+                                       m_bytes += size;
+                                   }
+                                   receive();
+                               });
+    }
+
+    boost::asio::io_service m_ioservice;
+    boost::asio::ip::udp::socket m_socket;
+    std::array<char, 1024 * 64> m_buffer;
+    std::atomic<std::size_t> m_messages{0};
+    std::atomic<std::size_t> m_bytes{0};
+    std::thread m_thread;
+};
+
+/**
+ * Counts the messages of a TCP or TLS stream by their octet counting frames,
+ * "MSG-LEN SP SYSLOG-MSG", a message is counted when all its bytes arrived
+ * */
+class frame_counter {
+public:
+    void add(const char *data, std::size_t size) {
+        std::size_t i = 0;
+        while (i < size) {
+            if (m_remaining > 0) {
+                const std::size_t _taken = std::min(m_remaining, size - i);
+                m_remaining -= _taken;
+                i += _taken;
+                if (m_remaining == 0) {
+                    ++m_messages;
+                }
+            } else if (data[i] == ' ') {
+                m_remaining = m_length;
+                m_length = 0;
+                ++i;
+                if (m_remaining == 0) {
+                    ++m_messages;
+                }
+            } else {
+                m_length = m_length * 10 + static_cast<std::size_t>(data[i] - '0');
+                ++i;
+            }
+        }
+    }
+
+    std::size_t messages() const {
+        return m_messages;
+    }
+
+private:
+    std::size_t m_length = 0; //!< Length of the next frame, while its digits are read
+    std::size_t m_remaining = 0; //!< Bytes of the current frame not read yet
+    std::size_t m_messages = 0;
+};
+
+/**
+ * TCP collector counting the bytes and the messages of every connection
+ * */
+class tcp_counter {
+public:
+    tcp_counter()
+            : m_acceptor(m_ioservice, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {
+        accept();
+        m_thread = std::thread([this]() { m_ioservice.run(); });
+    }
+
+    ~tcp_counter() {
+        m_ioservice.stop();
+        m_thread.join();
+    }
+
+    int port() const {
+        return m_acceptor.local_endpoint().port();
+    }
+
+    std::size_t bytes() const {
+        return m_bytes;
+    }
+
+    std::size_t messages() const {
+        return m_messages;
+    }
+
+private:
+    struct connection {
+        explicit connection(boost::asio::io_service &service) : m_socket(service) { }
+
+        boost::asio::ip::tcp::socket m_socket;
+        std::array<char, 1024 * 64> m_buffer;
+        frame_counter m_counter;
+    };
+
+    void accept() {
+        auto _connection = std::make_shared<connection>(m_ioservice);
+        m_acceptor.async_accept(_connection->m_socket, [this, _connection](const boost::system::error_code &error) {
+            if (!error) {
+                read(_connection);
+            }
+            accept();
+        });
+    }
+
+    void read(std::shared_ptr<connection> c) {
+        c->m_socket.async_read_some(boost::asio::buffer(c->m_buffer),
+                                    [this, c](const boost::system::error_code &error, std::size_t size) {
+                                        if (!error) {
+                                            const std::size_t _before = c->m_counter.messages();
+                                            c->m_counter.add(c->m_buffer.data(), size);
+                                            m_messages += c->m_counter.messages() - _before;
+                                            m_bytes += size;
+                                            read(c);
+                                        }
+                                    });
+    }
+
+    boost::asio::io_service m_ioservice;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    std::atomic<std::size_t> m_bytes{0};
+    std::atomic<std::size_t> m_messages{0};
+    std::thread m_thread;
+};
+
+/**
+ * Collector of the transport chosen, only one of them is started
+ * */
+struct loadgen_sink {
+    std::unique_ptr<udp_counter> m_udp;
+    std::unique_ptr<tcp_counter> m_tcp;
+    std::unique_ptr<tls_server> m_tls;
+    std::unique_ptr<relp_server> m_relp;
+
+    /**
+     * Messages received, the streams are split by the length of the messages
+     * */
+    std::size_t messages() const {
+        if (m_udp) {
+            return m_udp->messages();
+        }
+        if (m_tcp) {
+            return m_tcp->messages();
+        }
+        if (m_tls) {
+            std::size_t _messages = 0;
+            for (const auto &i: m_tls->streams()) {
+                frame_counter _counter;
+                _counter.add(i.data(), i.size());
+                _messages += _counter.messages();
+            }
+            return _messages;
+        }
+        return m_relp ? m_relp->count() : 0;
+    }
+
+    /**
+     * Bytes received, framing included
+     * */
+    std::size_t bytes() const {
+        if (m_udp) {
+            return m_udp->bytes();
+        }
+        if (m_tcp) {
+            return m_tcp->bytes();
+        }
+        return m_tls ? m_tls->bytes() : 0;
+    }
+};
+
+/**
+ * What one producer did
+ * */
+struct producer_result {
+    uint64_t m_sent = 0; //!< log calls
+    uint64_t m_bytes = 0; //!< Bytes of the bodies
+    umi::log::latency_snapshot m_call; //!< Time inside log()
+    umi::log::latency_snapshot m_response; //!< From the time the message was due, wake-up delay included
+};
+
+static void print_usage() {
+    std::fprintf(stderr,
+                 "usage: umilog_loadgen [--name=value]...\n"
+                 "  --transport=udp|tcp|tls|relp   collector started on localhost (udp)\n"
+                 "  --threads=N                    producer threads (4)\n"
+                 "  --rate=R                       messages per second of all the producers, 0 for\n"
+                 "                                 as fast as possible (0)\n"
+                 "  --arrival=fixed|poisson        spacing of the messages at a rate (fixed)\n"
+                 "  --duration=S                   seconds logging (5)\n"
+                 "  --size=MIN:MAX                 bytes of the bodies, uniform (64:256)\n"
+                 "  --sd=P                         share of the messages with structured data (0.5)\n"
+                 "  --severities=NAME:W,...        weight of every severity, emergency, alert, critical,\n"
+                 "                                 error, warning, notice, informational or debug\n"
+                 "                                 (error:1,warning:2,informational:7)\n"
+                 "  --pipelines=N                  pipelines of the logger (1)\n"
+                 "  --drain=S                      seconds to write what is queued at the end and\n"
+                 "                                 for the collector to receive it (10)\n"
+                 "  --seed=N                       seed of the generators (1)\n"
+                 "  --format=text|json             report format (text)\n");
+}
+
+/**
+ * Reads the options, false if one is unknown or malformed
+ * */
+static bool parse_options(int argc, char **argv, loadgen_options &options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string _argument(argv[i]);
+        const std::size_t _equal = _argument.find('=');
+        if (_argument.compare(0, 2, "--") != 0 || _equal == std::string::npos) {
+            return false;
+        }
+        const std::string _name(_argument, 2, _equal - 2);
+        const std::string _value(_argument, _equal + 1);
+        try {
+            if (_name == "transport") {
+                options.m_transport = _value;
+            } else if (_name == "threads") {
+                options.m_threads = static_cast<uint32_t>(std::stoul(_value));
+            } else if (_name == "rate") {
+                options.m_rate = std::stod(_value);
+            } else if (_name == "arrival") {
+                options.m_arrival = _value;
+            } else if (_name == "duration") {
+                options.m_duration = std::stod(_value);
+            } else if (_name == "size") {
+                const std::size_t _colon = _value.find(':');
+                options.m_minSize = std::stoul(_value.substr(0, _colon));
+                options.m_maxSize = _colon == std::string::npos ? options.m_minSize :
+                                    std::stoul(_value.substr(_colon + 1));
+            } else if (_name == "sd") {
+                options.m_sdShare = std::stod(_value);
+            } else if (_name == "severities") {
+                options.m_severities = _value;
+            } else if (_name == "pipelines") {
+                options.m_pipelines = static_cast<uint32_t>(std::stoul(_value));
+            } else if (_name == "drain") {
+                options.m_drain = std::stod(_value);
+            } else if (_name == "seed") {
+                options.m_seed = std::stoull(_value);
+            } else if (_name == "format") {
+                options.m_format = _value;
+            } else {
+                return false;
+            }
+        } catch (const std::exception &) {
+            return false;
+        }
+    }
+    return (options.m_transport == "udp" || options.m_transport == "tcp" || options.m_transport == "tls" ||
+            options.m_transport == "relp") &&
+           (options.m_arrival == "fixed" || options.m_arrival == "poisson") &&
+           (options.m_format == "text" || options.m_format == "json") &&
+           options.m_threads > 0 && options.m_rate >= 0 && options.m_duration > 0 &&
+           options.m_minSize <= options.m_maxSize && options.m_sdShare >= 0 && options.m_sdShare <= 1;
+}
+
+/**
+ * Reads "name:weight,..." in the severities and their weights, false if it is malformed
+ * */
+static bool parse_severities(const std::string &value,
+                             std::vector<umi::log::severity> &severities,
+                             std::vector<double> &weights) {
+    std::size_t _begin = 0;
+    while (_begin < value.size()) {
+        std::size_t _end = value.find(',', _begin);
+        if (_end == std::string::npos) {
+            _end = value.size();
+        }
+        const std::string _item(value, _begin, _end - _begin);
+        const std::size_t _colon = _item.find(':');
+        if (_colon == std::string::npos) {
+            return false;
+        }
+        try {
+            weights.push_back(std::stod(_item.substr(_colon + 1)));
+        } catch (const std::exception &) {
+            return false;
+        }
+        umi::log::severity _severity;
+        if (!umi::log::parse_severity(_item.substr(0, _colon), _severity)) {
+            return false;
+        }
+        severities.push_back(_severity);
+        _begin = _end + 1;
+    }
+    return !severities.empty();
+}
+
+/**
+ * Logs until the deadline at the rate of the producer
+ * */
+static void produce(umi::log::logger &log,
+                    const loadgen_options &options,
+                    const std::vector<umi::log::severity> &severities,
+                    const std::vector<double> &weights,
+                    const std::string &text,
+                    uint32_t index,
+                    std::chrono::steady_clock::time_point start,
+                    std::chrono::steady_clock::time_point deadline,
+                    producer_result &result) {
+    std::mt19937_64 _random(options.m_seed + index);
+    std::uniform_int_distribution<std::size_t> _size(options.m_minSize, options.m_maxSize);
+    std::bernoulli_distribution _withSd(options.m_sdShare);
+    std::discrete_distribution<std::size_t> _severity(weights.begin(), weights.end());
+    // Every producer has its share of the rate
+    const double _interval = options.m_rate > 0 ? 1e9 * options.m_threads / options.m_rate : 0;
+    std::exponential_distribution<double> _gap(_interval > 0 ? 1 / _interval : 1);
+    double _due = 0;
+    uint64_t _sequence = 0;
+    while (true) {
+        std::chrono::steady_clock::time_point _dueTime = std::chrono::steady_clock::now();
+        if (_interval > 0) {
+            _due += options.m_arrival == "poisson" ? _gap(_random) : _interval;
+            _dueTime = start + std::chrono::nanoseconds(static_cast<int64_t>(_due));
+            if (_dueTime >= deadline) {
+                break;
+            }
+            // Late messages are not skipped, their wait counts in the response time
+            std::this_thread::sleep_until(_dueTime);
+        } else if (_dueTime >= deadline) {
+            break;
+        }
+        const std::size_t _bodySize = _size(_random);
+        const umi::log::severity _level = severities[_severity(_random)];
+        const auto _callStart = std::chrono::steady_clock::now();
+        if (_withSd(_random)) {
+            umi::log::sd_builder _sd;
+            _sd.add_element("load@32473")
+                    .add_param("producer", std::to_string(index))
+                    .add_param("seq", std::to_string(_sequence));
+            log.log(umi::log::facility::Local_Use_0, _level, "loadgen", "LOAD", _sd, "%.*s",
+                    static_cast<int>(_bodySize), text.data());
+        } else {
+            log.log(umi::log::facility::Local_Use_0, _level, "loadgen", "LOAD", "%.*s",
+                    static_cast<int>(_bodySize), text.data());
+        }
+        const auto _callEnd = std::chrono::steady_clock::now();
+        result.m_call.add(umi::log::latency_snapshot::get_bucket(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(_callEnd - _callStart).count())), 1);
+        result.m_response.add(umi::log::latency_snapshot::get_bucket(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(_callEnd - _dueTime).count())), 1);
+        ++result.m_sent;
+        result.m_bytes += _bodySize;
+        ++_sequence;
+    }
+}
+
+static double to_us(std::chrono::nanoseconds value) {
+    return static_cast<double>(value.count()) / 1000.0;
+}
+
+int main(int argc, char **argv) {
+    loadgen_options _options;
+    std::vector<umi::log::severity> _severities;
+    std::vector<double> _weights;
+    if (!parse_options(argc, argv, _options) || !parse_severities(_options.m_severities, _severities, _weights)) {
+        print_usage();
+        return 2;
+    }
+    loadgen_sink _sink;
+    std::vector<umi::log::connection> _loggerConnection;
+    if (_options.m_transport == "udp") {
+        _sink.m_udp = std::make_unique<udp_counter>();
+        _loggerConnection.emplace_back(umi::log::connection::connection_type::UDP, "127.0.0.1",
+                                       _sink.m_udp->port(), std::string());
+    } else if (_options.m_transport == "tcp") {
+        _sink.m_tcp = std::make_unique<tcp_counter>();
+        _loggerConnection.emplace_back(umi::log::connection::connection_type::TCP, "127.0.0.1",
+                                       _sink.m_tcp->port(), std::string());
+    } else if (_options.m_transport == "tls") {
+        _sink.m_tls = std::make_unique<tls_server>();
+        _loggerConnection.emplace_back(umi::log::connection::connection_type::TLS, "localhost",
+                                       _sink.m_tls->port(), _sink.m_tls->ca_file());
+    } else {
+        _sink.m_relp = std::make_unique<relp_server>();
+        _loggerConnection.emplace_back(umi::log::connection::connection_type::RELP, "127.0.0.1",
+                                       _sink.m_relp->port(), std::string());
+    }
+    umi::log::logger_local_data _loggerData("localhost", 1, false, umi::log::facility::Local_Use_0,
+                                            umi::log::severity::Debug);
+    _loggerData.set_pipelines(_options.m_pipelines);
+    umi::log::logger _log(_loggerData, _loggerConnection);
+    // The body of every message is a prefix of this text
+    std::string _text;
+    while (_text.size() < _options.m_maxSize) {
+        _text += "user=jose action=login result=ok ";
+    }
+
+    std::vector<producer_result> _results(_options.m_threads);
+    std::vector<std::thread> _producers;
+    const auto _start = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+    const auto _deadline = _start + std::chrono::nanoseconds(static_cast<int64_t>(_options.m_duration * 1e9));
+    for (uint32_t i = 0; i < _options.m_threads; ++i) {
+        _producers.emplace_back([&, i]() {
+            std::this_thread::sleep_until(_start);
+            produce(_log, _options, _severities, _weights, _text, i, _start, _deadline, _results[i]);
+        });
+    }
+    for (auto &i: _producers) {
+        i.join();
+    }
+    const auto _stopped = std::chrono::steady_clock::now();
+    const bool _drained = _log.flush(std::chrono::milliseconds(static_cast<int64_t>(_options.m_drain * 1000)));
+    const auto _flushed = std::chrono::steady_clock::now();
+    const umi::log::logger_metrics _metrics = _log.get_metrics();
+    const umi::log::connection_metrics &_connection = _metrics.m_connections.at(0);
+    // The collector may still be reading what was written, RELP only counts the messages
+    const auto _received = [&_sink, &_connection]() {
+        return _sink.m_relp ? _sink.messages() >= _connection.m_written :
+               _sink.bytes() >= _connection.m_writtenBytes;
+    };
+    const auto _receiveDeadline = _flushed + std::chrono::milliseconds(static_cast<int64_t>(_options.m_drain * 1000));
+    while (!_received() && std::chrono::steady_clock::now() < _receiveDeadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    producer_result _total;
+    for (auto &i: _results) {
+        _total.m_sent += i.m_sent;
+        _total.m_bytes += i.m_bytes;
+        _total.m_call.merge(i.m_call);
+        _total.m_response.merge(i.m_response);
+    }
+    const double _seconds = std::chrono::duration<double>(_stopped - _start).count();
+    const double _drainSeconds = std::chrono::duration<double>(_flushed - _stopped).count();
+    const double _throughput = static_cast<double>(_total.m_sent) / _seconds;
+    const double _deliveredRate = static_cast<double>(_connection.m_written) /
+                                  std::chrono::duration<double>(_flushed - _start).count();
+    const umi::log::latency_snapshot *_latencies[] = {&_total.m_call, &_total.m_response};
+    const char *_latencyNames[] = {"call", "response"};
+    const double _percentiles[] = {50, 90, 99, 99.9};
+
+    if (_options.m_format == "json") {
+        std::printf("{\n  \"transport\": \"%s\", \"threads\": %u, \"rate\": %.0f, \"arrival\": \"%s\",\n"
+                    "  \"duration_s\": %.3f, \"sent\": %llu, \"body_bytes\": %llu, \"throughput\": %.1f,\n"
+                    "  \"delivered_rate\": %.1f, \"drained\": %s, \"drain_s\": %.3f,\n"
+                    "  \"enqueued\": %llu, \"written\": %llu, \"written_bytes\": %llu, \"dropped\": %llu,\n"
+                    "  \"truncated\": %llu, \"errors\": %llu, \"sink_messages\": %zu, \"sink_bytes\": %zu",
+                    _options.m_transport.c_str(), _options.m_threads, _options.m_rate, _options.m_arrival.c_str(),
+                    _seconds, static_cast<unsigned long long>(_total.m_sent),
+                    static_cast<unsigned long long>(_total.m_bytes), _throughput, _deliveredRate,
+                    _drained ? "true" : "false", _drainSeconds,
+                    static_cast<unsigned long long>(_metrics.m_enqueued),
+                    static_cast<unsigned long long>(_connection.m_written),
+                    static_cast<unsigned long long>(_connection.m_writtenBytes),
+                    static_cast<unsigned long long>(_connection.m_dropped),
+                    static_cast<unsigned long long>(_connection.m_truncated),
+                    static_cast<unsigned long long>(_connection.m_errors), _sink.messages(), _sink.bytes());
+        for (std::size_t i = 0; i < 2; ++i) {
+            std::printf(",\n  \"%s_us\": {", _latencyNames[i]);
+            for (double j: _percentiles) {
+                std::printf("\"p%g\": %.2f, ", j, to_us(_latencies[i]->get_percentile(j)));
+            }
+            std::printf("\"max\": %.2f}", to_us(_latencies[i]->get_max()));
+        }
+        std::printf("\n}\n");
+    } else {
+        std::printf("transport %s, %u threads, rate %.0f/s (%s), %.3f s\n", _options.m_transport.c_str(),
+                    _options.m_threads, _options.m_rate, _options.m_rate > 0 ? _options.m_arrival.c_str() : "max",
+                    _seconds);
+        std::printf("sent       %llu messages, %.1f msg/s, %.2f MB/s of bodies\n",
+                    static_cast<unsigned long long>(_total.m_sent), _throughput,
+                    static_cast<double>(_total.m_bytes) / _seconds / 1e6);
+        std::printf("delivered  %llu messages, %llu bytes, %.1f msg/s, drain %.3f s%s\n",
+                    static_cast<unsigned long long>(_connection.m_written),
+                    static_cast<unsigned long long>(_connection.m_writtenBytes), _deliveredRate, _drainSeconds,
+                    _drained ? "" : " (timed out)");
+        std::printf("dropped    %llu, truncated %llu, errors %llu\n",
+                    static_cast<unsigned long long>(_connection.m_dropped),
+                    static_cast<unsigned long long>(_connection.m_truncated),
+                    static_cast<unsigned long long>(_connection.m_errors));
+        std::printf("collector  %zu messages, %zu bytes\n", _sink.messages(), _sink.bytes());
+        for (std::size_t i = 0; i < 2; ++i) {
+            std::printf("%-10s", _latencyNames[i]);
+            for (double j: _percentiles) {
+                std::printf(" p%g %.2f us", j, to_us(_latencies[i]->get_percentile(j)));
+            }
+            std::printf(" max %.2f us\n", to_us(_latencies[i]->get_max()));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,2405 @@
+/*Copyright (c) 2015, José Gerardo Palma Durán, raistmaj@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. All advertising materials mentioning features or use of this software
+   must display the following acknowledgement:
+   This product includes software developed by the University of
+   California, Berkeley and its contributors.
+4. Neither the name of the University nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ''AS IS'' AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
+/**
+ * Connections, io threads and queues behind umi::log::logger. This header is
+ * internal to the library, the applications only include umilog.hpp.
+ * */
+#ifndef UMILOG_TRANSPORT_HPP
+#define UMILOG_TRANSPORT_HPP
+
+#include "umilog.hpp"
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/lexical_cast.hpp>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <queue>
+#include <tuple>
+
+namespace umi {
+    namespace log {
+        /**
+          \brief Client TLS contexts shared by the connections with the same CA
+
+          Building a context loads the CA file, every connection used to do it.
+          The contexts prefer TLS 1.3, accept 1.2 as the minimum, and let the
+          connections keep their sessions to resume them when they reconnect.
+        */
+        class tls_context {
+        public:
+            /**
+              \brief Gets the context for a CA file, it is created if no connection uses it
+            */
+            static std::shared_ptr<boost::asio::ssl::context> get(const std::string &caFile) {
+                static std::mutex _contextsMutex;
+                static std::map<std::string, std::weak_ptr<boost::asio::ssl::context>> _contexts;
+                std::unique_lock<std::mutex> _lock(_contextsMutex);
+                std::weak_ptr<boost::asio::ssl::context> &_shared = _contexts[caFile];
+                std::shared_ptr<boost::asio::ssl::context> _context = _shared.lock();
+                if (!_context) {
+                    _context = create(caFile);
+                    _shared = _context;
+                }
+                return _context;
+            }
+
+        protected:
+            static std::shared_ptr<boost::asio::ssl::context> create(const std::string &caFile);
+        };
+
+        /**
+          \brief Session of a TLS connection kept to resume it in the next handshake
+        */
+        class tls_session {
+        public:
+            tls_session() = default;
+
+            tls_session(const tls_session &) = delete;
+
+            tls_session &operator=(const tls_session &) = delete;
+
+            ~tls_session() {
+                if (m_session) {
+                    SSL_SESSION_free(m_session);
+                }
+            }
+
+            /**
+              \brief Prepares a new connection, it resumes the last session if there is one
+
+              \param ssl of the connection before its handshake
+              \param host used as server name if it is not an address
+            */
+            void attach(SSL *ssl, const std::string &host) {
+                SSL_set_ex_data(ssl, get_index(), this);
+                boost::system::error_code _notAddress;
+                boost::asio::ip::make_address(host, _notAddress);
+                if (_notAddress) {
+                    SSL_set_tlsext_host_name(ssl, host.c_str());
+                }
+                if (m_session) {
+                    SSL_set_session(ssl, m_session);
+                }
+            }
+
+            /**
+              \brief Checks if the connection has resumed the session
+            */
+            static bool is_resumed(SSL *ssl) {
+                return SSL_session_reused(ssl) == 1;
+            }
+
+            /**
+              \brief Callback of the contexts, called with every session or ticket received
+            */
+            static int store(SSL *ssl, SSL_SESSION *session) {
+                umi::log::tls_session *_owner = static_cast<umi::log::tls_session *>(SSL_get_ex_data(ssl, get_index()));
+                if (!_owner) {
+                    return 0;
+                }
+                if (_owner->m_session) {
+                    SSL_SESSION_free(_owner->m_session);
+                }
+                // A copy, closing the connection without a shutdown marks its own session as not resumable
+                _owner->m_session = SSL_SESSION_dup(session);
+                return 0;
+            }
+
+        protected:
+            /**
+              \brief Gets the index where the connections keep their session owner
+            */
+            static int get_index() {
+                static const int _index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+                return _index;
+            }
+
+            SSL_SESSION *m_session = nullptr; //!< Last session of the connection
+        };
+
+        /**
+          \brief Creates a client context
+        */
+        inline std::shared_ptr<boost::asio::ssl::context> tls_context::create(const std::string &caFile) {
+            auto _context = std::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::tls_client);
+            _context->set_verify_mode(boost::asio::ssl::context::verify_peer);
+            _context->set_options(boost::asio::ssl::context::default_workarounds |
+                                  boost::asio::ssl::context::no_sslv2 |
+                                  boost::asio::ssl::context::no_sslv3 |
+                                  boost::asio::ssl::context::no_tlsv1 |
+                                  boost::asio::ssl::context::no_tlsv1_1 |
+                                  boost::asio::ssl::context::single_dh_use);
+            // The highest version both sides support is negotiated, TLS 1.3 when the collector has it
+            SSL_CTX_set_min_proto_version(_context->native_handle(), TLS1_2_VERSION);
+            SSL_CTX_set_session_cache_mode(_context->native_handle(),
+                                           SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(_context->native_handle(), &umi::log::tls_session::store);
+            if (!caFile.empty()) {
+                _context->load_verify_file(caFile);
+            }
+            return _context;
+        }
+
+        /**
+          \brief Lock-free latency histogram
+
+          Recording is one relaxed atomic increment, it can be read while it is
+          recorded. See latency_snapshot for the buckets.
+        */
+        class latency_histogram {
+        public:
+            /**
+              \brief Records one latency
+            */
+            void record(std::chrono::steady_clock::duration elapsed) {
+                const auto _nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+                const uint64_t _value = _nanoseconds < 0 ? 0 : static_cast<uint64_t>(_nanoseconds);
+                m_counts[umi::log::latency_snapshot::get_bucket(_value)].fetch_add(1, std::memory_order_relaxed);
+            }
+
+            /**
+              \brief Adds the values recorded to a snapshot
+            */
+            void add_to(umi::log::latency_snapshot &snapshot) const {
+                for (std::size_t i = 0; i < m_counts.size(); ++i) {
+                    const uint64_t _count = m_counts[i].load(std::memory_order_relaxed);
+                    if (_count > 0) {
+                        snapshot.add(i, _count);
+                    }
+                }
+            }
+
+        protected:
+            /**
+             * Values by bucket
+             * */
+            std::array<std::atomic<uint64_t>, umi::log::latency_snapshot::bucket_count> m_counts{};
+        };
+
+        /**
+          \brief Completion of a flush, it waits for every pipeline and connection
+
+          Each party adds itself before it releases the one that added it, the
+          future is ready when the last one is released.
+        */
+        class flush_barrier {
+        public:
+            explicit flush_barrier(std::size_t count)
+                    : m_count(count),
+                      m_future(m_done.get_future().share()) {
+            }
+
+            /**
+              \brief Adds parties to wait for
+            */
+            void add(std::size_t count) {
+                m_count += count;
+            }
+
+            /**
+              \brief One party has finished
+            */
+            void release() {
+                if (--m_count == 0) {
+                    m_done.set_value();
+                }
+            }
+
+            /**
+              \brief Gets the future ready when every party has finished
+            */
+            const std::shared_future<void> &get_future() const {
+                return m_future;
+            }
+
+        protected:
+            std::atomic<std::size_t> m_count; //!< Parties not finished yet
+            std::promise<void> m_done; //!< Set by the last party
+            std::shared_future<void> m_future; //!< Future of m_done
+        };
+
+        /**
+          \brief Queue, io service and connections used to send the messages
+
+          A logger owns one pipeline, or several in sharded mode. Each pipeline
+          has its own queue and transport, the producers are spread among them
+          so they don't meet in the same queue. The messages of one pipeline
+          keep their order.
+        */
+        class pipeline {
+        public:
+            /**
+              \brief Creates the connections and starts the io threads
+
+              \param loggerData with the settings of the logger, it must outlive the pipeline
+              \param loggerConnection with the collectors, it must outlive the pipeline
+            */
+            pipeline(const umi::log::logger_local_data &loggerData,
+                     const std::vector<umi::log::connection> &loggerConnection);
+
+            /**
+              \brief Stops the io threads and closes the connections
+            */
+            ~pipeline();
+
+            /**
+              \brief Adds the health of the connections to the logger report
+            */
+            void add_health(std::vector<umi::log::connection_health> &health) const;
+
+            /**
+              \brief Stores one message in the queue
+            */
+            void push(std::shared_ptr<umi::log::log_message> &&message) {
+                {
+                    std::unique_lock<std::mutex> _lock(m_queueMutex);
+                    m_messageQueue.push(std::move(message));
+                    ++m_queueDepth;
+                }
+                m_strand.post([this]() { this->process_messages(); });
+            }
+
+            /**
+              \brief Releases the barrier when the messages pushed before are written by the connections
+
+              The repeats not reported yet are sent first.
+            */
+            void flush(const std::shared_ptr<umi::log::flush_barrier> &barrier);
+
+            /**
+              \brief Gets the messages in the queue not handed to the connections yet
+            */
+            std::size_t get_queue_depth() const {
+                return m_queueDepth;
+            }
+
+            /**
+              \brief Gets the repeats counted instead of sent
+            */
+            uint64_t get_collapsed() const {
+                return m_collapsed;
+            }
+
+            /**
+              \brief Adds the encode and queue latencies to the logger report
+            */
+            void add_latency(umi::log::logger_metrics &metrics) const {
+                m_encodeLatency.add_to(metrics.m_encodeLatency);
+                m_queueLatency.add_to(metrics.m_queueLatency);
+            }
+
+            /**
+              \brief Gets the io service of the transport
+            */
+            boost::asio::io_service &get_io_service();
+
+            /**
+              \brief Gets the connections in the order of the logger connection data
+            */
+            const std::vector<umi::log::socket *> &get_sockets() const {
+                return m_sockets;
+            }
+
+        protected:
+            /**
+              \brief Internal function to process the queue
+            */
+            void process_messages();
+
+            /**
+              \brief Checks if the message repeats the last one sent
+
+              Repeats inside the window are counted instead of sent, the count is
+              reported when a different message arrives or the window expires. A
+              repeat has the same call site and priority, and the same bytes after
+              the timestamp: host, app, pid, msgid, structured data and body. The
+              hash only saves the comparison of different messages.
+
+              \return true if the message has been collapsed
+            */
+            bool collapse_message(const std::shared_ptr<umi::log::log_message> &message) {
+                const auto &_data = message->get_data();
+                const uint64_t _hash = umi::log::hash_bytes(_data.data() + message->get_header_size(),
+                                                            _data.size() - message->get_header_size());
+                const auto _now = std::chrono::steady_clock::now();
+                if (m_lastMessage &&
+                    _hash == m_lastHash &&
+                    message->get_site() == m_lastMessage->get_site() &&
+                    message->get_priority() == m_lastMessage->get_priority() &&
+                    _now - m_lastSent < m_loggerLocalData.get_dedup_window() &&
+                    is_same_content(*message, *m_lastMessage)) {
+                    m_collapsed.fetch_add(1, std::memory_order_relaxed);
+                    umi::log::crash_handler::confirm(message->get_crash_id()); // the repeat count reports it
+                    if (m_repeated++ == 0) {
+                        m_dedupTimer.expires_at(m_lastSent + m_loggerLocalData.get_dedup_window());
+                        std::weak_ptr<bool> _alive = m_alive;
+                        m_dedupTimer.async_wait(m_strand.wrap(
+                                [this, _alive](const boost::system::error_code &error) {
+                                    if (!error && !_alive.expired()) {
+                                        this->flush_repeated();
+                                        m_lastMessage.reset();
+                                    }
+                                }));
+                    }
+                    return true;
+                }
+                flush_repeated();
+                m_lastMessage = message;
+                m_lastHash = _hash;
+                m_lastSent = _now;
+                return false;
+            }
+
+            /**
+              \brief Checks if two messages have the same bytes after the timestamp
+            */
+            static bool is_same_content(const umi::log::log_message &a, const umi::log::log_message &b) {
+                const std::size_t _size = a.get_data().size() - a.get_stamp_end();
+                return _size == b.get_data().size() - b.get_stamp_end() &&
+                       std::memcmp(a.get_data().data() + a.get_stamp_end(),
+                                   b.get_data().data() + b.get_stamp_end(), _size) == 0;
+            }
+
+            /**
+              \brief Sends the "last message repeated N times" line if there are repeats
+            */
+            void flush_repeated() {
+                if (m_repeated == 0 || !m_lastMessage) {
+                    return;
+                }
+                m_dedupTimer.cancel();
+                const auto &_last = m_lastMessage->get_data();
+                std::string _repeatCount = boost::lexical_cast<std::string>(m_repeated);
+                std::string _data(_last, 0, m_lastMessage->get_stamp_begin());
+                _data += umi::log::Timestamp::get_timestamp(m_loggerLocalData.get_precision());
+                const std::size_t _stampEnd = _data.size();
+                _data.append(_last, m_lastMessage->get_stamp_end(),
+                             m_lastMessage->get_header_size() - m_lastMessage->get_stamp_end());
+                const std::size_t _headerSize = _data.size();
+                _data += "[";
+                _data += umi::log::umilog_sd_id;
+                _data += " repeated=\"" + _repeatCount + "\"] ";
+                const std::size_t _bodyBegin = _data.size();
+                _data += "last message repeated " + _repeatCount + " times";
+                m_repeated = 0;
+                auto _message = std::make_shared<umi::log::log_message>(
+                        std::move(_data), m_lastMessage->get_priority(), m_lastMessage->get_stamp_begin(),
+                        _stampEnd, _headerSize, _bodyBegin, m_lastMessage->get_site(),
+                        m_lastMessage->get_msgid_hash());
+                if (m_loggerLocalData.get_latency_tracking()) {
+                    const auto _now = std::chrono::steady_clock::now();
+                    _message->set_enqueued(_now, std::chrono::steady_clock::duration(0));
+                    _message->set_dequeued(_now);
+                }
+                send_message(_message);
+            }
+
+            /**
+              \brief Hands one message to every connection
+            */
+            void send_message(const std::shared_ptr<umi::log::log_message> &message);
+
+            /**
+             * Settings of the logger
+             * */
+            const umi::log::logger_local_data &m_loggerLocalData;
+            /**
+             * Atomic to control de status
+             * */
+            std::atomic_bool m_run;
+            /**
+             * Io threads and connections, private or shared with other loggers
+             * */
+            std::shared_ptr<umi::log::transport> m_transport;
+            /**
+             * Strand where the queue is processed, the sockets have their own
+             * */
+            boost::asio::io_service::strand m_strand;
+            /**
+             * Connections we will use to send data by group, owned by the transport.
+             * Every group gets each message once, a connection without group is a group
+             * */
+            std::vector<std::vector<umi::log::socket *>> m_connections;
+            /**
+             * Next connection of each group for the round robin
+             * */
+            std::vector<std::size_t> m_nextConnection;
+            /**
+             * Connections in the order of the logger connection data
+             * */
+            std::vector<umi::log::socket *> m_sockets;
+            /**
+             * Released when the pipeline stops, late timer handlers check it
+             * */
+            std::shared_ptr<bool> m_alive;
+            /**
+             * Mutex used to protect the message queue
+             * */
+            std::mutex m_queueMutex;
+            /**
+             * Internal message queue
+             * */
+            std::queue<std::shared_ptr<umi::log::log_message>> m_messageQueue;
+            /**
+             * Last message sent, used to collapse repeats
+             * */
+            std::shared_ptr<umi::log::log_message> m_lastMessage;
+            /**
+             * Hash of the body of the last message sent
+             * */
+            uint64_t m_lastHash = 0;
+            /**
+             * When the last message was sent
+             * */
+            std::chrono::steady_clock::time_point m_lastSent;
+            /**
+             * Repeats of the last message not sent yet
+             * */
+            uint64_t m_repeated = 0;
+            /**
+             * Timer to report the repeats when the window expires
+             * */
+            boost::asio::steady_timer m_dedupTimer;
+            /**
+             * Messages pushed and not handed to the connections yet
+             * */
+            std::atomic<std::size_t> m_queueDepth{0};
+            /**
+             * Repeats counted instead of sent
+             * */
+            std::atomic<uint64_t> m_collapsed{0};
+            /**
+             * Time to encode the messages
+             * */
+            umi::log::latency_histogram m_encodeLatency;
+            /**
+             * Time the messages wait in the queue
+             * */
+            umi::log::latency_histogram m_queueLatency;
+        };
+
+        /**
+          \brief Addresses of the collector hosts shared by every connection
+
+          The resolver doesn't give the DNS TTL, the entries live for the TTL
+          of the connection that resolved them. An expired entry is still
+          used while one connection resolves the host again. A resolution
+          that doesn't finish in the refresh timeout, for example because the
+          connection stopped before its handler ran, lets another connection
+          try again.
+        */
+        class endpoint_cache {
+        public:
+            /**
+              \brief Gets the cache of the process
+            */
+            static umi::log::endpoint_cache &get_instance() {
+                static umi::log::endpoint_cache _instance;
+                return _instance;
+            }
+
+            /**
+              \brief Gets the time a connection has to resolve a host before another one can
+            */
+            std::chrono::milliseconds get_refresh_timeout() {
+                std::unique_lock<std::mutex> _lock(m_mutex);
+                return m_refreshTimeout;
+            }
+
+            /**
+              \brief Sets the time a connection has to resolve a host before another one can
+            */
+            void set_refresh_timeout(std::chrono::milliseconds val) {
+                std::unique_lock<std::mutex> _lock(m_mutex);
+                m_refreshTimeout = val;
+            }
+
+            /**
+              \brief Gets the addresses of a host
+
+              \param host to look for
+              \param force to ask for a new resolution even if the entry has not expired
+              \param addresses with the addresses found
+              \param refresh set to true if the caller has to resolve the host again
+              \return false if the host is not in the cache
+            */
+            bool get(const std::string &host,
+                     bool force,
+                     std::vector<boost::asio::ip::address> &addresses,
+                     bool &refresh) {
+                std::unique_lock<std::mutex> _lock(m_mutex);
+                refresh = false;
+                auto _entry = m_entries.find(host);
+                if (_entry == m_entries.end()) {
+                    return false;
+                }
+                addresses = _entry->second.m_addresses;
+                // Only one connection refreshes the entry at the same time
+                const auto _now = std::chrono::steady_clock::now();
+                if (_now >= _entry->second.m_refreshDeadline && (force || _now >= _entry->second.m_expires)) {
+                    _entry->second.m_refreshDeadline = _now + m_refreshTimeout;
+                    refresh = true;
+                }
+                return true;
+            }
+
+            /**
+              \brief Stores the addresses of a host
+            */
+            void put(const std::string &host,
+                     const std::vector<boost::asio::ip::address> &addresses,
+                     std::chrono::seconds ttl) {
+                std::unique_lock<std::mutex> _lock(m_mutex);
+                entry &_entry = m_entries[host];
+                _entry.m_addresses = addresses;
+                _entry.m_expires = std::chrono::steady_clock::now() + ttl;
+                _entry.m_refreshDeadline = std::chrono::steady_clock::time_point();
+            }
+
+            /**
+              \brief The resolution of a host has failed, the old addresses are kept
+            */
+            void refresh_failed(const std::string &host) {
+                std::unique_lock<std::mutex> _lock(m_mutex);
+                auto _entry = m_entries.find(host);
+                if (_entry != m_entries.end()) {
+                    _entry->second.m_refreshDeadline = std::chrono::steady_clock::time_point();
+                }
+            }
+
+        protected:
+            /**
+             * Addresses of one host
+             * */
+            struct entry {
+                std::vector<boost::asio::ip::address> m_addresses; //!< Addresses resolved
+                std::chrono::steady_clock::time_point m_expires; //!< End of the TTL
+                std::chrono::steady_clock::time_point m_refreshDeadline; //!< Until then a connection resolves it
+            };
+
+            /**
+             * Time a connection has to resolve a host
+             * */
+            std::chrono::milliseconds m_refreshTimeout = std::chrono::seconds(30);
+
+            /**
+             * Mutex used to protect the entries
+             * */
+            std::mutex m_mutex;
+            /**
+             * Entries by host
+             * */
+            std::unordered_map<std::string, entry> m_entries;
+        };
+
+        /**
+          \brief Class to represent a socket connection
+          against the rsyslog server.
+
+          As we know udp connections differs from tcp and
+          we can't use ssl with them
+
+          Every socket owns a strand of the logger io service, all the work of
+          the connection runs inside it. This keeps the stream in order while
+          the connections are served in parallel by the io threads. The
+          messages wait in a queue and only one write is in flight per socket,
+          it takes the pending messages up to the batch limits of the
+          connection. Under load a batch not full may linger for more.
+
+          The host is resolved in the background, the messages wait while the
+          connection opens up to the pending limit of the connection. When the
+          connection fails the pending messages are handed to its failover
+          group if it has one, else they are dropped unless the connection
+          retransmits, and it is opened again after the reconnect interval of
+          the connection with the cached addresses, they are refreshed
+          meanwhile. A failover group takes the queued messages of a stalled
+          connection too.
+        */
+        class socket {
+            friend class socket_factory;
+
+        public:
+            /**
+              \brief Clean the connection
+            */
+            virtual ~socket() { }
+
+            /**
+              \brief Sends the data
+            */
+            void send(std::shared_ptr<umi::log::log_message> message) {
+                m_pendingBytes += message->get_data().size();
+                ++m_sent;
+                m_strand.post([this, message]() { this->enqueue(message); });
+            }
+
+            /**
+              \brief Gets the number of messages sent to the connection
+            */
+            uint64_t get_sent() const {
+                return m_sent;
+            }
+
+            /**
+              \brief Calls the handler inside the strand once the first count messages sent are done,
+              written, acked or dropped
+            */
+            void when_done(uint64_t count, std::function<void()> handler) {
+                m_strand.post([this, count, handler]() {
+                    if (m_done >= count) {
+                        handler();
+                    } else {
+                        m_doneWaiters.emplace_back(count, handler);
+                    }
+                });
+            }
+
+            /**
+              \brief Gets the bytes handed to the socket and not written yet
+            */
+            std::size_t get_pending_bytes() const {
+                return m_pendingBytes;
+            }
+
+            /**
+              \brief Gets the health of the connection
+            */
+            umi::log::connection_health get_health() const {
+                umi::log::connection_health _health;
+                _health.m_open = m_isOpen;
+                _health.m_pendingBytes = m_pendingBytes;
+                _health.m_lastSuccess = std::chrono::steady_clock::time_point(
+                        std::chrono::steady_clock::duration(m_lastSuccess.load()));
+                _health.m_errors = m_errors;
+                return _health;
+            }
+
+            /**
+              \brief Gets the counters of the connection
+            */
+            umi::log::connection_metrics get_metrics() const {
+                umi::log::connection_metrics _metrics;
+                _metrics.m_open = m_isOpen;
+                _metrics.m_sent = m_sent;
+                _metrics.m_written = m_written;
+                _metrics.m_writtenBytes = m_writtenBytes;
+                _metrics.m_batches = m_batches;
+                _metrics.m_dropped = m_dropped;
+                _metrics.m_pendingBytes = m_pendingBytes;
+                _metrics.m_pendingLimit = m_loggerInfo.get_pending_limit();
+                _metrics.m_reconnects = m_reconnects;
+                _metrics.m_errors = m_errors;
+                _metrics.m_truncated = m_truncated;
+                m_pendingLatency.add_to(_metrics.m_pendingLatency);
+                m_writeLatency.add_to(_metrics.m_writeLatency);
+                m_totalLatency.add_to(_metrics.m_totalLatency);
+                return _metrics;
+            }
+
+            /**
+              \brief Checks if the connection is open and its write in flight is not older than stall
+            */
+            virtual bool is_healthy(std::chrono::milliseconds stall) const {
+                if (!m_isOpen) {
+                    return false;
+                }
+                const std::chrono::steady_clock::rep _started = m_writeStarted;
+                return _started == 0 ||
+                       std::chrono::steady_clock::now().time_since_epoch() -
+                       std::chrono::steady_clock::duration(_started) < stall;
+            }
+
+            /**
+              \brief Gets the settings of the connection
+            */
+            const umi::log::connection &get_connection() const {
+                return m_loggerInfo;
+            }
+
+            /**
+              \brief Closes the connection for good, the messages not written are dropped
+            */
+            void close() {
+                m_strand.post([this]() {
+                    m_closed = true;
+                    if (m_retransmit) {
+                        requeue_unconfirmed();
+                    }
+                    drop_pending();
+                    m_isOpen = false;
+                    m_writing = false;
+                    m_writeStarted = 0;
+                    m_lingering = false;
+                    m_lingerExpired = false;
+                    m_lingerTimer.cancel();
+                    m_reconnectTimer.cancel();
+                    m_failoverTimer.cancel();
+                    close_connection();
+                });
+            }
+
+            /**
+              \brief Opens again a connection closed with close()
+            */
+            void reopen() {
+                m_strand.post([this]() {
+                    if (m_closed) {
+                        m_closed = false;
+                        m_refreshAddresses = true;
+                        open();
+                    }
+                });
+            }
+
+            /**
+              \brief Closes the session with the collector, handler is called when it is closed or it
+              can't be. Without a closing handshake in the protocol it is called at once.
+            */
+            virtual void close_session(const std::function<void()> &handler) {
+                handler();
+            }
+
+            /**
+              \brief Joins the connection to the failover group of a pipeline
+
+              When the connection fails, or it is not healthy while it has
+              messages, the messages not written are handed to the first healthy
+              connection of the group. A connection shared by several pipelines
+              uses the first group joined.
+
+              \param owner with the pipeline, used to leave the group
+              \param group with the connections of the group in order, this one included
+              \param stall with the time a write can take
+            */
+            void add_failover(const void *owner,
+                              const std::vector<umi::log::socket *> &group,
+                              std::chrono::milliseconds stall) {
+                std::unique_lock<std::mutex> _lock(m_failoverMutex);
+                m_failoverGroups.push_back(failover_group{owner, group, stall});
+            }
+
+            /**
+              \brief Leaves the failover group of a pipeline
+            */
+            void remove_failover(const void *owner) {
+                std::unique_lock<std::mutex> _lock(m_failoverMutex);
+                m_failoverGroups.erase(std::remove_if(m_failoverGroups.begin(), m_failoverGroups.end(),
+                                                      [owner](const failover_group &group) {
+                                                          return group.m_owner == owner;
+                                                      }),
+                                       m_failoverGroups.end());
+            }
+
+        protected:
+            /**
+              \brief Gets the internal boost asio
+            */
+            boost::asio::io_service &get_internal_service() {
+                return m_ioservice;
+            }
+
+            /**
+              \brief Constructor with the default connection
+              information data
+            */
+            socket(boost::asio::io_service &ioservice, const umi::log::connection &loggerInfo)
+                    : m_ioservice(ioservice),
+                      m_loggerInfo(loggerInfo),
+                      m_strand(ioservice),
+                      m_reconnectTimer(ioservice),
+                      m_lingerTimer(ioservice),
+                      m_failoverTimer(ioservice) {
+            }
+
+            /**
+              \brief Opens the connection, it must set m_isOpen when ready or call
+              handle_error. Called inside the strand, or by the constructor.
+            */
+            virtual void open() = 0;
+
+            /**
+              \brief Closes the socket, the handlers of the operations in progress must not open it
+              again. Called inside the strand.
+            */
+            virtual void close_connection() = 0;
+
+            /**
+              \brief Starts the write of the first m_inFlight pending messages, it must end calling
+              handle_write inside the strand. Called inside the strand.
+            */
+            virtual void write_messages() = 0;
+
+            /**
+              \brief Adds the message to the pending ones, called inside the strand
+            */
+            void enqueue(const std::shared_ptr<umi::log::log_message> &message) {
+                if (!m_isOpen && m_pendingBytes > m_loggerInfo.get_pending_limit()) {
+                    m_pendingBytes -= message->get_data().size();
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    complete_messages(1);
+                    return;
+                }
+                m_pending.push_back(message);
+                watch_failover();
+                if (m_writing) {
+                    return;
+                }
+                if (m_lingering) {
+                    // Nothing to do until the batch is full or the linger expires
+                    m_lingerBytes += message->get_data().size();
+                    if (m_pending.size() < get_batch_room() && m_lingerBytes <= m_loggerInfo.get_batch_bytes()) {
+                        return;
+                    }
+                }
+                write_next();
+            }
+
+            /**
+              \brief Gets the messages a batch can take
+            */
+            std::size_t get_batch_room() const {
+                const uint32_t _messages = m_loggerInfo.get_batch_messages();
+                return std::min<std::size_t>(get_write_room(), _messages == 0 ?
+                                                               std::numeric_limits<std::size_t>::max() : _messages);
+            }
+
+            /**
+              \brief Writes the first pending messages as a batch if any, or lingers for more
+            */
+            void write_next() {
+                m_writing = false;
+                m_writeStarted = 0;
+                const std::size_t _room = get_batch_room();
+                if (!m_isOpen || m_pending.empty() || _room == 0) {
+                    return;
+                }
+                // At least one message, a bigger one is written alone
+                std::size_t _count = 0;
+                std::size_t _bytes = 0;
+                while (_count < m_pending.size() && _count < _room &&
+                       (_count == 0 ||
+                        _bytes + m_pending[_count]->get_data().size() <= m_loggerInfo.get_batch_bytes())) {
+                    _bytes += m_pending[_count++]->get_data().size();
+                }
+                const auto _now = std::chrono::steady_clock::now();
+                const auto _linger = m_loggerInfo.get_batch_linger();
+                if (_count == m_pending.size() && _count < _room && !m_lingerExpired && _linger.count() > 0 &&
+                    _now - std::chrono::steady_clock::time_point(
+                            std::chrono::steady_clock::duration(m_lastSuccess.load())) < _linger) {
+                    // Under load, the batch waits for more messages
+                    if (!m_lingering) {
+                        start_linger(_linger);
+                    }
+                    m_lingerBytes = _bytes;
+                    return;
+                }
+                if (m_lingering) {
+                    m_lingering = false;
+                    m_lingerTimer.cancel();
+                }
+                m_lingerExpired = false;
+                m_writing = true;
+                m_writeStarted = _now.time_since_epoch().count();
+                m_inFlight = _count;
+                write_messages();
+            }
+
+            /**
+              \brief Writes the batch when the linger expires
+            */
+            void start_linger(std::chrono::microseconds linger) {
+                m_lingering = true;
+                const uint64_t _linger = ++m_lingerCount;
+                m_lingerTimer.expires_from_now(linger);
+                m_lingerTimer.async_wait(m_strand.wrap([this, _linger](const boost::system::error_code &error) {
+                    if (error || !m_lingering || _linger != m_lingerCount) {
+                        return;
+                    }
+                    m_lingering = false;
+                    m_lingerExpired = true;
+                    write_next();
+                }));
+            }
+
+            /**
+              \brief Completion of the write of the messages in flight
+            */
+            void handle_write(const boost::system::error_code &error, std::size_t size) {
+                if (!m_writing) {
+                    return; // the connection failed meanwhile, handle_error took the batch
+                }
+                if (error) {
+                    handle_error();
+                    return;
+                }
+                const auto _now = std::chrono::steady_clock::now();
+                m_lastSuccess = _now.time_since_epoch().count();
+                m_written.fetch_add(m_inFlight, std::memory_order_relaxed);
+                const std::chrono::steady_clock::time_point _started(
+                        std::chrono::steady_clock::duration(m_writeStarted.load()));
+                for (std::size_t i = 0; i < m_inFlight; ++i) {
+                    const auto &_message = m_pending[i];
+                    if (!m_retransmit && _message->get_crash_id() != 0 && _message->count_crash_writer()) {
+                        umi::log::crash_handler::confirm(_message->get_crash_id()); // else it waits for the ack
+                    }
+                    if (_message->get_enqueued() != std::chrono::steady_clock::time_point()) {
+                        m_pendingLatency.record(_started - _message->get_dequeued());
+                        m_writeLatency.record(_now - _started);
+                        m_totalLatency.record(_now - _message->get_enqueued());
+                    }
+                }
+                m_writtenBytes.fetch_add(size, std::memory_order_relaxed);
+                m_batches.fetch_add(1, std::memory_order_relaxed);
+                for (std::size_t i = 0; i < m_inFlight; ++i) {
+                    m_pendingBytes -= m_pending.front()->get_data().size();
+                    m_pending.pop_front();
+                }
+                if (!m_retransmit) {
+                    complete_messages(m_inFlight); // else they are done when confirmed
+                }
+                write_next();
+            }
+
+            /**
+              \brief Counts the messages done and calls the waiters reached, called inside the strand
+            */
+            void complete_messages(std::size_t count) {
+                m_done += count;
+                for (auto i = m_doneWaiters.begin(); i != m_doneWaiters.end();) {
+                    if (i->first <= m_done) {
+                        const std::function<void()> _handler = std::move(i->second);
+                        i = m_doneWaiters.erase(i);
+                        _handler();
+                    } else {
+                        ++i;
+                    }
+                }
+            }
+
+            /**
+              \brief Gets how many messages the connection accepts in the next write, called inside the strand
+            */
+            virtual std::size_t get_write_room() const {
+                return std::numeric_limits<std::size_t>::max();
+            }
+
+            /**
+              \brief Moves the messages sent and not confirmed back to the pending ones, it is
+              called on errors if the connection retransmits
+            */
+            virtual void requeue_unconfirmed() { }
+
+            /**
+              \brief Closes the connection after an error and schedules the reconnection
+            */
+            void handle_error() {
+                if (m_closed) {
+                    return; // an operation aborted by close()
+                }
+                ++m_errors;
+                if (m_retransmit) {
+                    requeue_unconfirmed();
+                }
+                // The failover group takes the messages, else they wait for the reconnection or are lost
+                if (!fail_over(true) && !m_retransmit) {
+                    drop_pending();
+                }
+                m_isOpen = false;
+                m_writing = false;
+                m_writeStarted = 0;
+                m_lingering = false;
+                m_lingerExpired = false;
+                m_lingerTimer.cancel();
+                m_reconnectTimer.expires_from_now(m_loggerInfo.get_reconnect_interval());
+                m_reconnectTimer.async_wait(m_strand.wrap([this](const boost::system::error_code &error) {
+                    if (!error && !m_closed) {
+                        m_refreshAddresses = true;
+                        m_reconnects.fetch_add(1, std::memory_order_relaxed);
+                        this->open();
+                    }
+                }));
+            }
+
+            /**
+              \brief Drops the pending messages, they are done for the flushes
+            */
+            void drop_pending() {
+                for (auto &i: m_pending) {
+                    m_pendingBytes -= i->get_data().size();
+                }
+                m_dropped.fetch_add(m_pending.size(), std::memory_order_relaxed);
+                complete_messages(m_pending.size());
+                m_pending.clear();
+            }
+
+            /**
+              \brief Gets the first healthy connection of the failover group other than this one
+
+              \param stall receives the stall time of the group
+              \return null if the connection has no group or no other connection is healthy
+            */
+            umi::log::socket *get_failover_target(std::chrono::milliseconds &stall) {
+                std::unique_lock<std::mutex> _lock(m_failoverMutex);
+                if (m_failoverGroups.empty()) {
+                    return nullptr;
+                }
+                const failover_group &_group = m_failoverGroups.front();
+                stall = _group.m_stall;
+                for (auto i: _group.m_connections) {
+                    if (i != this && i->is_healthy(_group.m_stall)) {
+                        return i;
+                    }
+                }
+                return nullptr;
+            }
+
+            /**
+              \brief Hands the pending messages to the first healthy connection of the failover group
+
+              They are done here when that connection has done them, so a flush
+              waiting for this one waits for them too. Called inside the strand.
+
+              \param inFlight to hand the batch in flight too, after an error
+              \return false if there is no connection to take them
+            */
+            bool fail_over(bool inFlight) {
+                std::chrono::milliseconds _stall;
+                umi::log::socket *_target = get_failover_target(_stall);
+                if (!_target) {
+                    return false;
+                }
+                const std::size_t _first = m_writing && !inFlight ? m_inFlight : 0;
+                if (m_pending.size() <= _first) {
+                    return true;
+                }
+                const std::size_t _count = m_pending.size() - _first;
+                for (std::size_t i = _first; i < m_pending.size(); ++i) {
+                    m_pendingBytes -= m_pending[i]->get_data().size();
+                    _target->send(m_pending[i]);
+                }
+                m_pending.erase(m_pending.begin() + static_cast<std::ptrdiff_t>(_first), m_pending.end());
+                _target->when_done(_target->get_sent(), [this, _count]() {
+                    m_strand.post([this, _count]() { this->complete_messages(_count); });
+                });
+                return true;
+            }
+
+            /**
+              \brief Checks the health every stall time while there are messages, the ones
+              waiting in a stalled or closed connection go to the failover group. Called
+              inside the strand.
+            */
+            void watch_failover() {
+                if (m_failoverWatch) {
+                    return;
+                }
+                std::chrono::milliseconds _stall;
+                {
+                    std::unique_lock<std::mutex> _lock(m_failoverMutex);
+                    if (m_failoverGroups.empty()) {
+                        return;
+                    }
+                    _stall = m_failoverGroups.front().m_stall;
+                }
+                m_failoverWatch = true;
+                m_failoverTimer.expires_from_now(_stall);
+                m_failoverTimer.async_wait(m_strand.wrap([this, _stall](const boost::system::error_code &error) {
+                    m_failoverWatch = false;
+                    if (error) {
+                        return;
+                    }
+                    if (!is_healthy(_stall)) {
+                        fail_over(false);
+                    }
+                    if (!m_pending.empty() || m_writing) {
+                        watch_failover();
+                    }
+                }));
+            }
+
+            /**
+              \brief Gets the addresses of the host and calls handler(error, addresses) with them
+
+              The cached addresses are used at once if there are, the host is
+              resolved again in the background when they have expired or the
+              connection is being opened again. Called inside the strand, or by
+              the constructor.
+            */
+            template<typename Protocol, typename Handler>
+            void resolve(Handler handler) {
+                std::vector<boost::asio::ip::address> _addresses;
+                bool _refresh = false;
+                const bool _cached = umi::log::endpoint_cache::get_instance().get(
+                        m_loggerInfo.get_host(), m_refreshAddresses, _addresses, _refresh);
+                m_refreshAddresses = false;
+                if (!_cached) {
+                    lookup<Protocol>(handler);
+                    return;
+                }
+                if (_refresh) {
+                    lookup<Protocol>([](const boost::system::error_code &,
+                                        const std::vector<boost::asio::ip::address> &) { });
+                }
+                handler(boost::system::error_code(), _addresses);
+            }
+
+            /**
+              \brief Resolves the host without blocking and stores the addresses in the cache
+            */
+            template<typename Protocol, typename Handler>
+            void lookup(Handler handler) {
+                auto _resolver = std::make_shared<typename Protocol::resolver>(m_ioservice);
+                typename Protocol::resolver::query _query(m_loggerInfo.get_host(),
+                                                          boost::lexical_cast<std::string>(m_loggerInfo.get_port()));
+                const std::string _host = m_loggerInfo.get_host();
+                const std::chrono::seconds _ttl = m_loggerInfo.get_dns_ttl();
+                _resolver->async_resolve(_query, m_strand.wrap(
+                        [this, _resolver, _host, _ttl, handler](const boost::system::error_code &error,
+                                                                typename Protocol::resolver::iterator endpoint) {
+                            std::vector<boost::asio::ip::address> _addresses;
+                            for (; !error && endpoint != typename Protocol::resolver::iterator(); ++endpoint) {
+                                _addresses.push_back(endpoint->endpoint().address());
+                            }
+                            if (_addresses.empty()) {
+                                umi::log::endpoint_cache::get_instance().refresh_failed(_host);
+                                if (!m_closed) {
+                                    handler(error ? error : boost::asio::error::host_not_found, _addresses);
+                                }
+                                return;
+                            }
+                            umi::log::endpoint_cache::get_instance().put(_host, _addresses, _ttl);
+                            if (!m_closed) {
+                                handler(error, _addresses);
+                            }
+                        }));
+            }
+
+            /**
+              \brief Builds the endpoints of the connection for the addresses of the host
+            */
+            template<typename Endpoint>
+            std::vector<Endpoint> get_endpoints(const std::vector<boost::asio::ip::address> &addresses) const {
+                std::vector<Endpoint> _endpoints;
+                for (auto &i: addresses) {
+                    _endpoints.emplace_back(i, static_cast<unsigned short>(m_loggerInfo.get_port()));
+                }
+                return _endpoints;
+            }
+
+            /**
+             * Io service running the connection
+             * */
+            boost::asio::io_service &m_ioservice;
+            /**
+             * Information to use in the connection, a copy as the socket may outlive its logger
+             * */
+            const umi::log::connection m_loggerInfo;
+            /**
+             * Strand where the work of the connection runs
+             * */
+            boost::asio::io_service::strand m_strand;
+            /**
+             * Flag to describe if the socket is open or not
+             * */
+            std::atomic_bool m_isOpen{false};
+            /**
+             * Flag to mark there is one write in flight
+             * */
+            bool m_writing = false;
+            /**
+             * The connection has been closed with close(), no logger uses it
+             * */
+            bool m_closed = false;
+            /**
+             * Messages waiting to be written, the first ones are in flight
+             * */
+            std::deque<std::shared_ptr<umi::log::log_message>> m_pending;
+            /**
+             * Number of pending messages in the write in flight
+             * */
+            std::size_t m_inFlight = 1;
+            /**
+             * Bytes of the messages sent and not written yet
+             * */
+            std::atomic<std::size_t> m_pendingBytes{0};
+            /**
+             * Messages sent to the connection
+             * */
+            std::atomic<uint64_t> m_sent{0};
+            /**
+             * Messages done, written or dropped, or acked if the connection retransmits
+             * */
+            uint64_t m_done = 0;
+            /**
+             * Flushes waiting for a number of messages done
+             * */
+            std::vector<std::pair<uint64_t, std::function<void()>>> m_doneWaiters;
+            /**
+             * Steady clock ticks when the write in flight started, 0 if there is none
+             * */
+            std::atomic<std::chrono::steady_clock::rep> m_writeStarted{0};
+            /**
+             * Steady clock ticks of the last completed write
+             * */
+            std::atomic<std::chrono::steady_clock::rep> m_lastSuccess{0};
+            /**
+             * Connections and writes failed
+             * */
+            std::atomic<uint64_t> m_errors{0};
+            /**
+             * Messages written, retransmissions included
+             * */
+            std::atomic<uint64_t> m_written{0};
+            /**
+             * Bytes written, framing included
+             * */
+            std::atomic<uint64_t> m_writtenBytes{0};
+            /**
+             * Writes completed
+             * */
+            std::atomic<uint64_t> m_batches{0};
+            /**
+             * Messages lost by errors or by the pending limit
+             * */
+            std::atomic<uint64_t> m_dropped{0};
+            /**
+             * Connections opened again after an error
+             * */
+            std::atomic<uint64_t> m_reconnects{0};
+            /**
+             * Messages cut to the datagram limit
+             * */
+            std::atomic<uint64_t> m_truncated{0};
+            /**
+             * Time the messages wait in the connection before their write starts
+             * */
+            umi::log::latency_histogram m_pendingLatency;
+            /**
+             * Time the writes take
+             * */
+            umi::log::latency_histogram m_writeLatency;
+            /**
+             * Time from queued to written
+             * */
+            umi::log::latency_histogram m_totalLatency;
+            /**
+             * Timer to open the connection again after an error
+             * */
+            boost::asio::steady_timer m_reconnectTimer;
+            /**
+             * Timer to write a batch not full under load
+             * */
+            boost::asio::steady_timer m_lingerTimer;
+            /**
+             * The batch is waiting for more messages
+             * */
+            bool m_lingering = false;
+            /**
+             * The linger has expired, the next batch is written as it is
+             * */
+            bool m_lingerExpired = false;
+            /**
+             * Bytes of the batch waiting
+             * */
+            std::size_t m_lingerBytes = 0;
+            /**
+             * Lingers started, the handlers of the old ones are ignored
+             * */
+            uint64_t m_lingerCount = 0;
+            /**
+             * The messages without confirmation are sent again after the reconnection
+             * */
+            bool m_retransmit = false;
+            /**
+             * The next resolution has to refresh the cached addresses
+             * */
+            bool m_refreshAddresses = false;
+            /**
+             * Endpoints of the host, the connect operations iterate them
+             * */
+            std::vector<boost::asio::ip::tcp::endpoint> m_endpoints;
+            /**
+             * Failover group joined by a pipeline
+             * */
+            struct failover_group {
+                const void *m_owner; //!< Pipeline that joined the connection
+                std::vector<umi::log::socket *> m_connections; //!< Connections of the group in order
+                std::chrono::milliseconds m_stall; //!< Time a write can take
+            };
+            /**
+             * Mutex used to protect the failover groups
+             * */
+            std::mutex m_failoverMutex;
+            /**
+             * Failover groups of the connection, the first one is used
+             * */
+            std::vector<failover_group> m_failoverGroups;
+            /**
+             * Timer to check the health while there are messages
+             * */
+            boost::asio::steady_timer m_failoverTimer;
+            /**
+             * The health check is scheduled
+             * */
+            bool m_failoverWatch = false;
+        };
+
+        class socket_udp : public socket {
+        public:
+            socket_udp(boost::asio::io_service &ioservice,
+                       const umi::log::connection &loggerInfo)
+                    : socket(ioservice, loggerInfo),
+                      m_socket(std::make_unique<boost::asio::ip::udp::socket>(get_internal_service())) {
+                open();
+            }
+
+            virtual ~socket_udp() {
+                if (m_socket) {
+                    m_socket->close();
+                }
+            }
+
+        protected:
+            void open() {
+                resolve<boost::asio::ip::udp>([this](const boost::system::error_code &error,
+                                                     const std::vector<boost::asio::ip::address> &addresses) {
+                    if (error) {
+                        handle_error();
+                        return;
+                    }
+                    m_endpoint = std::make_unique<boost::asio::ip::udp::endpoint>(
+                            get_endpoints<boost::asio::ip::udp::endpoint>(addresses).front());
+                    boost::system::error_code _error;
+                    m_socket->close(_error);
+                    m_socket->open(m_endpoint->protocol(), _error);
+                    if (_error) {
+                        handle_error();
+                        return;
+                    }
+                    m_datagramLimit = m_loggerInfo.get_datagram_limit() > 0 ? m_loggerInfo.get_datagram_limit() :
+                                      get_path_datagram_limit();
+                    m_isOpen = true;
+                    write_next();
+                });
+            }
+
+            /**
+              \brief Gets the datagram size that is not fragmented to the endpoint (RFC 5426)
+            */
+            std::size_t get_path_datagram_limit() {
+                const bool _v6 = m_endpoint->address().is_v6();
+                std::size_t _limit = _v6 ? 1180 : 480;
+#ifdef __linux__
+                // The route MTU is known once a datagram socket is connected
+                boost::asio::ip::udp::socket _probe(get_internal_service());
+                boost::system::error_code _error;
+                _probe.connect(*m_endpoint, _error);
+                int _mtu = 0;
+                socklen_t _mtuSize = sizeof(_mtu);
+                const std::size_t _headers = _v6 ? 48 : 28; // IP and UDP headers
+                if (!_error && getsockopt(_probe.native_handle(), _v6 ? IPPROTO_IPV6 : IPPROTO_IP,
+                                          _v6 ? IPV6_MTU : IP_MTU, &_mtu, &_mtuSize) == 0 &&
+                    static_cast<std::size_t>(_mtu) > _headers) {
+                    _limit = std::min<std::size_t>(2048, static_cast<std::size_t>(_mtu) - _headers);
+                }
+#endif
+                return _limit;
+            }
+
+            void close_connection() {
+                boost::system::error_code _ignored;
+                m_socket->close(_ignored);
+            }
+
+            std::size_t get_write_room() const {
+                return 1; // each message is one datagram
+            }
+
+            void write_messages() {
+                const auto &_message = m_pending.front();
+                const std::size_t _size = _message->get_truncated_size(m_datagramLimit);
+                if (_size < _message->get_data().size()) {
+                    m_truncated.fetch_add(1, std::memory_order_relaxed);
+                }
+                // There are no partial sends of a datagram
+                m_socket->async_send_to(
+                        boost::asio::buffer(_message->get_data().data(), _size),
+                        *m_endpoint,
+                        m_strand.wrap(std::bind(&umi::log::socket_udp::handle_write, this,
+                                                std::placeholders::_1,
+                                                std::placeholders::_2)));
+            }
+
+            /**
+             * Socket used
+             * */
+            std::unique_ptr<boost::asio::ip::udp::socket> m_socket;
+            /**
+             * Endpoint where we connect
+             * */
+            std::unique_ptr<boost::asio::ip::udp::endpoint> m_endpoint;
+            /**
+             * Bytes of a datagram, the messages are cut to it
+             * */
+            std::size_t m_datagramLimit = 2048;
+        };
+
+        class socket_tcp : public socket {
+        public:
+            socket_tcp(boost::asio::io_service &ioservice,
+                       const umi::log::connection &loggerInfo)
+                    : socket(ioservice, loggerInfo),
+                      m_socket(std::make_unique<boost::asio::ip::tcp::socket>(get_internal_service())) {
+                open();
+            }
+
+            virtual ~socket_tcp() {
+                if (m_socket) {
+                    m_socket->close(); // this is not async
+                }
+            }
+
+            void handle_on_connect(const boost::system::error_code &errorCode) {
+                if (m_socket && !m_closed) {
+                    if (!errorCode) {
+                        boost::asio::socket_base::keep_alive _keepAlive(true);
+                        m_socket->set_option(_keepAlive);
+                        m_isOpen = true;
+                        write_next();
+                    } else {
+                        handle_error();
+                    }
+                }
+            }
+
+        protected:
+            void open() {
+                resolve<boost::asio::ip::tcp>([this](const boost::system::error_code &error,
+                                                     const std::vector<boost::asio::ip::address> &addresses) {
+                    if (error) {
+                        handle_error();
+                        return;
+                    }
+                    boost::system::error_code _ignored;
+                    m_socket->close(_ignored);
+                    // async_connect tries every address of the host
+                    m_endpoints = get_endpoints<boost::asio::ip::tcp::endpoint>(addresses);
+                    boost::asio::async_connect(
+                            *m_socket, m_endpoints.begin(), m_endpoints.end(),
+                            m_strand.wrap(std::bind(&umi::log::socket_tcp::handle_on_connect, this,
+                                                    std::placeholders::_1)));
+                });
+            }
+
+            void close_connection() {
+                boost::system::error_code _ignored;
+                m_socket->close(_ignored);
+            }
+
+            void write_messages() {
+                // One gathered write for the batch, async_write keeps writing until it is all in the socket.
+                // Every message goes with its length (octet counting, RFC 6587)
+                m_headers.resize(m_inFlight);
+                m_buffers.clear();
+                for (std::size_t i = 0; i < m_inFlight; ++i) {
+                    const auto &_data = m_pending[i]->get_data();
+                    std::string &_header = m_headers[i];
+                    _header = boost::lexical_cast<std::string>(_data.size());
+                    _header += ' ';
+                    m_buffers.push_back(boost::asio::buffer(_header));
+                    m_buffers.push_back(boost::asio::buffer(_data));
+                }
+                boost::asio::async_write(
+                        *m_socket,
+                        m_buffers,
+                        m_strand.wrap(std::bind(&umi::log::socket_tcp::handle_write, this,
+                                                std::placeholders::_1,
+                                                std::placeholders::_2)));
+            }
+
+            /**
+             * The tcp socket
+             * */
+            std::unique_ptr<boost::asio::ip::tcp::socket> m_socket;
+            /**
+             * Lengths of the messages of the batch in flight
+             * */
+            std::vector<std::string> m_headers;
+            /**
+             * Buffers of the batch in flight
+             * */
+            std::vector<boost::asio::const_buffer> m_buffers;
+        };
+
+        class socket_tls : public socket {
+        public:
+            socket_tls(boost::asio::io_service &ioservice,
+                       const umi::log::connection &loggerInfo)
+                    : socket(ioservice, loggerInfo),
+                      m_sslContext(umi::log::tls_context::get(loggerInfo.get_TLS_CA_file())),
+                      m_socket() {
+                open();
+            }
+
+            virtual ~socket_tls() {
+                if (m_socket) {
+                    boost::system::error_code _ignored;
+                    m_socket->lowest_layer().close(_ignored); // this is not async
+                }
+            }
+
+            void handle_on_connect(uint64_t generation, const boost::system::error_code &errorCode) {
+                if (generation != m_generation) {
+                    return;
+                }
+                if (!errorCode) {
+                    boost::asio::socket_base::keep_alive _keepAlive(true);
+                    m_socket->lowest_layer().set_option(_keepAlive);
+                    m_socket->async_handshake(boost::asio::ssl::stream_base::client,
+                                              m_strand.wrap(std::bind(&umi::log::socket_tls::handle_on_handshake,
+                                                                      this,
+                                                                      generation,
+                                                                      std::placeholders::_1)));
+                } else {
+                    handle_error();
+                }
+            }
+
+            void handle_on_handshake(uint64_t generation, const boost::system::error_code &error) {
+                if (generation != m_generation) {
+                    return;
+                }
+                if (!error) {
+                    m_isOpen = true;
+                    read();
+                    write_next();
+                } else {
+                    handle_error();
+                }
+            }
+
+            /**
+              \brief Checks if the current connection has resumed the last session
+            */
+            bool is_resumed() {
+                return m_socket && umi::log::tls_session::is_resumed(m_socket->native_handle());
+            }
+
+        protected:
+            typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> tls_stream;
+
+            void open() {
+                // A TLS stream can't be reused after an error, every connection gets a new one. The
+                // handlers share the stream, the old one dies with its last handler
+                ++m_generation;
+                if (m_socket) {
+                    boost::system::error_code _ignored;
+                    m_socket->lowest_layer().close(_ignored);
+                }
+                m_socket = std::make_shared<tls_stream>(get_internal_service(), *m_sslContext);
+                m_tlsSession.attach(m_socket->native_handle(), m_loggerInfo.get_host());
+                const uint64_t _generation = m_generation;
+                resolve<boost::asio::ip::tcp>([this, _generation](
+                        const boost::system::error_code &error,
+                        const std::vector<boost::asio::ip::address> &addresses) {
+                    if (_generation != m_generation) {
+                        return;
+                    }
+                    if (error) {
+                        handle_error();
+                        return;
+                    }
+                    m_endpoints = get_endpoints<boost::asio::ip::tcp::endpoint>(addresses);
+                    boost::asio::async_connect(
+                            m_socket->lowest_layer(), m_endpoints.begin(), m_endpoints.end(),
+                            m_strand.wrap(std::bind(&umi::log::socket_tls::handle_on_connect,
+                                                    this,
+                                                    _generation,
+                                                    std::placeholders::_1)));
+                });
+            }
+
+            /**
+              \brief Reads the collector, it only sends session tickets and the close
+            */
+            void read() {
+                const uint64_t _generation = m_generation;
+                auto _stream = m_socket;
+                m_socket->async_read_some(
+                        boost::asio::buffer(m_readBuffer),
+                        m_strand.wrap([this, _generation, _stream](const boost::system::error_code &error,
+                                                                   std::size_t) {
+                            if (_generation != m_generation || !m_isOpen) {
+                                return;
+                            }
+                            if (error) {
+                                handle_error();
+                            } else {
+                                read();
+                            }
+                        }));
+            }
+
+            void close_connection() {
+                ++m_generation; // the handlers in progress are ignored
+                if (m_socket) {
+                    boost::system::error_code _ignored;
+                    m_socket->lowest_layer().close(_ignored);
+                }
+            }
+
+            void write_messages() {
+                // The batch shares the records, with the default batch bytes it is encrypted as one record.
+                // Every message goes with its length (octet counting, RFC 5425)
+                m_record.clear();
+                for (std::size_t i = 0; i < m_inFlight; ++i) {
+                    const auto &_data = m_pending[i]->get_data();
+                    m_record += boost::lexical_cast<std::string>(_data.size());
+                    m_record += ' ';
+                    m_record += _data;
+                }
+                // The encryption runs here, inside the strand of this connection
+                const uint64_t _generation = m_generation;
+                auto _stream = m_socket;
+                boost::asio::async_write(
+                        *m_socket,
+                        boost::asio::buffer(m_record),
+                        m_strand.wrap([this, _generation, _stream](const boost::system::error_code &error,
+                                                                   std::size_t size) {
+                            if (_generation == m_generation && m_isOpen) {
+                                handle_write(error, size);
+                            }
+                        }));
+            }
+
+            /**
+             * SSL context used in the connection, shared by the connections with the same CA
+             * */
+            std::shared_ptr<boost::asio::ssl::context> m_sslContext;
+            /**
+             * Socket used in the connection
+             * */
+            std::shared_ptr<tls_stream> m_socket;
+            /**
+             * Session resumed when the connection opens again
+             * */
+            umi::log::tls_session m_tlsSession;
+            /**
+             * Connection attempt, the handlers of the old ones are ignored
+             * */
+            uint64_t m_generation = 0;
+            /**
+             * Batch in flight, the stream encrypts each buffer in its own records
+             * */
+            std::string m_record;
+            /**
+             * Buffer for the reads
+             * */
+            std::array<char, 512> m_readBuffer;
+        };
+
+        /**
+          \brief RELP connection, plain or over TLS
+
+          Every message is a numbered transaction, up to the window of them
+          wait for the ack of the collector at the same time. The messages
+          without ack when the connection fails are sent again after the
+          reconnection, so a message may arrive twice but is not lost.
+        */
+        class socket_relp : public socket {
+        public:
+            socket_relp(boost::asio::io_service &ioservice,
+                        const umi::log::connection &loggerInfo)
+                    : socket(ioservice, loggerInfo) {
+                m_retransmit = true;
+                if (loggerInfo.get_connection_type() == umi::log::connection::connection_type::RELP_TLS) {
+                    m_sslContext = umi::log::tls_context::get(loggerInfo.get_TLS_CA_file());
+                }
+                open();
+            }
+
+            virtual ~socket_relp() {
+                boost::system::error_code _ignored;
+                get_lowest_layer().close(_ignored);
+            }
+
+            /**
+              \brief Checks too that the oldest transaction without ack is not older than stall, a
+              collector that stops acking fills the window with no write in flight
+            */
+            bool is_healthy(std::chrono::milliseconds stall) const {
+                if (!socket::is_healthy(stall)) {
+                    return false;
+                }
+                const std::chrono::steady_clock::rep _oldest = m_oldestUnconfirmed;
+                return _oldest == 0 ||
+                       std::chrono::steady_clock::now().time_since_epoch() -
+                       std::chrono::steady_clock::duration(_oldest) < stall;
+            }
+
+            /**
+              \brief Sends the close command, handler is called with its response
+
+              A session with a write in flight is not closed, the collector
+              could not take the last messages anyway.
+            */
+            void close_session(const std::function<void()> &handler) {
+                m_strand.post([this, handler]() {
+                    if (!m_isOpen || m_writing) {
+                        handler();
+                        return;
+                    }
+                    m_closeHandler = handler;
+                    m_txnr = m_txnr >= 999999999 ? 1 : m_txnr + 1;
+                    m_closeTxnr = m_txnr;
+                    m_header = boost::lexical_cast<std::string>(m_txnr);
+                    m_header += " close 0\n";
+                    const uint64_t _session = m_session;
+                    write_frame(boost::asio::buffer(m_header),
+                                [this, _session](const boost::system::error_code &error, std::size_t) {
+                                    if (_session == m_session && error) {
+                                        handle_closed();
+                                    }
+                                });
+                });
+            }
+
+        protected:
+            typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> tls_stream;
+            typedef std::vector<boost::asio::ip::tcp::endpoint>::iterator endpoint_iterator;
+
+            /**
+              \brief Gets the tcp socket under the RELP session
+            */
+            boost::asio::ip::tcp::socket &get_lowest_layer() {
+                return m_tlsSocket ? m_tlsSocket->next_layer() : *m_socket;
+            }
+
+            /**
+              \brief Writes a frame in the plain or the TLS stream, the handler keeps the stream alive
+            */
+            template<typename Buffers, typename Handler>
+            void write_frame(const Buffers &buffers, Handler handler) {
+                if (m_tlsSocket) {
+                    auto _stream = m_tlsSocket;
+                    boost::asio::async_write(*_stream, buffers, m_strand.wrap(
+                            [_stream, handler](const boost::system::error_code &error, std::size_t size) {
+                                handler(error, size);
+                            }));
+                } else {
+                    auto _stream = m_socket;
+                    boost::asio::async_write(*_stream, buffers, m_strand.wrap(
+                            [_stream, handler](const boost::system::error_code &error, std::size_t size) {
+                                handler(error, size);
+                            }));
+                }
+            }
+
+            void open() {
+                ++m_session; // the handlers of the last session are ignored
+                m_input.clear();
+                m_txnr = 0;
+                if (m_socket || m_tlsSocket) {
+                    boost::system::error_code _ignored;
+                    get_lowest_layer().close(_ignored);
+                }
+                // The streams are shared with their handlers, the old one dies with its last handler
+                if (m_sslContext) {
+                    m_tlsSocket = std::make_shared<tls_stream>(get_internal_service(), *m_sslContext);
+                    m_tlsSession.attach(m_tlsSocket->native_handle(), m_loggerInfo.get_host());
+                } else {
+                    m_socket = std::make_shared<boost::asio::ip::tcp::socket>(get_internal_service());
+                }
+                const uint64_t _session = m_session;
+                resolve<boost::asio::ip::tcp>([this, _session](const boost::system::error_code &error,
+                                                               const std::vector<boost::asio::ip::address> &addresses) {
+                    if (_session != m_session) {
+                        return;
+                    }
+                    if (error) {
+                        handle_error();
+                        return;
+                    }
+                    connect(addresses);
+                });
+            }
+
+            /**
+              \brief Connects to the addresses of the host and opens the session
+            */
+            void connect(const std::vector<boost::asio::ip::address> &addresses) {
+                const uint64_t _session = m_session;
+                auto _tlsStream = m_tlsSocket;
+                auto _stream = m_socket;
+                m_endpoints = get_endpoints<boost::asio::ip::tcp::endpoint>(addresses);
+                boost::asio::async_connect(
+                        get_lowest_layer(), m_endpoints.begin(), m_endpoints.end(),
+                        m_strand.wrap([this, _session, _tlsStream, _stream](const boost::system::error_code &error,
+                                                                            endpoint_iterator) {
+                            if (_session != m_session) {
+                                return;
+                            }
+                            if (error) {
+                                handle_error();
+                                return;
+                            }
+                            boost::asio::socket_base::keep_alive _keepAlive(true);
+                            get_lowest_layer().set_option(_keepAlive);
+                            if (!m_tlsSocket) {
+                                start_session();
+                                return;
+                            }
+                            m_tlsSocket->async_handshake(
+                                    boost::asio::ssl::stream_base::client,
+                                    m_strand.wrap([this, _session, _tlsStream](const boost::system::error_code &error) {
+                                        if (_session != m_session) {
+                                            return;
+                                        }
+                                        if (error) {
+                                            handle_error();
+                                        } else {
+                                            start_session();
+                                        }
+                                    }));
+                        }));
+            }
+
+            /**
+              \brief Sends the open command, the messages wait until its ack
+            */
+            void start_session() {
+                static const char _offers[] = "relp_version=0\nrelp_software=umilog\ncommands=syslog";
+                m_header = "1 open ";
+                m_header += boost::lexical_cast<std::string>(sizeof(_offers) - 1);
+                m_header += ' ';
+                m_header.append(_offers, sizeof(_offers) - 1);
+                m_header += '\n';
+                m_txnr = 1;
+                read();
+                const uint64_t _session = m_session;
+                write_frame(boost::asio::buffer(m_header),
+                            [this, _session](const boost::system::error_code &error, std::size_t) {
+                                if (_session == m_session && error) {
+                                    handle_error();
+                                }
+                            });
+            }
+
+            void close_connection() {
+                ++m_session; // the handlers in progress are ignored
+                m_input.clear();
+                if (m_closeTxnr != 0) {
+                    handle_closed(); // a close command without response
+                } else {
+                    boost::system::error_code _ignored;
+                    get_lowest_layer().close(_ignored);
+                }
+            }
+
+            std::size_t get_write_room() const {
+                const std::size_t _window = std::max<uint32_t>(1, m_loggerInfo.get_relp_window());
+                return _window > m_unconfirmed.size() ? _window - m_unconfirmed.size() : 0;
+            }
+
+            void write_messages() {
+                // The frames of the batch go in one gathered write
+                m_headers.resize(m_inFlight);
+                m_buffers.clear();
+                for (std::size_t i = 0; i < m_inFlight; ++i) {
+                    const auto &_message = m_pending[i];
+                    m_txnr = m_txnr >= 999999999 ? 1 : m_txnr + 1;
+                    m_unconfirmed.push_back(unconfirmed_message{m_txnr, _message, m_writeStarted.load()});
+                    std::string &_header = m_headers[i];
+                    _header = boost::lexical_cast<std::string>(m_txnr);
+                    _header += " syslog ";
+                    _header += boost::lexical_cast<std::string>(_message->get_data().size());
+                    _header += ' ';
+                    m_buffers.push_back(boost::asio::buffer(_header));
+                    m_buffers.push_back(boost::asio::buffer(_message->get_data()));
+                    m_buffers.push_back(boost::asio::buffer("\n", 1));
+                }
+                const uint64_t _session = m_session;
+                update_oldest_unconfirmed();
+                write_frame(m_buffers, [this, _session](const boost::system::error_code &error, std::size_t size) {
+                    if (_session == m_session) {
+                        handle_write(error, size);
+                    }
+                });
+            }
+
+            void requeue_unconfirmed() {
+                // The batch in flight is at the end of the window and it is still pending
+                if (m_writing) {
+                    const auto _inFlightEnd = m_pending.begin() + static_cast<std::ptrdiff_t>(m_inFlight);
+                    while (!m_unconfirmed.empty() &&
+                           std::find(m_pending.begin(), _inFlightEnd, m_unconfirmed.back().m_message) != _inFlightEnd) {
+                        m_unconfirmed.pop_back();
+                    }
+                }
+                for (auto i = m_unconfirmed.rbegin(); i != m_unconfirmed.rend(); ++i) {
+                    m_pendingBytes += i->m_message->get_data().size();
+                    m_pending.push_front(i->m_message);
+                }
+                m_unconfirmed.clear();
+                update_oldest_unconfirmed();
+            }
+
+            /**
+              \brief Keeps the write time of the oldest transaction without ack for the health checks
+            */
+            void update_oldest_unconfirmed() {
+                m_oldestUnconfirmed = m_unconfirmed.empty() ? 0 : m_unconfirmed.front().m_sent;
+            }
+
+            /**
+              \brief The close command has been answered or has failed
+            */
+            void handle_closed() {
+                m_isOpen = false;
+                m_closeTxnr = 0;
+                boost::system::error_code _ignored;
+                get_lowest_layer().close(_ignored);
+                if (m_closeHandler) {
+                    auto _handler = std::move(m_closeHandler);
+                    m_closeHandler = nullptr;
+                    _handler();
+                }
+            }
+
+            /**
+              \brief Reads the responses of the collector
+            */
+            void read() {
+                const uint64_t _session = m_session;
+                auto _handler = m_strand.wrap([this, _session](const boost::system::error_code &error,
+                                                               std::size_t size) {
+                    if (_session != m_session) {
+                        return;
+                    }
+                    if (error && m_closeTxnr != 0) {
+                        handle_closed(); // the collector closed before answering
+                        return;
+                    }
+                    if (error) {
+                        handle_error();
+                        return;
+                    }
+                    m_input.append(m_readBuffer.data(), size);
+                    if (parse_responses() && _session == m_session) {
+                        read();
+                    }
+                });
+                if (m_tlsSocket) {
+                    auto _stream = m_tlsSocket;
+                    m_tlsSocket->async_read_some(boost::asio::buffer(m_readBuffer),
+                                                 [_stream, _handler](const boost::system::error_code &error,
+                                                                     std::size_t size) mutable {
+                                                     _handler(error, size);
+                                                 });
+                } else {
+                    auto _stream = m_socket;
+                    m_socket->async_read_some(boost::asio::buffer(m_readBuffer),
+                                              [_stream, _handler](const boost::system::error_code &error,
+                                                                  std::size_t size) mutable {
+                                                  _handler(error, size);
+                                              });
+                }
+            }
+
+            /**
+              \brief Processes the complete frames read
+
+              \return false if the session has failed
+            */
+            bool parse_responses() {
+                std::size_t _begin = 0;
+                while (true) {
+                    // TXNR SP COMMAND SP DATALEN [SP DATA] TRAILER
+                    const std::size_t _command = m_input.find(' ', _begin);
+                    const std::size_t _length = _command == std::string::npos ?
+                                                std::string::npos : m_input.find(' ', _command + 1);
+                    if (_length == std::string::npos) {
+                        break;
+                    }
+                    std::size_t _data = _length + 1;
+                    uint64_t _dataSize = 0;
+                    while (_data < m_input.size() && m_input[_data] >= '0' && m_input[_data] <= '9') {
+                        _dataSize = _dataSize * 10 + static_cast<uint64_t>(m_input[_data++] - '0');
+                    }
+                    if (_data >= m_input.size()) {
+                        break;
+                    }
+                    if (_dataSize > 0) {
+                        ++_data; // separator before the data
+                    }
+                    if (_data + _dataSize >= m_input.size()) {
+                        break;
+                    }
+                    const uint32_t _txnr = static_cast<uint32_t>(std::strtoul(m_input.c_str() + _begin, nullptr, 10));
+                    const std::string _name(m_input, _command + 1, _length - _command - 1);
+                    const bool _ok = _dataSize >= 3 && m_input.compare(_data, 3, "200") == 0;
+                    _begin = _data + _dataSize + 1;
+                    if (m_closeTxnr != 0 && (_txnr == m_closeTxnr || _name == "serverclose")) {
+                        handle_closed(); // the session is over, whatever the response
+                        return false;
+                    }
+                    if (_name != "rsp" || !_ok) {
+                        // serverclose or an error, the messages without ack are sent again
+                        handle_error();
+                        return false;
+                    }
+                    handle_ack(_txnr);
+                }
+                m_input.erase(0, _begin);
+                return true;
+            }
+
+            /**
+              \brief A transaction has been confirmed by the collector
+            */
+            void handle_ack(uint32_t txnr) {
+                if (!m_isOpen) {
+                    if (txnr == 1) {
+                        m_isOpen = true; // the session is open
+                        write_next();
+                    }
+                    return;
+                }
+                for (auto i = m_unconfirmed.begin(); i != m_unconfirmed.end(); ++i) {
+                    if (i->m_txnr == txnr) {
+                        if (i->m_message->get_crash_id() != 0 && i->m_message->count_crash_writer()) {
+                            umi::log::crash_handler::confirm(i->m_message->get_crash_id());
+                        }
+                        m_unconfirmed.erase(i);
+                        update_oldest_unconfirmed();
+                        complete_messages(1);
+                        break;
+                    }
+                }
+                if (!m_writing && m_closeTxnr == 0) {
+                    write_next();
+                }
+            }
+
+            /**
+             * SSL context used in RELP over TLS, null otherwise
+             * */
+            std::shared_ptr<boost::asio::ssl::context> m_sslContext;
+            /**
+             * Session resumed when the connection opens again
+             * */
+            umi::log::tls_session m_tlsSession;
+            /**
+             * Socket used in plain RELP
+             * */
+            std::shared_ptr<boost::asio::ip::tcp::socket> m_socket;
+            /**
+             * Socket used in RELP over TLS
+             * */
+            std::shared_ptr<tls_stream> m_tlsSocket;
+            /**
+             * Session of the connection, each reconnection starts a new one
+             * */
+            uint64_t m_session = 0;
+            /**
+             * Last transaction number used
+             * */
+            uint32_t m_txnr = 0;
+            /**
+             * Frame of the open command
+             * */
+            std::string m_header;
+            /**
+             * Headers of the frames of the batch in flight
+             * */
+            std::vector<std::string> m_headers;
+            /**
+             * Buffers of the batch in flight
+             * */
+            std::vector<boost::asio::const_buffer> m_buffers;
+            /**
+             * Message sent waiting for its ack
+             * */
+            struct unconfirmed_message {
+                uint32_t m_txnr; //!< Transaction number
+                std::shared_ptr<umi::log::log_message> m_message; //!< Message sent
+                std::chrono::steady_clock::rep m_sent; //!< Time its write started
+            };
+            /**
+             * Messages sent waiting for their ack, in transaction order
+             * */
+            std::deque<unconfirmed_message> m_unconfirmed;
+            /**
+             * Write time of the oldest message without ack, 0 if all have it
+             * */
+            std::atomic<std::chrono::steady_clock::rep> m_oldestUnconfirmed{0};
+            /**
+             * Transaction number of the close command, 0 while the session is not closing
+             * */
+            uint32_t m_closeTxnr = 0;
+            /**
+             * Called when the session is closed
+             * */
+            std::function<void()> m_closeHandler;
+            /**
+             * Responses read and not processed yet
+             * */
+            std::string m_input;
+            /**
+             * Buffer for the reads
+             * */
+            std::array<char, 4096> m_readBuffer;
+        };
+
+        /**
+          \brief Factory to create sockets depending on the logger
+          configuration
+        */
+        class socket_factory {
+        public:
+            /**
+              \brief Creates a socket with the desired configuration
+            */
+            static socket *create_socket(boost::asio::io_service &ioservice,
+                                         const umi::log::connection &loggerInfo) {
+                if (loggerInfo.get_connection_type() == umi::log::connection::connection_type::UDP) {
+                    return new umi::log::socket_udp(ioservice, loggerInfo);
+                } else if (loggerInfo.get_connection_type() == umi::log::connection::connection_type::TCP) {
+                    return new umi::log::socket_tcp(ioservice, loggerInfo);
+                } else if (loggerInfo.get_connection_type() == umi::log::connection::connection_type::TLS) {
+                    return new umi::log::socket_tls(ioservice, loggerInfo);
+                } else if (loggerInfo.get_connection_type() == umi::log::connection::connection_type::RELP ||
+                           loggerInfo.get_connection_type() == umi::log::connection::connection_type::RELP_TLS) {
+                    return new umi::log::socket_relp(ioservice, loggerInfo);
+                }
+                return 0;
+            }
+
+        };
+
+        /**
+          \brief Io threads and connections used by the pipelines
+
+          Every pipeline has a private transport unless the logger shares it,
+          then all the sharing loggers of the process use the same io threads
+          and one connection per collector (type, host, port and CA). They
+          must agree on the io threads and on the settings of the connections
+          to a collector, the group aside. A connection is closed when the
+          last logger using it releases it.
+        */
+        class transport {
+        public:
+            /**
+              \brief Starts the io threads
+            */
+            explicit transport(uint32_t threads)
+                    : m_worker(m_ioservice),
+                      m_threads(std::max<uint32_t>(1, threads)) {
+                for (uint32_t i = 0; i < m_threads; ++i) {
+                    m_loggerThreads.emplace_back([this]() { m_ioservice.run(); });
+                }
+            }
+
+            /**
+              \brief Stops the io threads and closes the connections
+            */
+            ~transport() {
+                m_ioservice.stop();// stop the io service
+                for (auto &i: m_loggerThreads) {
+                    i.join(); // join the threads before the connections they use die
+                }
+                m_connections.clear(); // stop the connections
+            }
+
+            /**
+              \brief Gets the transport shared by the process, it is created if no logger uses it
+
+              \param threads io threads of the transport
+              \throw std::invalid_argument if the transport exists with other io threads
+            */
+            static std::shared_ptr<umi::log::transport> get_shared(uint32_t threads) {
+                static std::mutex _sharedMutex;
+                static std::weak_ptr<umi::log::transport> _shared;
+                std::unique_lock<std::mutex> _lock(_sharedMutex);
+                std::shared_ptr<umi::log::transport> _transport = _shared.lock();
+                if (!_transport) {
+                    _transport = std::make_shared<umi::log::transport>(threads);
+                    _shared = _transport;
+                } else if (_transport->m_threads != std::max<uint32_t>(1, threads)) {
+                    throw std::invalid_argument("the shared transport runs with other io threads");
+                }
+                return _transport;
+            }
+
+            /**
+              \brief Gets the io service running the connections
+            */
+            boost::asio::io_service &get_io_service() {
+                return m_ioservice;
+            }
+
+            /**
+              \brief Gets the connection to a collector, it is opened if no logger uses it
+
+              Every call must be paired with release_socket().
+
+              \throw std::invalid_argument if a logger uses the connection with other settings
+            */
+            umi::log::socket &get_socket(const umi::log::connection &loggerInfo) {
+                const connection_key _key(static_cast<int>(loggerInfo.get_connection_type()), loggerInfo.get_host(),
+                                          loggerInfo.get_port(), loggerInfo.get_TLS_CA_file());
+                std::unique_lock<std::mutex> _lock(m_connectionsMutex);
+                connection_entry &_entry = m_connections[_key];
+                if (_entry.m_socket && !is_same_setup(_entry.m_socket->get_connection(), loggerInfo)) {
+                    if (_entry.m_users > 0) {
+                        throw std::invalid_argument("the shared connection to " + loggerInfo.get_host() +
+                                                    " is used with other settings");
+                    }
+                    // Its handlers may still run, it is kept until the transport dies
+                    m_retired.push_back(std::move(_entry.m_socket));
+                }
+                if (!_entry.m_socket) {
+                    _entry.m_socket.reset(umi::log::socket_factory::create_socket(m_ioservice, loggerInfo));
+                } else if (_entry.m_users == 0) {
+                    _entry.m_socket->reopen();
+                }
+                ++_entry.m_users;
+                return *_entry.m_socket;
+            }
+
+            /**
+              \brief Releases a connection got with get_socket(), the last logger using it closes it
+
+              \param socket with the connection
+              \param timeout with the time to wait for the closing handshake of the session
+            */
+            void release_socket(umi::log::socket &socket, std::chrono::milliseconds timeout) {
+                // The lock is held while closing, a logger getting the connection meanwhile waits
+                std::unique_lock<std::mutex> _lock(m_connectionsMutex);
+                for (auto &i: m_connections) {
+                    if (i.second.m_socket.get() == &socket) {
+                        if (--i.second.m_users == 0) {
+                            if (timeout.count() > 0) {
+                                close_sessions(std::vector<umi::log::socket *>{&socket}, timeout);
+                            }
+                            socket.close();
+                        }
+                        return;
+                    }
+                }
+            }
+
+            /**
+              \brief Closes the sessions of the connections, waiting for them up to timeout
+            */
+            void close_sessions(std::vector<umi::log::socket *> connections, std::chrono::milliseconds timeout) {
+                std::sort(connections.begin(), connections.end());
+                connections.erase(std::unique(connections.begin(), connections.end()), connections.end());
+                if (connections.empty()) {
+                    return;
+                }
+                auto _barrier = std::make_shared<umi::log::flush_barrier>(connections.size());
+                for (auto i: connections) {
+                    i->close_session([_barrier]() { _barrier->release(); });
+                }
+                _barrier->get_future().wait_for(timeout);
+            }
+
+            /**
+              \brief Gets the number of connections used by the loggers
+            */
+            std::size_t get_connection_count() {
+                std::unique_lock<std::mutex> _lock(m_connectionsMutex);
+                return static_cast<std::size_t>(std::count_if(
+                        m_connections.begin(), m_connections.end(),
+                        [](const std::pair<const connection_key, connection_entry> &i) {
+                            return i.second.m_users > 0;
+                        }));
+            }
+
+        protected:
+            typedef std::tuple<int, std::string, uint32_t, std::string> connection_key;
+
+            /**
+             * Connection to a collector and the loggers using it
+             * */
+            struct connection_entry {
+                std::unique_ptr<umi::log::socket> m_socket; //!< Connection, closed if nobody uses it
+                std::size_t m_users = 0; //!< Pipelines using the connection
+            };
+
+            /**
+              \brief Checks if two connections to a collector have the same settings, the group aside
+            */
+            static bool is_same_setup(const umi::log::connection &a, const umi::log::connection &b) {
+                return a.get_reconnect_interval() == b.get_reconnect_interval() &&
+                       a.get_relp_window() == b.get_relp_window() &&
+                       a.get_pending_limit() == b.get_pending_limit() &&
+                       a.get_dns_ttl() == b.get_dns_ttl() &&
+                       a.get_batch_bytes() == b.get_batch_bytes() &&
+                       a.get_batch_messages() == b.get_batch_messages() &&
+                       a.get_batch_linger() == b.get_batch_linger() &&
+                       a.get_datagram_limit() == b.get_datagram_limit();
+            }
+
+            /**
+             * The boost io service
+             * */
+            boost::asio::io_service m_ioservice;
+            /**
+             * The worker to keep the io service pending of new messages
+             * */
+            boost::asio::io_service::work m_worker;
+            /**
+             * Number of io threads
+             * */
+            const uint32_t m_threads;
+            /**
+             * Threads used to run the io service
+             * */
+            std::vector<std::thread> m_loggerThreads;
+            /**
+             * Mutex used to protect the connections
+             * */
+            std::mutex m_connectionsMutex;
+            /**
+             * Connections by collector
+             * */
+            std::map<connection_key, connection_entry> m_connections;
+            /**
+             * Connections replaced by others with new settings
+             * */
+            std::vector<std::unique_ptr<umi::log::socket>> m_retired;
+        };
+    }
+}
+
+#endif